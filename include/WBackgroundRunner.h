@@ -0,0 +1,72 @@
+﻿#ifndef WMEDIAKITS_BACKGROUNDRUNNER_H_
+#define WMEDIAKITS_BACKGROUNDRUNNER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wmediakits {
+
+// 进程内共用的后台执行器，替代 “起一个 detach 线程 sleep 一会儿再回调” 的写法：
+//  - 定时任务在一个调度线程上按到期顺序执行，只做很快的内部工作，不跑用户代码
+//  - 可能阻塞的任务（join 播放线程、mpv_terminate_destroy）交给少量工作线程
+//  - 用户回调交给另一组回调线程，不会被卡住的拆除任务挡住，回调里也可以阻塞
+// 所有线程都由执行器持有，Shutdown()（或进程退出时析构）时 join，不会泄漏线程。
+class WBackgroundRunner {
+public:
+    typedef std::function<void()> Task;
+
+    static WBackgroundRunner& Shared();
+
+    explicit WBackgroundRunner(size_t maxWorkers = 4);
+    ~WBackgroundRunner();
+
+    // delayMs 毫秒后在调度线程上执行；Shutdown 后提交的和到时还没到期的会被丢弃
+    void PostDelayed(Task task, int delayMs);
+    // 交给工作线程执行，没有空闲线程时按需新建（不超过 maxWorkers，多出来的排队）；
+    // Shutdown 后提交的直接在调用线程上执行
+    void PostBlocking(Task task);
+    // delayMs 毫秒后交给回调线程执行（调度线程只负责到时转交）。用于所有用户回调；
+    // 回调线程和 PostBlocking 的工作线程各自计数，互不占用。Shutdown 后提交的会被丢弃
+    void PostCallback(Task task, int delayMs = 0);
+
+    // 执行完已排队的阻塞任务后 join 所有线程
+    void Shutdown();
+
+private:
+    WBackgroundRunner(const WBackgroundRunner&) = delete;
+    WBackgroundRunner& operator=(const WBackgroundRunner&) = delete;
+
+    // 一组按需创建的工作线程和它们的队列
+    struct Lane {
+        std::condition_variable  cv;
+        std::deque<Task>         work;
+        std::vector<std::thread> workers;
+        size_t                   idle = 0;
+    };
+
+    void timerFunc();
+    void workerFunc(Lane* lane);
+    void enqueueLocked(Lane& lane, Task task);
+
+    typedef std::chrono::steady_clock Clock;
+
+    const size_t m_maxWorkers;
+
+    std::mutex              m_mx;
+    std::condition_variable m_timerCV;
+    std::multimap<Clock::time_point, Task> m_timers;
+    std::thread              m_timerThread;
+    Lane                     m_blocking;
+    Lane                     m_callbacks;
+    bool                     m_shutdown = false;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_BACKGROUNDRUNNER_H_
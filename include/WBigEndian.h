@@ -1,14 +1,407 @@
 ﻿#ifndef WMEDIAKITS_BIG_ENDIAN_H_
 #define WMEDIAKITS_BIG_ENDIAN_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <stdlib.h>  // _byteswap_*
+#endif
+
+// Pick the widest byte shuffle the compiler is allowed to emit. SSE2 is the
+// x64 baseline; SSSE3 (pshufb) is only used when the build targets it (e.g.
+// -mssse3 or /arch:AVX), so no runtime dispatch is needed.
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define WMEDIAKITS_BYTESWAP_SSSE3 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WMEDIAKITS_BYTESWAP_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define WMEDIAKITS_BYTESWAP_NEON 1
+#endif
+
+// Resolve the byte order at compile time instead of probing memory at runtime.
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#define WMEDIAKITS_BIG_ENDIAN_ARCH (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#elif defined(_WIN32)
+#define WMEDIAKITS_BIG_ENDIAN_ARCH 0  // Every Windows target is little-endian.
+#else
+#error "Cannot determine the byte order of the target architecture."
+#endif
 
 // Returns true if this code is running on a big-endian architecture.
-inline bool IsBigEndianArchitecture() {
-  const uint16_t kTestWord = 0x0100;
-  uint8_t bytes[sizeof(kTestWord)];
-  memcpy(bytes, &kTestWord, sizeof(bytes));
-  return !!bytes[0];
+constexpr bool IsBigEndianArchitecture() {
+  return WMEDIAKITS_BIG_ENDIAN_ARCH != 0;
+}
+
+// Scalar byte swaps. These compile down to a single bswap/rev instruction.
+inline uint16_t ByteSwap16(uint16_t x) {
+#if defined(_MSC_VER)
+  return _byteswap_ushort(x);
+#else
+  return __builtin_bswap16(x);
+#endif
+}
+
+inline uint32_t ByteSwap32(uint32_t x) {
+#if defined(_MSC_VER)
+  return _byteswap_ulong(x);
+#else
+  return __builtin_bswap32(x);
+#endif
+}
+
+inline uint64_t ByteSwap64(uint64_t x) {
+#if defined(_MSC_VER)
+  return _byteswap_uint64(x);
+#else
+  return __builtin_bswap64(x);
+#endif
+}
+
+// Unaligned big-endian loads and stores.
+inline uint16_t ReadBigEndian16(const void* p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return IsBigEndianArchitecture() ? v : ByteSwap16(v);
+}
+
+inline uint32_t ReadBigEndian32(const void* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return IsBigEndianArchitecture() ? v : ByteSwap32(v);
+}
+
+inline uint64_t ReadBigEndian64(const void* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return IsBigEndianArchitecture() ? v : ByteSwap64(v);
+}
+
+inline void WriteBigEndian16(void* p, uint16_t v) {
+  v = IsBigEndianArchitecture() ? v : ByteSwap16(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+inline void WriteBigEndian32(void* p, uint32_t v) {
+  v = IsBigEndianArchitecture() ? v : ByteSwap32(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+inline void WriteBigEndian64(void* p, uint64_t v) {
+  v = IsBigEndianArchitecture() ? v : ByteSwap64(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+// Little-endian counterparts, for on-disk formats that are defined as LE.
+inline uint16_t ReadLittleEndian16(const void* p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return IsBigEndianArchitecture() ? ByteSwap16(v) : v;
+}
+
+inline uint32_t ReadLittleEndian32(const void* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return IsBigEndianArchitecture() ? ByteSwap32(v) : v;
+}
+
+inline uint64_t ReadLittleEndian64(const void* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return IsBigEndianArchitecture() ? ByteSwap64(v) : v;
+}
+
+inline void WriteLittleEndian16(void* p, uint16_t v) {
+  v = IsBigEndianArchitecture() ? ByteSwap16(v) : v;
+  memcpy(p, &v, sizeof(v));
+}
+
+inline void WriteLittleEndian32(void* p, uint32_t v) {
+  v = IsBigEndianArchitecture() ? ByteSwap32(v) : v;
+  memcpy(p, &v, sizeof(v));
+}
+
+inline void WriteLittleEndian64(void* p, uint64_t v) {
+  v = IsBigEndianArchitecture() ? ByteSwap64(v) : v;
+  memcpy(p, &v, sizeof(v));
+}
+
+// Bulk sample byte swaps. |count| is a number of samples, not bytes. |src| and
+// |dst| may be the same buffer (the InPlace variants are thin wrappers), but
+// must not otherwise overlap. No alignment is required.
+inline void ByteSwapSamples16(const void* src, void* dst, size_t count) {
+  const uint8_t* s = static_cast<const uint8_t*>(src);
+  uint8_t* d = static_cast<uint8_t*>(dst);
+  size_t i = 0;
+#if defined(WMEDIAKITS_BYTESWAP_SSE2)
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 2));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i * 2), v);
+  }
+#elif defined(WMEDIAKITS_BYTESWAP_NEON)
+  for (; i + 8 <= count; i += 8) {
+    vst1q_u8(d + i * 2, vrev16q_u8(vld1q_u8(s + i * 2)));
+  }
+#endif
+  for (; i < count; ++i) {
+    const uint8_t b0 = s[i * 2];
+    d[i * 2] = s[i * 2 + 1];
+    d[i * 2 + 1] = b0;
+  }
+}
+
+inline void ByteSwapSamples24(const void* src, void* dst, size_t count) {
+  const uint8_t* s = static_cast<const uint8_t*>(src);
+  uint8_t* d = static_cast<uint8_t*>(dst);
+  size_t i = 0;
+#if defined(WMEDIAKITS_BYTESWAP_SSSE3)
+  // Each step swaps five packed samples (15 bytes) out of a 16-byte load. The
+  // 16th byte is written back unchanged and rewritten by the next step, so
+  // the loop needs one extra sample of headroom.
+  const __m128i kShuffle =
+      _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+  for (; i + 6 <= count; i += 5) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i * 3),
+                     _mm_shuffle_epi8(v, kShuffle));
+  }
+#elif defined(WMEDIAKITS_BYTESWAP_NEON)
+  for (; i + 16 <= count; i += 16) {
+    uint8x16x3_t v = vld3q_u8(s + i * 3);
+    const uint8x16_t msb = v.val[0];
+    v.val[0] = v.val[2];
+    v.val[2] = msb;
+    vst3q_u8(d + i * 3, v);
+  }
+#endif
+  for (; i < count; ++i) {
+    const uint8_t b0 = s[i * 3];
+    d[i * 3 + 1] = s[i * 3 + 1];
+    d[i * 3] = s[i * 3 + 2];
+    d[i * 3 + 2] = b0;
+  }
+}
+
+inline void ByteSwapSamples32(const void* src, void* dst, size_t count) {
+  const uint8_t* s = static_cast<const uint8_t*>(src);
+  uint8_t* d = static_cast<uint8_t*>(dst);
+  size_t i = 0;
+#if defined(WMEDIAKITS_BYTESWAP_SSSE3)
+  const __m128i kShuffle =
+      _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i * 4),
+                     _mm_shuffle_epi8(v, kShuffle));
+  }
+#elif defined(WMEDIAKITS_BYTESWAP_SSE2)
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 4));
+    // Swap the 16-bit halves of each word, then the bytes of each half.
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i * 4), v);
+  }
+#elif defined(WMEDIAKITS_BYTESWAP_NEON)
+  for (; i + 4 <= count; i += 4) {
+    vst1q_u8(d + i * 4, vrev32q_u8(vld1q_u8(s + i * 4)));
+  }
+#endif
+  for (; i < count; ++i) {
+    uint32_t v;
+    memcpy(&v, s + i * 4, sizeof(v));
+    v = ByteSwap32(v);
+    memcpy(d + i * 4, &v, sizeof(v));
+  }
+}
+
+inline void ByteSwapSamples16InPlace(void* data, size_t count) {
+  ByteSwapSamples16(data, data, count);
+}
+
+inline void ByteSwapSamples24InPlace(void* data, size_t count) {
+  ByteSwapSamples24(data, data, count);
+}
+
+inline void ByteSwapSamples32InPlace(void* data, size_t count) {
+  ByteSwapSamples32(data, data, count);
+}
+
+// Converts big-endian samples (e.g. RTP L16/L24 payloads) to host order. On a
+// big-endian host these reduce to a copy or nothing at all.
+inline void BigEndianToHostSamples16(const void* src, void* dst, size_t count) {
+  if (IsBigEndianArchitecture()) {
+    if (src != dst)
+      memcpy(dst, src, count * 2);
+    return;
+  }
+  ByteSwapSamples16(src, dst, count);
+}
+
+inline void BigEndianToHostSamples24(const void* src, void* dst, size_t count) {
+  if (IsBigEndianArchitecture()) {
+    if (src != dst)
+      memcpy(dst, src, count * 3);
+    return;
+  }
+  ByteSwapSamples24(src, dst, count);
+}
+
+inline void BigEndianToHostSamples32(const void* src, void* dst, size_t count) {
+  if (IsBigEndianArchitecture()) {
+    if (src != dst)
+      memcpy(dst, src, count * 4);
+    return;
+  }
+  ByteSwapSamples32(src, dst, count);
+}
+
+// Reads MSB-first bit fields from a byte buffer, as found in H.264/H.265 SPS
+// and ADTS headers. Bits are pulled through a 64-bit cache so most reads are a
+// shift and a mask. Reading past the end yields zero bits and sets overrun()
+// instead of touching memory out of bounds.
+//
+// NOTE: NAL payloads must have their emulation prevention bytes removed first
+// (see RemoveEmulationPreventionBytes()).
+class BigEndianBitReader {
+ public:
+  BigEndianBitReader(const uint8_t* data, size_t size)
+      : ptr_(data), end_(data + size), total_bits_(size * 8) {}
+
+  // Returns the next |num_bits| bits (0 to 32) as an unsigned value.
+  uint32_t ReadBits(int num_bits) {
+    if (num_bits <= 0)
+      return 0;
+    if (cache_bits_ < num_bits)
+      Refill();
+    const uint32_t value = static_cast<uint32_t>(cache_ >> (64 - num_bits));
+    Consume(num_bits);
+    return value;
+  }
+
+  // Returns the next |num_bits| bits (0 to 32) without consuming them.
+  uint32_t PeekBits(int num_bits) {
+    if (num_bits <= 0)
+      return 0;
+    if (cache_bits_ < num_bits)
+      Refill();
+    return static_cast<uint32_t>(cache_ >> (64 - num_bits));
+  }
+
+  bool ReadFlag() { return ReadBits(1) != 0; }
+
+  void SkipBits(size_t num_bits) {
+    if (num_bits <= static_cast<size_t>(cache_bits_)) {
+      Consume(static_cast<int>(num_bits));
+      return;
+    }
+    num_bits -= cache_bits_;
+    consumed_bits_ += cache_bits_;
+    cache_ = 0;
+    cache_bits_ = 0;
+    const size_t skip_bytes = num_bits / 8;
+    if (skip_bytes > static_cast<size_t>(end_ - ptr_)) {
+      consumed_bits_ = total_bits_;
+      ptr_ = end_;
+      overrun_ = true;
+      return;
+    }
+    ptr_ += skip_bytes;
+    consumed_bits_ += skip_bytes * 8;
+    ReadBits(static_cast<int>(num_bits % 8));
+  }
+
+  // Skips to the next byte boundary.
+  void ByteAlign() { SkipBits((8 - consumed_bits_ % 8) % 8); }
+
+  // Exp-Golomb coded ue(v) and se(v), as used throughout H.264/H.265 headers.
+  uint32_t ReadUE() {
+    int leading_zeros = 0;
+    while (!ReadFlag()) {
+      if (overrun_ || ++leading_zeros > 31) {
+        overrun_ = true;
+        return 0;
+      }
+    }
+    return ((1u << leading_zeros) - 1) + ReadBits(leading_zeros);
+  }
+
+  int32_t ReadSE() {
+    const uint32_t code = ReadUE();
+    return (code & 1) ? static_cast<int32_t>((code >> 1) + 1)
+                      : -static_cast<int32_t>(code >> 1);
+  }
+
+  size_t BitsRead() const { return consumed_bits_; }
+  size_t BitsLeft() const { return total_bits_ - consumed_bits_; }
+  bool overrun() const { return overrun_; }
+
+ private:
+  void Refill() {
+    if (end_ - ptr_ >= 8) {
+      // Load eight bytes at once but only count the whole bytes that fit. Any
+      // extra low bits are the real next bits of the stream, so OR-ing them in
+      // again on the next refill is harmless.
+      const int bytes = (64 - cache_bits_) >> 3;
+      cache_ |= ReadBigEndian64(ptr_) >> cache_bits_;
+      ptr_ += bytes;
+      cache_bits_ += bytes * 8;
+      return;
+    }
+    while (cache_bits_ <= 56 && ptr_ < end_) {
+      cache_ |= static_cast<uint64_t>(*ptr_++) << (56 - cache_bits_);
+      cache_bits_ += 8;
+    }
+  }
+
+  void Consume(int num_bits) {
+    if (num_bits > cache_bits_) {
+      overrun_ = true;
+      consumed_bits_ = total_bits_;
+      cache_ = 0;
+      cache_bits_ = 0;
+      return;
+    }
+    cache_ = num_bits < 64 ? cache_ << num_bits : 0;
+    cache_bits_ -= num_bits;
+    consumed_bits_ += num_bits;
+  }
+
+  const uint8_t* ptr_;
+  const uint8_t* const end_;
+  const size_t total_bits_;
+  size_t consumed_bits_ = 0;
+  uint64_t cache_ = 0;  // Left-aligned; the top |cache_bits_| bits are valid.
+  int cache_bits_ = 0;
+  bool overrun_ = false;
+};
+
+// Copies a NAL unit payload from |src| to |dst|, dropping the 0x03 byte of
+// every 0x000003 sequence. |dst| must hold |size| bytes and may equal |src|.
+// Returns the unescaped size.
+inline size_t RemoveEmulationPreventionBytes(const uint8_t* src,
+                                             size_t size,
+                                             uint8_t* dst) {
+  size_t out = 0;
+  int zeros = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const uint8_t b = src[i];
+    if (zeros >= 2 && b == 0x03) {
+      zeros = 0;
+      continue;
+    }
+    zeros = (b == 0) ? zeros + 1 : 0;
+    dst[out++] = b;
+  }
+  return out;
 }
 
 #endif  // WMEDIAKITS_BIG_ENDIAN_H_
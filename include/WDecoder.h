@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -35,9 +36,17 @@ class WDecoder {
   bool IsInit() { return codec_ != nullptr; }
 
   void SetCodecName(const std::string& codec_name);
+  const std::string& codec_name() const { return codec_name_; }
 
   void Decode(unsigned char* data, int data_len);
 
+  // Rough size of the buffers libavcodec holds internally (reference frames,
+  // reorder delay and frame threads), refreshed on every decoded frame. Safe to
+  // call from any thread.
+  size_t EstimatedBufferBytes() const {
+    return buffer_bytes_.load(std::memory_order_relaxed);
+  }
+
  private:
   // Helper to initialize the FFMPEG decoder and supporting objects. Returns
   // false if this failed (and the Client was notified).
@@ -51,6 +60,9 @@ class WDecoder {
   // notifying the Client of it.
   void OnError(const char* what, int av_errnum);
 
+  // Updates |buffer_bytes_| from the size of a freshly decoded |frame|.
+  void UpdateBufferEstimate(const AVFrame& frame);
+
   std::string codec_name_;
   const AVCodec* codec_ = nullptr;
   AVCodecParserContextUniquePtr parser_;
@@ -60,8 +72,17 @@ class WDecoder {
 
   Client* client_ = nullptr;
 
+  std::atomic<size_t> buffer_bytes_{0};
+
 };
 
+// AirPlay 的 ALAC / AAC-ELD 流不带 codec 配置，按会话的固定参数给出 extradata、
+// 采样率和声道数（解码器初始化与 WStreamRecorder 共用）。其他 codec 返回 false。
+bool GetAirPlayAudioConfig(const std::string& codec_name,
+                           std::vector<uint8_t>* extradata,
+                           int* sample_rate,
+                           int* channels);
+
 }  // namespace wmediakits
 
 #endif  // WMEDIAKITS_DECODER_H_
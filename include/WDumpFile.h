@@ -9,14 +9,99 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include <mutex>
+#include <string>
+
+#include "WDumpWriter.h"
+
 /*
- *  Video Functions 
+ *  Video Functions
+ *
+ *  按 linesize 逐行写出所有平面，支持任意 planar 格式（含高位深）。
+ *  文件名以 .y4m 结尾时写 YUV4MPEG2 流（带头和 FRAME 标记），否则写裸数据。
  */
 int WWriteVideoFrame(const AVFrame* frame, const char* filename);
+/*
+ *  同上，frameRate 写进 Y4M 头（只在第一次打开该文件时生效）；不带时按 30fps。
+ */
+int WWriteVideoFrame(const AVFrame* frame, const char* filename, AVRational frameRate);
 
-/* 
+/*
  *  Audio Functions
+ *
+ *  按原始采样格式交错写出。文件名以 .wav / .caf 结尾时带文件头，
+ *  长度字段在 WCloseDumpFiles() 时回填；否则写裸 PCM。
  */
 int WWriteAudioFrame(const AVFrame* frame, const char* filename);
 
-#endif // WMEDIAKITS_DUMPFILE_H_
\ No newline at end of file
+/*
+ *  Flush and close every dump file opened by the functions above.
+ *
+ *  这些写入器是进程级共享的（按文件名），不属于某个播放会话：应用在退出前、
+ *  所有会话都停止之后调用一次。之后再写同名的 .y4m/.wav/.caf 会重新打开并覆盖原文件。
+ */
+void WCloseDumpFiles();
+
+namespace wmediakits {
+
+// YUV4MPEG2 流式写入：首帧决定头部（尺寸/色彩格式），之后每帧逐行拷进
+// WDumpWriter 的环形缓冲，不经过中间缓冲。
+// 支持 mono/411/420/422/444(含 alpha) 的 8~16 位 planar 格式，大端高位深就地转成小端。
+class WY4MWriter {
+public:
+    WY4MWriter();
+    ~WY4MWriter();
+
+    bool Open(const std::string& path, AVRational frameRate);
+    // 4K 等大帧应按帧大小加大 opts.ringBytes，否则每帧都走阻塞写
+    bool Open(const std::string& path, AVRational frameRate, const WDumpWriter::Options& opts);
+    int WriteFrame(const AVFrame* frame);
+    void Close();
+    bool IsOpen() const { return m_writer.IsOpen(); }
+
+private:
+    bool writeHeader(const AVFrame* frame);
+
+    WDumpWriter m_writer;
+    std::mutex  m_headerMx;  // 多个线程写同一个文件时保护头部和格式字段
+    AVRational  m_frameRate{ 30, 1 };
+    bool        m_headerWritten = false;
+    int         m_width = 0;
+    int         m_height = 0;
+    int         m_format = AV_PIX_FMT_NONE;
+};
+
+// WAV / CAF 流式写入：首帧决定采样格式，planar 数据直接交错进环形缓冲。
+// Close() 时回填头部里的长度字段。
+class WAudioFileWriter {
+public:
+    enum class Container {
+        Wav,
+        Caf
+    };
+
+    WAudioFileWriter();
+    ~WAudioFileWriter();
+
+    bool Open(const std::string& path, Container container);
+    int WriteFrame(const AVFrame* frame);
+    void Close();
+    bool IsOpen() const { return m_writer.IsOpen(); }
+
+private:
+    bool writeHeader(const AVFrame* frame);
+
+    WDumpWriter m_writer;
+    std::mutex  m_headerMx;  // 多个线程写同一个文件时保护头部、格式字段和 m_dataBytes
+    Container   m_container = Container::Wav;
+    bool        m_headerWritten = false;
+    int         m_format = AV_SAMPLE_FMT_NONE;
+    int         m_channels = 0;
+    int         m_sampleRate = 0;
+    size_t      m_headerBytes = 0;
+    uint64_t    m_dataBytes = 0;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_DUMPFILE_H_
@@ -0,0 +1,136 @@
+﻿#ifndef WMEDIAKITS_DUMPWRITER_H_
+#define WMEDIAKITS_DUMPWRITER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wmediakits {
+
+// 持久化的异步 dump 写入器：
+//  - 文件只打开一次，调用方线程只做一次 memcpy 到预分配的环形缓冲
+//  - 后台线程按整块（对齐）写盘，能用 O_DIRECT / FILE_FLAG_NO_BUFFERING 就用
+//  - 缓冲满时整条记录丢弃并计数，不阻塞解码/音频线程
+//  - 例外：比整个环还大的记录（如 8MiB 环里的一帧 4K YUV）永远放不下，改为分段阻塞写，
+//    调用方线程等后台写盘腾空间；期间其它生产者的记录被丢弃，不会插到中间。
+//    所以 ringBytes 要按最大记录定（WWriteVideoFrame 按首帧取几帧的大小），这只是兜底
+class WDumpWriter {
+public:
+    struct Options {
+        size_t ringBytes = 8 << 20;  // 环形缓冲大小（会向上取整到 blockBytes 的倍数）
+        size_t blockBytes = 1 << 20; // 后台线程单次写盘的块大小（向上取整到 4K）
+        bool   directIO = true;      // 尽量绕过系统页缓存
+        bool   truncate = true;      // true=覆盖已有文件，false=追加
+    };
+
+    // 一条记录的分段写入：构造时一次性预留空间，析构时整体发布。
+    // 预留失败（缓冲满/未打开）时 operator bool 为 false，Append 不做任何事。
+    // 持有期间会挡住其它生产者，只应在其中做拷贝。size 大于环形缓冲时 Append/AppendSpan 会阻塞。
+    class ScopedRecord {
+    public:
+        ScopedRecord(WDumpWriter& writer, size_t size);
+        ~ScopedRecord();
+
+        explicit operator bool() const { return m_ok; }
+        void Append(const void* data, size_t size);
+        // 直接返回环内下一段连续空间（最多 size 字节，实际长度写入 *got），
+        // 调用方就地填充，省去中间缓冲。环回绕处需要再调用一次。
+        uint8_t* AppendSpan(size_t size, size_t* got);
+
+    private:
+        ScopedRecord(const ScopedRecord&) = delete;
+        ScopedRecord& operator=(const ScopedRecord&) = delete;
+
+        WDumpWriter& m_writer;
+        std::unique_lock<std::mutex> m_lock;
+        bool m_ok = false;
+        bool m_large = false;  // 分段阻塞写
+    };
+
+    WDumpWriter();
+    ~WDumpWriter();
+
+    bool Open(const std::string& path);
+    bool Open(const std::string& path, const Options& opts);
+    // 把剩余数据写完并关闭文件（阻塞到写盘结束）
+    void Close();
+    bool IsOpen() const { return m_open.load(std::memory_order_acquire); }
+
+    // 任意线程调用，非阻塞（size 大于环形缓冲时除外，见类注释）。返回 false 表示本条被丢弃。
+    bool Write(const void* data, size_t size);
+
+    // 缓冲满时等待后台线程腾出空间，size 可以大于环形缓冲。只用于关闭前写索引/尾部
+    // 这类非实时路径；等待期间其它生产者的记录被丢弃。
+    bool WriteBlocking(const void* data, size_t size);
+
+    // Close() 写完全部数据后，再在 offset（相对本次打开写入的起点）处覆盖写 data，
+    // 用于回填 WAV/CAF 头里的长度字段。
+    void PatchOnClose(uint64_t offset, const void* data, size_t size);
+
+    uint64_t BytesWritten() const { return m_diskBytes.load(std::memory_order_relaxed); }
+    uint64_t DroppedBytes() const { return m_droppedBytes.load(std::memory_order_relaxed); }
+    uint64_t DroppedRecords() const { return m_droppedRecords.load(std::memory_order_relaxed); }
+
+private:
+    WDumpWriter(const WDumpWriter&) = delete;
+    WDumpWriter& operator=(const WDumpWriter&) = delete;
+
+    // 以下均在持有 m_mx 时调用
+    bool reserveLocked(size_t size);
+    void appendLocked(const void* data, size_t size);
+    uint8_t* appendSpanLocked(size_t size, size_t* got);
+    void commitLocked();
+    // 分段阻塞写：m_largeActive 期间发布已追加的部分，等到有空间再预留下一段
+    bool beginLargeLocked();
+    bool waitRoomLocked(std::unique_lock<std::mutex>& lk, size_t* room);
+    bool appendBlockingLocked(std::unique_lock<std::mutex>& lk, const uint8_t* data, size_t size);
+    uint8_t* appendSpanBlockingLocked(std::unique_lock<std::mutex>& lk, size_t size, size_t* got);
+
+    void threadFunc();
+    bool writeBlock(const uint8_t* data, size_t size);
+    void finishFile(uint64_t logicalSize);
+
+    struct Patch {
+        uint64_t offset;
+        std::vector<uint8_t> data;
+    };
+
+    // 平台文件句柄（Windows 为 HANDLE，POSIX 为 fd）
+    intptr_t m_file = -1;
+    bool     m_direct = false;
+    std::string m_path;
+    uint64_t m_startOffset = 0; // 本次打开时的文件长度（追加模式）
+    uint64_t m_fileOffset = 0;  // 下一块写入的文件偏移
+    std::vector<Patch> m_patches; // 受 m_mx 保护
+
+    uint8_t* m_ring = nullptr;
+    size_t   m_ringBytes = 0;
+    size_t   m_blockBytes = 0;
+
+    // m_head/m_tail 为单调递增的字节计数，位置 = 计数 % m_ringBytes
+    std::mutex              m_mx;
+    std::condition_variable m_cv;
+    std::condition_variable m_spaceCV;      // 后台线程写完一块后通知 WriteBlocking
+    uint64_t                m_reserved = 0; // 已预留（含未发布）
+    uint64_t                m_cursor = 0;   // 当前记录的追加位置
+    std::atomic<uint64_t>   m_head{ 0 };    // 已发布
+    std::atomic<uint64_t>   m_tail{ 0 };    // 已写盘
+    bool                    m_closing = false;
+    bool                    m_largeActive = false;  // 正在分段阻塞写一条大记录
+
+    std::thread       m_thread;
+    std::atomic<bool> m_open{ false };
+
+    std::atomic<uint64_t> m_diskBytes{ 0 };
+    std::atomic<uint64_t> m_droppedBytes{ 0 };
+    std::atomic<uint64_t> m_droppedRecords{ 0 };
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_DUMPWRITER_H_
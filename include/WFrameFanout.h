@@ -0,0 +1,104 @@
+﻿#ifndef WMEDIAKITS_FRAMEFANOUT_H_
+#define WMEDIAKITS_FRAMEFANOUT_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "avcodec_glue.h"
+#include "WDecoder.h"
+
+namespace wmediakits {
+
+// 把一路解码输出分发给多个消费者（窗口之外的 dump、缩略图、分析等）。
+// 每个 sink 拿到的是同一帧的引用（av_frame_ref，像素不拷贝），各自有有界队列、丢帧策略和
+// 投递线程：慢的 sink 只会在自己的队列里丢帧，不会拖慢解码线程和渲染。
+//
+// 可以直接作为 WDecoder 的 Client（解码错误转给 SetErrorClient() 设置的对象），
+// 也可以由已有的 Client 在 OnFrameDecoded 里调用 Push()（WSDLPlayer 就是这样）。
+class WFrameFanout : public WDecoder::Client {
+public:
+    enum class DropPolicy {
+        DropOldest,  // 队列满时丢最老的一帧，sink 总是拿到最新的画面（预览、分析）
+        DropNewest   // 队列满时丢新来的帧，已排队的按顺序处理（连续性更重要时）
+    };
+
+    struct SinkOptions {
+        std::string name;                       // 只用于统计
+        size_t      capacity = 4;               // 最多排队的帧数
+        DropPolicy  policy = DropPolicy::DropOldest;
+    };
+
+    struct SinkStats {
+        int         id = 0;
+        std::string name;
+        size_t      queued = 0;
+        size_t      queued_bytes = 0;  // 排队帧引用的 AVBufferRef 大小之和
+        uint64_t    delivered = 0;
+        uint64_t    dropped = 0;
+    };
+
+    // 在 sink 自己的线程上调用；frame 只在回调期间有效，要留着用 av_frame_ref 取一份引用
+    typedef std::function<void(const AVFrame& frame)> FrameSink;
+
+    WFrameFanout();
+    ~WFrameFanout();
+
+    // 返回 sink ID
+    int  AddSink(FrameSink sink);
+    int  AddSink(FrameSink sink, const SinkOptions& options);
+    // 返回后不会再有这个 sink 的回调；在它自己的回调里调用时，当前这次回调照常返回
+    void RemoveSink(int id);
+    bool HasSinks() const { return m_sinkCount.load(std::memory_order_relaxed) > 0; }
+
+    // 任意线程调用，不阻塞：给每个 sink 入队一份引用
+    void Push(const AVFrame& frame);
+
+    std::vector<SinkStats> GetStats() const;
+    // 所有 sink 队列里帧引用的 AVBufferRef 大小之和（和别处共享的缓冲也计入）
+    size_t QueuedBytes() const { return m_queuedBytes.load(std::memory_order_relaxed); }
+    // 内存紧张时每个 sink 只留 keep 帧：DropOldest 丢最老的，DropNewest 丢最新的。返回丢掉的帧数
+    size_t Trim(size_t keep);
+
+    void SetErrorClient(WDecoder::Client* client) { m_errorClient = client; }
+
+    /* WDecoder::Client */
+    void OnFrameDecoded(const AVFrame& frame) override;
+    void OnDecodeError(const std::string& message) override;
+    void OnFatalError(const std::string& message) override;
+
+private:
+    WFrameFanout(const WFrameFanout&) = delete;
+    WFrameFanout& operator=(const WFrameFanout&) = delete;
+
+    struct Sink;
+    typedef std::vector<std::shared_ptr<Sink>> SinkList;
+
+    static void sinkThreadFunc(std::shared_ptr<Sink> sink);
+    void stopSink(const std::shared_ptr<Sink>& sink);
+
+    // 帧引用的壳，必须比下面的 sink 队列活得久
+    AVFramePool m_framePool;
+
+    // 写时复制：Push() 只取一份列表的引用
+    mutable std::mutex m_mx;
+    std::shared_ptr<const SinkList> m_sinks;
+    std::vector<std::thread> m_retired;  // 在 sink 自己的回调里被移除的线程，之后再 join
+    int m_nextId = 1;
+    std::atomic<int> m_sinkCount{ 0 };
+    std::atomic<size_t> m_queuedBytes{ 0 };  // sink 线程都在析构里 join，可以放心引用
+
+    WDecoder::Client* m_errorClient = nullptr;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_FRAMEFANOUT_H_
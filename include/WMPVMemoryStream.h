@@ -0,0 +1,78 @@
+﻿#ifndef WMEDIAKITS_MPVMEMORYSTREAM_H_
+#define WMEDIAKITS_MPVMEMORYSTREAM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace wmediakits {
+
+// 进程内的有界字节环，应用线程往里推数据，mpv 通过 stream_cb 直接读，
+// 不再绕一层本地 HTTP 服务。用法见 WMPVPlayer::AddMemoryStream()。
+//
+// 所有位置都是从流开头算起的字节偏移。环里保留 [BufferStart(), BufferEnd()) 这一段：
+// 未读的数据绝不会被覆盖（写满时 Write() 阻塞，即背压）；已读的数据在空间不够时才淘汰，
+// 所以在这段窗口内可以前后 seek。
+// 读端看到的流从 OpenReader() 时的窗口开头算起（开头已被淘汰时不是 0），
+// Seek()/Size() 都用这个相对偏移，与 mpv 的 stream_cb 一致。
+class WMPVMemoryStream {
+public:
+    explicit WMPVMemoryStream(size_t capacity = 16 << 20);
+    ~WMPVMemoryStream();
+
+    // 生产者：写满时等待读端腾出空间。timeoutMs < 0 表示一直等；
+    // 超时、Abort() 或已 EndOfStream() 时返回 false，本次数据整体不写入。
+    bool Write(const void* data, size_t size, int timeoutMs = -1);
+    // 非阻塞：空间不够时直接返回 false
+    bool TryWrite(const void* data, size_t size);
+    // 数据写完了，读端读到末尾后得到 EOF，并可以知道总长度
+    void EndOfStream();
+    // 放弃这个流：唤醒两端，之后的读写都失败
+    void Abort();
+
+    uint64_t BufferStart() const;
+    uint64_t BufferEnd() const;
+    uint64_t ReadPosition() const;
+    size_t   Capacity() const { return m_ring.size(); }
+
+    // 以下由 mpv 的 stream_cb 回调使用（mpv 的读线程）
+    // 读端打开：以当前窗口开头作为读端的 0，清掉上一次的取消标记
+    void OpenReader();
+    // 阻塞到有数据；返回读到的字节数，0 表示 EOF，-1 表示被取消/放弃
+    int64_t Read(void* buf, uint64_t size);
+    // offset 相对 OpenReader() 时的位置，只能落在缓冲窗口内；超出窗口返回 false
+    bool Seek(uint64_t offset);
+    // 读端看到的总长度，EndOfStream() 之前未知返回 -1
+    int64_t Size() const;
+    // mpv 要求中断阻塞中的 Read()（换文件/退出时）
+    void CancelRead();
+
+private:
+    WMPVMemoryStream(const WMPVMemoryStream&) = delete;
+    WMPVMemoryStream& operator=(const WMPVMemoryStream&) = delete;
+
+    // 持 m_mx 调用：拷贝进环，必要时淘汰已读数据
+    void writeLocked(const uint8_t* data, size_t size);
+    size_t freeLocked() const { return m_ring.size() - static_cast<size_t>(m_end - m_read); }
+
+    std::vector<uint8_t> m_ring;
+
+    // m_start <= m_read <= m_end，位置 = 偏移 % 容量；m_base 是读端的 0
+    mutable std::mutex      m_mx;
+    std::condition_variable m_dataCV;  // 有新数据/EOF/取消，唤醒读端
+    std::condition_variable m_spaceCV; // 读端前进/seek/放弃，唤醒写端
+    uint64_t m_start = 0;
+    uint64_t m_base = 0;
+    uint64_t m_read = 0;
+    uint64_t m_end = 0;
+    bool     m_eof = false;
+    bool     m_aborted = false;
+    bool     m_cancelled = false;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_MPVMEMORYSTREAM_H_
@@ -1,29 +1,176 @@
 #ifndef WMEDIAKITS_WMPVPLAYER_H
 #define WMEDIAKITS_WMPVPLAYER_H
 
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 #include <atomic>
 #include <functional>
+#include <map>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
 
 struct mpv_handle;
 struct mpv_render_context;
+struct mpv_event_property;
+struct mpv_stream_cb_info;
+struct mpv_node;
 
 namespace wmediakits {
 
+class WMPVMemoryStream;
+class WSegmentCache;
+class WMPVPlayerHost;
+
 class WMPVPlayer {
     typedef std::function<void()> OnDisconnect;
 public:
+    // finished=false 表示到截止时间还没拆完（拆除仍在后台继续，线程最终都会被 join）
+    typedef std::function<void(bool finished)> OnStopped;
+
     enum class FillMode { 
         Contain, 
         Cover, 
         Stretch 
     }; // 等比/裁剪铺满/拉伸铺满
 
+    enum class PresentMode {
+        Immediate,  // 关 vsync，有更新就画（延迟最低，可能撕裂）
+        VSync,      // 开 vsync 并回报 swap，mpv 按显示器节奏同步（display-resample）
+        LowLatency  // 开 vsync，每个 vblank 只画最新一帧，mpv 不等目标显示时间
+    };
+
+    // 播放参数档位：点播要大缓存、可 seek；直播/镜像要小预读、不因缓存暂停、低延迟解复用
+    struct PlaybackOptions {
+        bool        cache = true;
+        int64_t     cache_max_bytes = 150 << 20;     // demuxer-max-bytes
+        int64_t     cache_max_back_bytes = 50 << 20; // demuxer-max-back-bytes
+        double      readahead_secs = 0.0;            // demuxer-readahead-secs / cache-secs，<=0 保持 mpv 默认
+        bool        cache_pause = true;              // 缓存见底时是否暂停等待
+        bool        force_seekable = true;
+        std::string hwdec = "auto-safe";
+        int         decoder_threads = 0;             // vd-lavc-threads，0=自动
+        bool        low_latency = false;             // 关闭探测/缓冲（nobuffer、短 analyzeduration、无音频缓冲）
+        bool        untimed = false;                 // 不按时间戳等待，来一帧显示一帧
+        std::string user_agent = "AppleCoreMedia/1.0";
+
+        static PlaybackOptions Vod();
+        static PlaybackOptions Live();
+    };
+
+    // 单个播放器的 demuxer 缓存预算。进程总上限（SetProcessCacheLimit）不够分时，
+    // 先给每个开了缓存的播放器留 1MiB 前向下限（包含在总上限内），其余按请求的字节数
+    // 等比例缩小；cache=false 的播放器不参与分配。秒数不参与分配
+    struct CacheBudget {
+        int64_t forward_bytes = 150 << 20; // demuxer-max-bytes
+        int64_t back_bytes = 50 << 20;     // demuxer-max-back-bytes
+        double  forward_secs = 0.0;        // demuxer-readahead-secs / cache-secs，<=0 为 mpv 默认
+    };
+
+    // 每帧的渲染/呈现耗时（播放器线程写，任意线程读）
+    struct FrameTimings {
+        uint64_t frames = 0;            // 已呈现帧数
+        uint64_t vsync_misses = 0;      // 帧就绪后没能赶上下一个 vblank 的次数
+        double   refresh_hz = 0.0;      // 当前显示器刷新率（未知为 0）
+        double   last_render_ms = 0.0;  // mpv_render_context_render 耗时
+        double   last_swap_ms = 0.0;    // SDL_GL_SwapWindow 耗时（开 vsync 时含等待）
+        double   last_latency_ms = 0.0; // mpv 通知有新帧到上屏
+        double   avg_render_ms = 0.0;   // 滑动平均
+        double   avg_swap_ms = 0.0;
+        double   avg_latency_ms = 0.0;
+        double   max_render_ms = 0.0;
+        double   max_swap_ms = 0.0;
+        double   max_latency_ms = 0.0;
+    };
+
+    // 启动各阶段耗时（毫秒）
+    struct StartupTimings {
+        bool   warm = false;                  // 是否经 Warmup() 预热
+        double sdl_init_ms = 0.0;             // SDL_Init + 注册自定义事件
+        double mpv_init_ms = 0.0;             // mpv_create + 选项 + mpv_initialize
+        double window_ms = 0.0;               // 窗口 + GL 上下文
+        double render_context_ms = 0.0;       // mpv_render_context_create
+        double play_to_load_ms = 0.0;         // Play() 到发出 loadfile
+        double play_to_file_loaded_ms = 0.0;  // Play() 到 MPV_EVENT_FILE_LOADED
+        double play_to_first_frame_ms = 0.0;  // Play() 到首帧上屏
+    };
+
+    // 无窗口软件渲染（MPV_RENDER_API_TYPE_SW）交出的一帧，rgb0，每像素 4 字节
+    struct SoftwareFrame {
+        const uint8_t* data = nullptr;
+        int      width = 0;
+        int      height = 0;
+        size_t   stride = 0;
+        uint64_t index = 0;        // 本次播放的帧序号，从 0 开始
+        double   position = 0.0;   // 渲染时的播放位置（秒）
+        double   render_ms = 0.0;  // 本帧 mpv_render_context_render 耗时
+        // 池化缓冲的持有者：回调里留一份即可在回调之后继续用 data；调用方缓冲时为空
+        std::shared_ptr<const void> storage;
+    };
+    typedef std::function<void(const SoftwareFrame&)> FrameCallback;
+
+    // RequestThumbnail() 交出的缩略图，4 字节像素，通道顺序见 format（通常 "bgr0"）
+    struct Thumbnail {
+        const uint8_t* data = nullptr;  // 失败时为空
+        int         width = 0;
+        int         height = 0;
+        size_t      stride = 0;
+        const char* format = "";
+        double      position = 0.0;     // 截图时的播放位置（秒）
+        // 池化缓冲的持有者：回调里留一份即可在回调之后继续用 data
+        std::shared_ptr<const void> storage;
+    };
+    typedef std::function<void(const Thumbnail&)> ThumbnailCallback;
+
+    struct HeadlessOptions {
+        int      width = 640;
+        int      height = 360;
+        double   fps = 0.0;          // >0 时用 vf=fps 降到该帧率，0 按片源帧率
+        size_t   pool_size = 4;      // 池里最多保留的空闲缓冲数
+        // 调用方提供的缓冲（至少 target_stride * height 字节），为空用池。
+        // 地址和 stride 必须至少 4 字节对齐，否则 InitHeadless 失败；
+        // 建议按 64 字节对齐（与池一致），软件渲染的 SIMD 路径最快
+        uint8_t* target = nullptr;
+        size_t   target_stride = 0;  // 0 表示 width * 4
+    };
+
+    // 播放质量遥测的一个采样点（播放中约每秒一个）
+    struct TelemetrySample {
+        uint64_t time_us = 0;          // steady_clock 时间戳（微秒），不同播放器之间可比
+        double   position = 0.0;
+        int64_t  frame_drops = 0;      // frame-drop-count，VO 丢帧（累计）
+        int64_t  decoder_drops = 0;    // decoder-frame-drop-count（累计）
+        int64_t  vo_delayed = 0;       // vo-delayed-frame-count（累计）
+        double   avsync = 0.0;         // 音视频差（秒）
+        double   vf_fps = 0.0;         // estimated-vf-fps
+        double   video_bitrate = 0.0;  // bit/s
+        double   cache_duration = 0.0;
+        double   fw_bytes = 0.0;
+        int      buffering_state = 0;
+        int      buffering_percent = 0;
+    };
+    static constexpr size_t kTelemetrySamples = 120;
+
+    // 进程内所有在跑播放器最新采样的汇总
+    struct TelemetryAggregate {
+        size_t  players = 0;
+        int64_t frame_drops = 0;          // 各播放器累计值之和
+        int64_t decoder_drops = 0;
+        int64_t vo_delayed = 0;
+        double  max_abs_avsync = 0.0;
+        double  avg_vf_fps = 0.0;
+        double  total_video_bitrate = 0.0;
+        double  total_fw_bytes = 0.0;
+        int     buffering_players = 0;    // 正在缓冲的播放器数
+    };
+
     struct PlaybackInfo {
         double position = 0.0;   // 当前秒
         double duration = 0.0;   // 总时长（0 代表 live/未知）
@@ -40,9 +187,38 @@ public:
         double fw_bytes = 0.0; // 前向缓存字节数
         std::string vcodec;             // 视频编码名
         std::string acodec;             // 音频编码名
+        // 已缓存、可以直接 seek 的时间段（demuxer-cache-state.seekable-ranges，最多 kMaxSeekableRanges 段）
+        struct TimeRange {
+            double start;
+            double end;
+        };
+        std::vector<TimeRange> seekable_ranges;
 
         bool is_live() const { return duration <= 0.0 && !seekable; }
+        bool is_cached(double sec) const
+        {
+            for (const TimeRange& r : seekable_ranges)
+                if (sec >= r.start && sec <= r.end) return true;
+            return false;
+        }
+    };
+    static constexpr int kMaxSeekableRanges = 8;
+
+    // 订阅通知里的变化字段（按位或）
+    enum PlaybackField : uint32_t {
+        FieldPosition   = 1u << 0,
+        FieldDuration   = 1u << 1,
+        FieldPause      = 1u << 2,
+        FieldRate       = 1u << 3,
+        FieldSeekable   = 1u << 4,
+        FieldDimensions = 1u << 5,
+        FieldCodecs     = 1u << 6,
+        FieldBuffering  = 1u << 7,  // buffering_state / buffering_percent
+        FieldCache      = 1u << 8,  // cache_duration / fw/bw_bytes / seekable_ranges
+        FieldAll        = 0x1ffu
     };
+    // changed 为这次通知里变化过的字段（已按订阅的 fields 过滤），info 为同一份快照
+    typedef std::function<void(uint32_t changed, const PlaybackInfo& info)> PlaybackListener;
 
     WMPVPlayer();
     ~WMPVPlayer();
@@ -50,11 +226,41 @@ public:
     bool Init(const std::string& title = "WMPVPlayer",
               int default_w = 1280, int default_h = 720,
               FillMode defaultFill = FillMode::Contain);
+    bool Init(const std::string& title, int default_w, int default_h,
+              FillMode defaultFill, const PlaybackOptions& options);
+    // 无窗口模式：不建窗口/GL，不出声，用软件渲染按指定尺寸出帧并在播放器线程回调。
+    // 可以在没有 GPU/显示器的机器上跑（缩略图、分析、CI）；GetFrameTimings() 给出每帧渲染耗时。
+    bool InitHeadless(const HeadlessOptions& options, FrameCallback onFrame);
 
     // 开始播放一个 HLS（或任意 url）地址 
     // startSeconds > 0 将从指定秒数开始
+    // 已在播放时直接切流（loadfile replace），窗口/GL/mpv 核心都保留
     bool Play(const std::string& url, double startSeconds = 0.0);
+    bool Play(const std::string& url, double startSeconds, const PlaybackOptions& options);
+
+    // 可选的预热：在 Init() 之后调用，把 SDL、mpv 核心、（隐藏的）窗口、GL 与渲染上下文
+    // 全部建好，阻塞到就绪为止。之后的 Play() 只需发 loadfile 并显示窗口。
+    bool Warmup();
     void Stop();
+    // 不阻塞调用方：在后台执行 Stop()，完成或到 deadlineMs 时（先到者）回调一次，
+    // 回调在后台线程上，只有 finished == true 时才能在里面销毁播放器（finished == false
+    // 时拆除还在进行，析构会一直等到它结束）。deadlineMs < 0 表示只在完成时回调
+    void StopAsync(OnStopped done = nullptr, int deadlineMs = 3000);
+
+    // 挂到共享的 UI/渲染线程上（见 WMPVPlayerHost），nullptr 恢复自带线程。只能在未运行时调用
+    bool SetHost(WMPVPlayerHost* host);
+
+    // 预加载下一条：加入播放列表并提前打开，之后 Play(同一 url) 或当前项播完时无缝切换
+    bool Preload(const std::string& url);
+
+    // 注册一个进程内的内存流，返回可交给 Play()/Preload() 的 url（wmkmem://name）。
+    // 同名会替换；mpv 正在读的旧流保持有效直到它关闭。
+    std::string AddMemoryStream(const std::string& name, const std::shared_ptr<WMPVMemoryStream>& stream);
+    void RemoveMemoryStream(const std::string& name);
+
+    // 经共享的分片磁盘缓存播放 HLS（见 WSegmentCache，需已 Start）：之后 Play()/Preload() 的
+    // http(s) .m3u8 地址改走本机代理，多个播放器/会话共用已下载的分片。nullptr 关闭
+    void SetSegmentCache(const std::shared_ptr<WSegmentCache>& cache);
 
     void RegisterOnDisconnect(OnDisconnect handler);
 
@@ -65,28 +271,90 @@ public:
     void AddVolume(int delta);     // +-音量
     void SetRate(double rate);     // 倍速
     void SetFillMode(FillMode m);  // 画面填充策略
+    void SetPresentMode(PresentMode m); // 呈现方式，默认 Immediate（与之前的行为一致）
+    // 播放中调用时，mpv 允许运行时修改的项立即生效（部分从下一个文件起生效）
+    void SetPlaybackOptions(const PlaybackOptions& options);
+
+    // 缓存预算：覆盖 PlaybackOptions 里的对应三项，运行时调用立即生效
+    void SetCacheBudget(const CacheBudget& budget);
+    // 实际生效的预算（已按进程总上限分配）
+    CacheBudget GetCacheBudget() const;
+    // 所有在跑播放器的前向+后向缓存字节总上限，0 表示不限制
+    static void SetProcessCacheLimit(int64_t bytes);
+    static int64_t GetProcessCacheLimit();
 
     bool GetPlaybackInfo(PlaybackInfo& out) const;
 
+    // 订阅播放状态变化：在后台回调线程上回调（不在播放器线程和定时调度线程上），
+    // 同一播放器的通知按顺序、不并发；回调阻塞只会推迟这个播放器之后的通知。
+    // 同一字段的通知按 SetNotifyInterval 合并限频（默认 position 250ms、cache 500ms，其余立即），
+    // 每次通知只取一份快照给所有订阅者。返回订阅 ID
+    int  Subscribe(PlaybackListener listener, uint32_t fields = FieldAll);
+    // 返回后不会再有这个订阅的回调（在回调里退订自己时除外：当前这次回调照常返回）
+    void Unsubscribe(int id);
+    void SetNotifyInterval(uint32_t fields, int intervalMs);
+    bool GetFrameTimings(FrameTimings& out) const;
+    bool GetStartupTimings(StartupTimings& out) const;
+
+    // 异步截取当前视频帧（screenshot-raw video，不含字幕/OSD），在播放器线程上缩放到
+    // width x height，再在后台回调线程上回调。width/height 其中一个 <= 0 时按原始宽高比推算。
+    // 上一个请求还没完成，或距上次请求不足 1/maxRate 秒时直接返回 false，截图不会堆积拖慢播放
+    bool RequestThumbnail(int width, int height, ThumbnailCallback done);
+    void SetThumbnailMaxRate(double perSecond); // 默认每秒 1 张
+
+    // 最近 kTelemetrySamples 个采样，从旧到新；无锁，任意线程调用
+    size_t GetTelemetry(std::vector<TelemetrySample>& out) const;
+    bool GetLatestTelemetry(TelemetrySample& out) const;
+    static TelemetryAggregate GetProcessTelemetry();
+
 private:
+    friend class WMPVPlayerHost;
+
     // 线程方法
 	void threadFunc();
+    bool startThread();              // 自带线程，或交给 host
+    bool beginSession();             // 启动 + 加载，结束后通知 Warmup()
+    void endSession();               // 拆掉窗口/mpv，与 beginSession 同一线程
+    void reapEndedSession();         // 会话已自行结束（关窗口/启动失败）但还没 Stop 时收掉它
+    bool startup();                  // 播放器线程：SDL/mpv/窗口/渲染上下文，逐阶段计时
+    void markPlayRequested();
+    void notePlayPhase(double StartupTimings::* field, bool& pending);
 
     // SDL/GL
-    bool createWindow(const std::string& title, int w, int h);
+    bool createWindow(const std::string& title, int w, int h, bool hidden);
+    bool createRenderContext();
     void destroyWindow();
     void renderFrame(); // 在当前 GL 上下文绘制一帧
+    void renderSoftware(); // 无窗口模式：软件渲染到内存并回调
+    void noteFrameTiming(double renderMs, double swapMs, std::chrono::steady_clock::time_point presentedAt);
+    Uint32 sdlSubsystems() const;
+    void applyPresentMode();   // 播放器线程：swap interval + mpv video-sync
+    void updateRefreshRate();
+    void handleEvent(const SDL_Event& e, bool& need_redraw);
     bool IsEventForWindow(const SDL_Event& e, SDL_Window* window);
 
     // mpv
     bool createMpv();
     void destroyMpv();
     void handleMpvEvents();          // 拉取并处理 mpv 事件
+    void handlePropertyChange(uint64_t id, const mpv_event_property* p);
+    void sampleTelemetry(std::chrono::steady_clock::time_point now);
+    void deliverThumbnail(int error, const mpv_node* result);
+    bool readTelemetrySlot(uint64_t i, TelemetrySample& out) const;
     void applyFillMode();
+    void issueSeekLocked();          // 持 m_seekMx 调用：没有在途 seek 时发出待发的 seek
+    void loadLocked(const std::string& url, double startSeconds); // 持 m_loadMx
+    void appendLocked(const std::string& url);                    // 持 m_loadMx
+    void resetFileState();           // 换文件时清掉上一文件的加载/seek 状态
+    void cacheBudgetOptions(std::vector<std::pair<std::string, std::string>>& out) const;
+    void applyCacheBudget();         // 播放器线程：把分到的预算设给 mpv
+    static void registerCacheUser(WMPVPlayer* player, bool live);
+    static void rebalanceCaches();   // 按进程总上限重新分配，变化的播放器会被唤醒
 
     static void onMpvEvents(void*);  // mpv 唤醒
     static void onMpvRender(void*);  // mpv 渲染更新
     static void* getProcAddr(void*, const char* name);
+    static int onStreamOpen(void* user_data, char* uri, mpv_stream_cb_info* info); // wmkmem://
 
 private:
     // SDL
@@ -94,12 +362,17 @@ private:
     SDL_GLContext m_gl = nullptr;
     Uint32        m_evRenderUpdate = 0; // SDL 自定义事件：提示需要调用 mpv_render_context_update
     Uint32        m_evMpvEvents = 0; // SDL 自定义事件：提示有 mpv 普通事件
-    Uint32        m_evWake = 0; // 外部 Stop/控制时唤醒
+    std::atomic<Uint32> m_evWake{ 0 }; // 外部 Stop/控制时唤醒；其他线程读，会话开始/结束时写
     
 	// 线程控制
     std::thread      m_thread;
+    WMPVPlayerHost*  m_host = nullptr;     // 非空时不起自己的线程
     std::atomic<bool> m_running{ false }; // 线程是否在跑
     std::atomic<bool> m_quit{ false };
+    std::mutex        m_stopMx;            // 串行化 Stop()（StopAsync 的后台任务和析构可能并发）
+    std::mutex        m_asyncStopMx;
+    std::condition_variable m_asyncStopCv;
+    int               m_asyncStops = 0;    // 还没跑完的 StopAsync 任务，析构时等它们
 
     // mpv
     mpv_handle* m_mpv = nullptr;
@@ -112,24 +385,134 @@ private:
     int         m_defaultH{ 720 };
     FillMode    m_fill = FillMode::Contain;
 
-    // 播放参数
+    // 无窗口软件渲染（Init 之后不变，仅播放器线程使用池和计数）
+    struct SwBufferPool;
+    bool            m_headless = false;
+    HeadlessOptions m_headlessOpts;
+    FrameCallback   m_onFrame;
+    std::shared_ptr<SwBufferPool> m_swPool;
+    uint64_t        m_swFrames = 0;
+
+    // 呈现/帧时序
+    std::atomic<PresentMode> m_presentMode{ PresentMode::Immediate };
+    PresentMode              m_appliedPresentMode = PresentMode::Immediate; // 仅播放器线程
+    bool                     m_frameWaiting = false;                    // 有新帧尚未上屏
+    std::chrono::steady_clock::time_point m_frameReadyAt;
+    mutable std::mutex       m_timingMx;
+    FrameTimings             m_timings;
+    // 以下受 m_timingMx 保护
+    StartupTimings           m_startup;
+    std::chrono::steady_clock::time_point m_playAt;
+    bool                     m_awaitLoad = false;
+    bool                     m_awaitFileLoaded = false;
+    bool                     m_awaitFirstFrame = false;
+    std::atomic<bool>        m_showWindow{ false };
+
+    // 播放档位：createMpv 在 mpv_initialize 前一次性应用
+    mutable std::mutex m_optionsMx;
+    PlaybackOptions    m_options;
+
+    // rebalanceCaches() 分到的前向/后向字节数，持有 mpv 核心期间参与分配
+    std::atomic<int64_t> m_grantedFwBytes{ 0 };
+    std::atomic<int64_t> m_grantedBackBytes{ 0 };
+    std::atomic<bool>    m_cacheDirty{ false };
+    // mpv_create 后读到的默认预读秒数，readahead_secs<=0 时用来恢复（只在播放器线程上写）
+    std::string          m_defaultReadahead;
+    std::string          m_defaultCacheSecs;
+
+    // 播放参数（受 m_loadMx 保护；m_coreReady 之后 Play/Preload 直接发命令）
+    std::mutex  m_loadMx;
     std::string m_url;
     double      m_startSeconds{ 0.0 };
+    std::string m_preloadUrl;
+    bool        m_coreReady = false;
+    bool        m_startupDone = false;   // 启动流程结束（无论成败），Warmup() 等它
+    std::condition_variable m_readyCv;
 
 	// 回调
     OnDisconnect m_onDisconnect;
 
-    // 播放信息快照（任意线程读，播放器线程写）
-    mutable std::mutex m_infoMx;
-    PlaybackInfo       m_info;
+    // wmkmem:// 内存流，mpv 的读线程在打开时查表
+    std::mutex m_streamsMx;
+    std::map<std::string, std::shared_ptr<WMPVMemoryStream>> m_streams;
+    std::shared_ptr<WSegmentCache> m_segmentCache;   // 同受 m_streamsMx 保护
+    std::string sourceUrl(const std::string& url);   // 交给 loadfile 的实际地址
+
+    // 播放信息快照：播放器线程（以及 SetRate）写，任意线程读。
+    // 用 seqlock 发布，读者不加锁、不阻塞写者；字符串用定长数组保证可按字拷贝。
+    struct InfoState {
+        double position = 0.0;
+        double duration = 0.0;
+        double rate = 1.0;
+        double cache_duration = 0.0;
+        double bw_bytes = 0.0;
+        double fw_bytes = 0.0;
+        int    width = 0;
+        int    height = 0;
+        int    buffering_state = 0;
+        int    buffering_percent = 0;
+        bool   paused = false;
+        bool   seekable = false;
+        char   vcodec[64] = {};
+        char   acodec[64] = {};
+        int    seek_ranges = 0;
+        double seek_start[kMaxSeekableRanges] = {};
+        double seek_end[kMaxSeekableRanges] = {};
+    };
+    static constexpr size_t kInfoWords = (sizeof(InfoState) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // 持 m_infoWriteMx 修改 m_infoState，然后整体发布
+    template <typename Fn>
+    void updateInfo(Fn&& fn);
+    void publishInfoLocked();
+    void readInfo(InfoState& out) const;
+    static uint32_t diffInfo(const InfoState& a, const InfoState& b);
+
+    // 订阅与合并状态，后台任务通过 weak_ptr 引用，播放器析构时断开
+    struct Notifier;
+    std::shared_ptr<Notifier> m_notifier;
+    void notifyChanged(uint32_t fields);
+    static void flushNotifications(const std::weak_ptr<Notifier>& weak, uint64_t seq);
+
+    std::mutex            m_infoWriteMx;  // 只用于串行化写者
+    InfoState             m_infoState;    // 写者手里的最新状态
+    std::atomic<uint32_t> m_infoSeq{ 0 }; // 奇数表示正在写
+    std::atomic<uint64_t> m_infoWords[kInfoWords];
+
+    // 遥测环：播放器线程单写，读者无锁。每个槽带序号，读到一半被覆盖的槽直接跳过
+    static constexpr size_t kTelemetryWords = (sizeof(TelemetrySample) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    struct TelemetrySlot {
+        std::atomic<uint64_t> seq;    // 2*i+1 正在写第 i 个样本，2*i+2 已写完
+        std::atomic<uint64_t> words[kTelemetryWords];
+    };
+    TelemetrySlot         m_telemetry[kTelemetrySamples];
+    std::atomic<uint64_t> m_telemetryCount{ 0 };
+    TelemetrySample       m_telemetryCur;   // 播放器线程：各属性的最新值
+    std::chrono::steady_clock::time_point m_telemetryLast;
+
+    // 缩略图请求：同一时间最多一个在途，并按最大频率节流
+    std::mutex        m_thumbMx;
+    bool              m_thumbInFlight = false;
+    int               m_thumbW = 0;
+    int               m_thumbH = 0;
+    ThumbnailCallback m_thumbDone;
+    double            m_thumbMaxRate = 1.0;
+    std::chrono::steady_clock::time_point m_thumbLast;
+    std::shared_ptr<SwBufferPool> m_thumbPool; // 仅播放器线程，尺寸变化时重建
 
     // 保存 mpv 的 nominal speed（不考虑 pause）
     std::atomic<double> m_speedRaw{ 1.0 };
 
 	// 处理B站这种延迟seek的情况，onPlay时还没有播放，后续紧跟了seek请求
     std::atomic<bool> file_loaded{ false };
-    std::atomic<bool> have_pending_seek{ false };
-    std::atomic<double> pending_seek_pos{ 0.0 };
+
+    // 异步 seek：同一时间最多一个 seek 命令在途（等 COMMAND_REPLY），
+    // 期间的请求合并成一个待发请求（连按方向键只会发出少量 seek）
+    std::mutex m_seekMx;
+    bool       m_seekInFlight = false;
+    bool       m_seekPending = false;
+    bool       m_seekPendingAbsolute = false;
+    double     m_seekPendingValue = 0.0; // 绝对目标（秒）或累积的相对偏移
 };
 
 }  // namespace wmediakits
@@ -0,0 +1,83 @@
+﻿#ifndef WMEDIAKITS_MPVPLAYERHOST_H_
+#define WMEDIAKITS_MPVPLAYERHOST_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+
+namespace wmediakits {
+
+class WMPVPlayer;
+
+// 多个 WMPVPlayer 共用的 UI/渲染线程。
+// SDL 的事件队列是进程全局的，每个播放器各跑一个 SDL_WaitEvent 循环会互相抢走对方的
+// 自定义事件；挂到同一个 host 上后只有一个线程取事件，按注册的事件类型和窗口 ID 分发，
+// 再按帧等待时间从久到新轮流渲染各窗口，由 host 按显示器刷新率统一限速。
+//
+// 用法：host.Start()；player.SetHost(&host)；之后 Play/Warmup/Stop 照常调用。
+// 不要在 host 线程（播放器回调）里对挂在它上面的播放器调用 Stop()/Warmup()。
+class WMPVPlayerHost {
+public:
+    WMPVPlayerHost();
+    ~WMPVPlayerHost();
+
+    bool Start();
+    // 拆掉所有挂着的播放器并结束线程；之后这些播放器的 Stop() 直接返回
+    void Stop();
+    bool IsRunning() const { return m_running.load(); }
+
+    size_t PlayerCount() const;
+
+private:
+    WMPVPlayerHost(const WMPVPlayerHost&) = delete;
+    WMPVPlayerHost& operator=(const WMPVPlayerHost&) = delete;
+
+    friend class WMPVPlayer;
+
+    // 由 WMPVPlayer 调用（任意线程）
+    bool attach(WMPVPlayer* player);  // 排队，host 线程上完成启动和加载
+    void detach(WMPVPlayer* player);  // 阻塞到 host 线程拆完这个播放器
+
+    struct Slot {
+        WMPVPlayer* player = nullptr;
+        bool        redraw = false;
+    };
+
+    void threadFunc();
+    void runCommands();
+    void dispatch(const SDL_Event& e);
+    Slot* route(const SDL_Event& e);
+    void renderPass();
+    void teardown(size_t index);
+    int  waitTimeoutMs() const;
+
+    std::thread       m_thread;
+    std::atomic<bool> m_running{ false };
+    std::atomic<bool> m_quit{ false };
+    Uint32            m_evCommand = 0;
+
+    // 命令队列与在 host 上的播放器集合（m_live 从 attach 起到拆完为止）
+    mutable std::mutex      m_mx;
+    std::condition_variable m_cv;
+    std::vector<WMPVPlayer*> m_pendingAttach;
+    std::vector<WMPVPlayer*> m_pendingDetach;
+    std::set<WMPVPlayer*>    m_live;
+    bool                     m_started = false; // 线程已初始化完 SDL（或失败）
+
+    // 以下只在 host 线程访问
+    std::vector<Slot> m_slots;
+    std::chrono::steady_clock::time_point m_lastPass;
+    double m_passIntervalMs = 1000.0 / 60.0;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_MPVPLAYERHOST_H_
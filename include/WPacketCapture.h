@@ -0,0 +1,192 @@
+﻿#ifndef WMEDIAKITS_PACKETCAPTURE_H_
+#define WMEDIAKITS_PACKETCAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "WDumpWriter.h"
+
+/*
+ *  输入包抓取文件格式（所有整数均为小端）：
+ *
+ *  文件头（v2 起补零到 16 字节对齐）
+ *    0   char[8]  "WMKPCAP\0"
+ *    8   u32      版本号
+ *    12  u32      文件头总长度（含下面的 codec 名和补零）
+ *    16  u16      音频 codec 名长度 n，后跟 n 字节
+ *        u16      视频 codec 名长度 m，后跟 m 字节
+ *
+ *  每条记录
+ *    0   u8       类型（WPacketType）
+ *    1   u8       flags（保留，写 0）
+ *    2   u16      保留
+ *    4   u32      负载长度
+ *    8   u64      到达时间（微秒，相对开始抓取的单调时钟）
+ *    16  负载
+ *        v2 起负载后补 AV_INPUT_BUFFER_PADDING_SIZE 个以上的 0，使下一条记录 16 字节对齐，
+ *        映射后的负载可以直接交给解码器
+ *
+ *  尾部索引（v2，正常关闭时写入；异常退出的文件没有，读取时退回逐条扫描）
+ *        u64[count]  每条记录的文件偏移
+ *        u64         索引起始偏移（= 记录区结束位置）
+ *        u64         count
+ *        char[8]     "WMKPIDX\0"
+ */
+
+namespace wmediakits {
+
+class WDecoder;
+class WSDLPlayer;
+
+enum class WPacketType : uint8_t {
+    Video = 1,
+    Audio = 2
+};
+
+// 把 ProcessVideo/ProcessAudio 收到的每个包连同到达时间追加写入文件。
+// 写盘走 WDumpWriter，调用线程只做一次拷贝；缓冲满时丢包并计数。
+class WPacketRecorder {
+public:
+    WPacketRecorder();
+    ~WPacketRecorder();
+
+    bool Open(const std::string& path, const std::string& acodec_name, const std::string& vcodec_name);
+    void Close();
+    bool IsOpen() const { return m_writer.IsOpen(); }
+
+    // 任意线程调用，非阻塞
+    bool Record(WPacketType type, const uint8_t* data, int size);
+
+    uint64_t PacketCount() const { return m_packets.load(std::memory_order_relaxed); }
+    uint64_t DroppedPackets() const { return m_writer.DroppedRecords(); }
+
+private:
+    WPacketRecorder(const WPacketRecorder&) = delete;
+    WPacketRecorder& operator=(const WPacketRecorder&) = delete;
+
+    WDumpWriter m_writer;
+    std::chrono::steady_clock::time_point m_start;
+    std::atomic<uint64_t> m_packets{ 0 };
+
+    // 以下受 m_indexMutex 保护；Close() 先封口再写索引，之后到达的包直接丢弃
+    std::mutex            m_indexMutex;
+    std::vector<uint64_t> m_index;
+    uint64_t              m_offset = 0;
+    bool                  m_sealed = false;
+};
+
+// 读取抓取文件并按原始节奏（或尽快）把包重新喂给播放器/解码器。
+class WPacketReplayer {
+public:
+    enum class Mode {
+        RealTime,        // 按记录的到达时间间隔回放，保留抖动
+        AsFastAsPossible // 不等待，用于压测解码/渲染
+    };
+
+    typedef std::function<void(WPacketType type, uint8_t* data, int size)> PacketHandler;
+
+    struct Stats {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        double   seconds = 0.0;   // 回放实际耗时
+        double   maxLateMs = 0.0; // RealTime 模式下最大的投递延迟
+    };
+
+    WPacketReplayer();
+    ~WPacketReplayer();
+
+    bool Open(const std::string& path);
+    void Close();
+
+    const std::string& AudioCodecName() const { return m_acodecName; }
+    const std::string& VideoCodecName() const { return m_vcodecName; }
+
+    // 在调用线程上阻塞回放到文件结束或 Stop()。文件损坏/截断时返回 false。
+    bool Replay(Mode mode, const PacketHandler& handler);
+    bool Replay(Mode mode, WSDLPlayer& player);
+
+    // 任意线程调用，让 Replay() 尽快返回
+    void Stop() { m_stop.store(true, std::memory_order_relaxed); }
+
+    Stats GetStats() const { return m_stats; }
+
+private:
+    WPacketReplayer(const WPacketReplayer&) = delete;
+    WPacketReplayer& operator=(const WPacketReplayer&) = delete;
+
+    FILE*       m_file = nullptr;
+    std::string m_acodecName;
+    std::string m_vcodecName;
+    uint32_t    m_version = 0;
+    uint64_t    m_dataOffset = 0;
+    uint64_t    m_dataEnd = 0;
+
+    std::vector<uint8_t> m_payload;
+    std::atomic<bool>    m_stop{ false };
+    Stats                m_stats;
+};
+
+// 把抓取文件整个映射进内存，按尾部索引直接给出指向映射区的包指针。
+// 回放过程中不拷贝、不分配堆内存，多 GB 的文件也能以内存带宽回放。
+// 只支持 v2 文件（负载后带解码器要求的补零）。
+class WPacketMappedReader {
+public:
+    struct Packet {
+        WPacketType    type;
+        const uint8_t* data; // 指向映射区，后面至少有 AV_INPUT_BUFFER_PADDING_SIZE 个 0
+        int            size;
+        uint64_t       arrivalUs;
+    };
+
+    WPacketMappedReader();
+    ~WPacketMappedReader();
+
+    bool Open(const std::string& path);
+    void Close();
+
+    const std::string& AudioCodecName() const { return m_acodecName; }
+    const std::string& VideoCodecName() const { return m_vcodecName; }
+
+    size_t PacketCount() const { return m_count; }
+    Packet GetPacket(size_t i) const;
+    // false 表示文件没有尾部索引（异常退出），索引是打开时扫描出来的
+    bool HasFooterIndex() const { return m_footerIndex != nullptr; }
+
+    bool Replay(WPacketReplayer::Mode mode, const WPacketReplayer::PacketHandler& handler);
+    // 直接把映射区指针交给解码器，audio/video 可以为 nullptr
+    bool Replay(WPacketReplayer::Mode mode, WDecoder* audio, WDecoder* video);
+
+    void Stop() { m_stop.store(true, std::memory_order_relaxed); }
+    WPacketReplayer::Stats GetStats() const { return m_stats; }
+
+private:
+    WPacketMappedReader(const WPacketMappedReader&) = delete;
+    WPacketMappedReader& operator=(const WPacketMappedReader&) = delete;
+
+    bool scanRecords(uint64_t dataOffset, uint64_t dataEnd);
+
+    const uint8_t* m_base = nullptr;
+    uint64_t       m_size = 0;
+    uint64_t       m_dataEnd = 0;
+
+    std::string m_acodecName;
+    std::string m_vcodecName;
+
+    const uint8_t*        m_footerIndex = nullptr; // 指向映射区内的索引
+    std::vector<uint64_t> m_scanIndex;             // 没有尾部索引时扫描得到
+    size_t                m_count = 0;
+
+    std::atomic<bool>      m_stop{ false };
+    WPacketReplayer::Stats m_stats;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_PACKETCAPTURE_H_
@@ -13,6 +13,10 @@
 #include <functional>
 
 #include "WDecoder.h"
+#include "WDumpWriter.h"
+#include "WFrameFanout.h"
+#include "WPacketCapture.h"
+#include "WStreamRecorder.h"
 
 namespace wmediakits {
 
@@ -40,18 +44,69 @@ class WSDLPlayer : public WDecoder::Client {
     typedef std::function<void()> OnDisconnect;
 
 public:
+    // finished=false 表示到截止时间还没停完（仍在后台继续，线程最终都会被 join）
+    typedef std::function<void(bool finished)> OnStopped;
+
     WSDLPlayer(std::shared_ptr<ISDLEventHandler> eventHandler);
+    // 不能在渲染线程上（ISDLEventHandler 的回调里）析构
     ~WSDLPlayer();
 
     void Init(const std::string & name, const std::string& acodec_name, const std::string& vcodec_name);
     void Play();
     void Stop();
+    // 不阻塞调用方：在后台执行 Stop()，完成或到 deadlineMs 时（先到者）回调一次。
+    // 回调在后台线程上；只有 finished == true 时才能在回调里销毁播放器，
+    // finished == false 时拆除还在进行，析构会一直等到它结束
+    void StopAsync(OnStopped done = nullptr, int deadlineMs = 3000);
 
     void ProcessVideo(uint8_t* buffer, int bufSize);
     void ProcessAudio(uint8_t* buffer, int bufSize);
 
     void RegisterOnDisconnect(OnDisconnect handler);
 
+    // 把之后收到的输入包连同到达时间录到 path，可用 WPacketReplayer 回放复现问题
+    bool StartPacketCapture(const std::string& path);
+    void StopPacketCapture();
+
+    // 把之后收到的压缩包不解码地封装成 MP4/MKV 录像（见 WStreamRecorder），与播放互不影响
+    bool StartRecording(const std::string& path, const WStreamRecorder::Options& options);
+    void StopRecording();
+
+    // 本会话各级缓冲占用的内存
+    struct MemoryUsage {
+        std::string name;                  // Init() 传入的窗口名
+        size_t   video_packet_bytes = 0;   // 待解码的视频包
+        size_t   audio_packet_bytes = 0;   // 待解码的音频包
+        size_t   render_frames = 0;        // 待渲染的帧数
+        size_t   render_frame_bytes = 0;   // 待渲染帧引用的 AVBufferRef 大小之和
+        size_t   sdl_audio_bytes = 0;      // SDL 设备里排队的 PCM（SDL_GetQueuedAudioSize）
+        size_t   sink_frame_bytes = 0;     // 视频 sink 队列里的帧引用（与渲染队列共享的缓冲会重复计入）
+        size_t   decoder_bytes = 0;        // 音视频解码器内部缓冲，估算值
+        size_t   budget = 0;
+        uint64_t budget_drops = 0;         // 因超预算丢掉的包/帧
+
+        size_t Total() const
+        {
+            return video_packet_bytes + audio_packet_bytes + render_frame_bytes +
+                   sdl_audio_bytes + sink_frame_bytes + decoder_bytes;
+        }
+    };
+
+    // 0 表示不限制。解码器内部缓冲丢不掉，先从预算里扣掉，剩下的管队列：超出时依次
+    // 渲染队列和各视频 sink 只留一帧 -> 丢最老的音频包，只剩 SDL 里排队的 PCM 超出时清掉它
+    // -> 清空视频包并丢到下一个关键帧（视频包不能挑着丢，后面的帧参考前面的），还不够再清 PCM
+    void SetMemoryBudget(size_t bytes) { m_memoryBudget.store(bytes, std::memory_order_relaxed); }
+    MemoryUsage GetMemoryUsage() const;
+    // 进程内所有 WSDLPlayer，按 Total() 从大到小
+    static std::vector<MemoryUsage> GetProcessMemoryReport();
+
+    // 解码后的视频帧除了送窗口，再以引用（不拷贝像素）分给这些 sink（见 WFrameFanout）。
+    // 每个 sink 有自己的线程和有界队列，慢了只丢它自己的帧，不影响渲染
+    int  AddVideoSink(WFrameFanout::FrameSink sink);
+    int  AddVideoSink(WFrameFanout::FrameSink sink, const WFrameFanout::SinkOptions& options);
+    void RemoveVideoSink(int id);
+    std::vector<WFrameFanout::SinkStats> GetVideoSinkStats() const { return m_videoFanout.GetStats(); }
+
     void InitAudioDecoder(const std::string& acodec_name);
     void InitVideoDecoder(const std::string& vcodec_name);
 
@@ -62,7 +117,16 @@ private:
     void AudioThreadFunc();
     void Render();
 
-    void ClearQueue(std::queue<AVFrame*>& queue);
+    // 调用方持有 m_renderMutex；丢到只剩 keep 帧，返回丢掉的帧数
+    size_t TrimRenderQueue(size_t keep);
+
+    size_t MemoryBytes() const;
+    // 丢帧/丢包能腾出来的部分（不含解码器内部缓冲）
+    size_t DroppableBytes() const;
+    // 预算扣掉解码器估算后留给可丢部分的字节数；没设预算返回 SIZE_MAX
+    size_t DroppableBudget() const;
+    // keepNewestVideo：最新入队的视频包是刚等到的关键帧，清空视频队列时留下它
+    void   EnforceMemoryBudget(bool keepNewestVideo = false);
 
     void CreateWindowAndRenderer(int width, int height);
 
@@ -85,6 +149,10 @@ private:
     std::string m_winName;
     //MiracastDevice* m_device;
     int m_lastX = 0, m_lastY = 0;
+
+    // 包/帧的复用池，必须声明在下面的队列之前（队列里的对象析构时要还回池）
+    AVPacketPool m_packetPool;
+    AVFramePool  m_framePool;
     
     // audio
     SDL_AudioSpec m_audioSpec;
@@ -92,7 +160,7 @@ private:
 
     std::condition_variable m_audioCV;
     std::mutex m_audioMutex;
-    std::queue<std::vector<uint8_t>> m_audioQueue;
+    std::queue<AVPacketPool::UniquePtr> m_audioQueue;
 
     // video
     SDL_Window* m_window;
@@ -101,10 +169,21 @@ private:
 
     std::condition_variable m_videoCV;
     std::mutex m_videoMutex;
-    std::queue<std::vector<uint8_t>> m_videoQueue;
+    std::queue<AVPacketPool::UniquePtr> m_videoQueue;
 
     std::mutex m_renderMutex;
-    std::queue<AVFrame*> m_renderQueue;
+    std::queue<AVFramePool::UniquePtr> m_renderQueue;
+
+    // 内存统计：在对应队列的锁内修改，读不加锁
+    std::atomic<size_t>   m_videoQueueBytes{ 0 };
+    std::atomic<size_t>   m_audioQueueBytes{ 0 };
+    std::atomic<size_t>   m_renderQueueBytes{ 0 };
+    std::atomic<size_t>   m_renderQueueFrames{ 0 };
+    std::atomic<size_t>   m_sdlQueuedBytes{ 0 };    // 音频线程每次入队后刷新
+    std::atomic<bool>     m_clearSdlAudio{ false }; // EnforceMemoryBudget 要求音频线程清掉排队的 PCM
+    std::atomic<size_t>   m_memoryBudget{ 0 };
+    std::atomic<uint64_t> m_budgetDrops{ 0 };
+    std::atomic<bool>     m_videoWaitKey{ false };  // 超预算清空过视频包，等关键帧
 
     std::atomic<bool> m_quit{ false };
     int m_videoWidth;
@@ -115,6 +194,12 @@ private:
 
     std::thread m_audioThread;
     std::thread m_videoThread;
+    std::thread m_renderThread;  // 窗口事件 + 渲染
+
+    std::mutex m_stopMutex;             // 串行化 Stop()
+    std::mutex m_asyncStopMutex;
+    std::condition_variable m_asyncStopCV;
+    int m_asyncStops = 0;               // 还没跑完的 StopAsync 任务，析构时等它们
 
     std::queue<CreateWindowEvent> m_customEventQueue;
     std::mutex m_queueMutex;
@@ -123,9 +208,13 @@ private:
 
     OnDisconnect m_onDisconnect;
 
-    FILE* m_pcmDumpFile = nullptr;
+    WDumpWriter m_pcmDump;           // 后台线程写盘，音频线程只做 memcpy
     bool  m_enablePcmDump = false;   // 想开就开
 
+    WPacketRecorder m_packetRecorder;
+    WStreamRecorder m_streamRecorder;
+    WFrameFanout    m_videoFanout;
+
     std::vector<uint8_t> interleaved_audio_buffer;
 };
 
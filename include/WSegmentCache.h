@@ -0,0 +1,122 @@
+﻿#ifndef WMEDIAKITS_SEGMENTCACHE_H_
+#define WMEDIAKITS_SEGMENTCACHE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace wmediakits {
+
+// 多个播放器（多个会话）共用的 HLS 分片磁盘缓存。
+// 以本机回环 HTTP 代理的形式挡在 mpv 的网络层前面 —— lavf 的 hls 解复用器只肯通过
+// http/file 打开分片，stream_cb 注册的自定义协议走不通：
+//  - 播放列表每次都回源取最新的，把里面的分片/子播放列表地址改写成代理地址，不落盘
+//  - 分片以 url 的 SHA-256 为 key 落盘；同一分片的并发请求只回源一次，其余等它下完
+//  - 总大小超过上限时按最近最少使用淘汰，正在被读的分片不会被删
+// 分片整段下完才开始发给播放器，适合几秒一段的 HLS，不要拿来代理大文件。
+// 一个目录同时只能由一个 WSegmentCache 使用。
+class WSegmentCache {
+public:
+    struct Options {
+        std::string dir;                   // 缓存目录（只会创建最后一级）
+        uint64_t max_bytes = 1ull << 30;   // 磁盘占用上限
+        bool     ignore_query = false;     // 算 key 时去掉 ?query（CDN 按会话签名、内容相同时打开）
+        int      timeout_ms = 10000;       // 回源的读写超时
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t bytes_on_disk = 0;
+        uint64_t bytes_fetched = 0;  // 回源下载的字节（含播放列表）
+        uint64_t bytes_served = 0;   // 发给播放器的字节
+        size_t   entries = 0;
+    };
+
+    explicit WSegmentCache(const Options& options);
+    ~WSegmentCache();
+
+    // 载入目录里已有的分片，监听 127.0.0.1 的随机端口
+    bool Start();
+    // 断开所有连接并 join 所有线程；磁盘上的分片保留，下次 Start() 继续用
+    void Stop();
+    bool IsRunning() const { return m_running.load(); }
+    uint16_t Port() const { return m_port; }
+
+    // http(s) 的 .m3u8/.m3u 地址换成代理地址，其它（或未 Start）原样返回
+    std::string ProxyUrl(const std::string& url) const;
+
+    Stats GetStats() const;
+
+    // 分片的 key：url（按 ignore_query 处理后）的 SHA-256 十六进制
+    std::string KeyFor(const std::string& url) const;
+
+private:
+    WSegmentCache(const WSegmentCache&) = delete;
+    WSegmentCache& operator=(const WSegmentCache&) = delete;
+
+    struct Entry {
+        uint64_t size = 0;
+        int      pins = 0;       // 正在读它的连接数
+        bool     ready = false;  // false：有连接正在回源下载
+        std::list<std::string>::iterator lru;
+    };
+
+    enum FetchResult { kFetchFailed, kFetchFile, kFetchMemory };
+
+    void acceptLoop();
+    void serve(intptr_t sock);
+    // 取分片：命中直接 pin；未命中回源，同 key 的并发请求等第一个下完。
+    // 内容其实是播放列表时不缓存，放进 memory 返回 kFetchMemory
+    FetchResult acquire(const std::string& url, std::string& key, uint64_t& size, std::string& memory,
+                        std::string& location);
+    void release(const std::string& key);
+    // tmpPath 为空时全部读进 memory；否则先看开头，是播放列表就读进 memory，不是就写文件。
+    // location 返回跟随重定向后的最终地址（取不到时就是 url）
+    FetchResult download(const std::string& url, const std::string& tmpPath, std::string& memory, uint64_t& size,
+                         std::string& location);
+    void evictLocked();
+    void scanDir();
+
+    // baseUrl 是播放列表重定向后的最终地址
+    std::string rewritePlaylist(const std::string& body, const std::string& baseUrl) const;
+    std::string proxyUrlFor(const std::string& url) const;
+    std::string entryPath(const std::string& key) const;
+
+    static int interruptCallback(void* opaque);
+
+    const Options m_opt;
+
+    std::atomic<bool> m_running{ false };
+    std::atomic<bool> m_quit{ false };
+    uint16_t    m_port = 0;
+    intptr_t    m_listen = -1;
+    std::thread m_acceptThread;
+
+    // 每个连接一个线程；结束的由 accept 线程回收（join 后关 socket），Stop() 时全部 join
+    struct Conn {
+        std::thread thread;
+        intptr_t    sock = -1;
+        bool        done = false;
+    };
+    std::mutex      m_connMx;
+    std::list<Conn> m_conns;
+
+    // 磁盘索引
+    mutable std::mutex      m_mx;
+    std::condition_variable m_cv;   // 某个分片下完/下载失败
+    std::map<std::string, Entry> m_entries;
+    std::list<std::string>  m_lru;  // 最近用过的在前
+    Stats m_stats;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_SEGMENTCACHE_H_
@@ -0,0 +1,133 @@
+﻿#ifndef WMEDIAKITS_STREAMRECORDER_H_
+#define WMEDIAKITS_STREAMRECORDER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "avcodec_glue.h"
+#include "WPacketCapture.h"
+
+struct AVFormatContext;
+struct AVStream;
+
+namespace wmediakits {
+
+// 把 ProcessVideo/ProcessAudio 收到的压缩包直接封装成 MP4/MKV 录像，不解码也不重新编码。
+// Record() 只在调用线程上拷贝一次入队；分帧、封装、写盘都在后台线程上完成。
+//
+// 输入约定与 WDecoder 相同：视频是 h264/hevc 的 Annex B 字节流或 vp8 帧（经 parser 分帧），
+// 音频是裸帧（aac-eld/alac 按 AirPlay 的固定配置，opus 按 48kHz 立体声）。
+// 包不带时间戳，按到达时间打点；实时镜像流没有 B 帧，pts = dts。
+//
+//  - 等到第一个带参数集的视频关键帧才开始写（之前的音视频包丢掉），SPS/PPS 等写进 extradata
+//  - MP4 默认写成分片（empty_moov + 关键帧/定时切片），进程崩溃时已写的部分仍可播放；
+//    MKV 本身按 cluster 顺序写出
+//  - 可按大小或时长在视频关键帧处切到下一个文件：rec.mp4 -> rec_000.mp4、rec_001.mp4 ...
+class WStreamRecorder {
+public:
+    struct Options {
+        std::string format;                    // "mp4"/"matroska" 等，空时按扩展名
+        bool     fragmented = true;            // MP4 写成分片
+        int      fragment_ms = 1000;           // 分片最长时长，MKV 为 cluster 时长
+        uint64_t rotate_bytes = 0;             // 当前文件超过这么大时在下一个关键帧切文件；0 不切
+        int      rotate_seconds = 0;           // 同上，按时长
+        size_t   max_queue_bytes = 64 << 20;   // 后台写不过来时最多积压的字节，超过丢包
+    };
+
+    // 一个文件写完（trailer 已写、已关闭），在后台线程上回调
+    typedef std::function<void(const std::string& path)> FileClosedHandler;
+
+    WStreamRecorder();
+    ~WStreamRecorder();
+
+    bool Open(const std::string& path, const std::string& acodec_name, const std::string& vcodec_name);
+    bool Open(const std::string& path, const std::string& acodec_name, const std::string& vcodec_name,
+              const Options& options);
+    // 写完队列里剩下的包再关闭
+    void Close();
+    bool IsOpen() const { return m_open.load(std::memory_order_relaxed); }
+
+    // Open() 之前设置
+    void SetFileClosedHandler(FileClosedHandler handler) { m_onFileClosed = std::move(handler); }
+
+    // 任意线程调用，非阻塞
+    bool Record(WPacketType type, const uint8_t* data, int size);
+
+    uint64_t PacketCount() const { return m_packets.load(std::memory_order_relaxed); }
+    uint64_t DroppedPackets() const { return m_dropped.load(std::memory_order_relaxed); }
+    uint32_t FileCount() const { return m_files.load(std::memory_order_relaxed); }
+
+private:
+    WStreamRecorder(const WStreamRecorder&) = delete;
+    WStreamRecorder& operator=(const WStreamRecorder&) = delete;
+
+    struct Track {
+        AVCodecID            codec_id = AV_CODEC_ID_NONE;
+        std::vector<uint8_t> extradata;
+        int width = 0;
+        int height = 0;
+        int sample_rate = 0;
+        int channels = 0;
+        AVStream* stream = nullptr;
+        int64_t   last_dts = 0;
+        int64_t   last_arrival = 0;
+        bool      written = false;
+    };
+
+    void threadFunc();
+    void handleVideo(AVPacketPool::UniquePtr packet);
+    void writeVideoFrame(const uint8_t* data, int size, bool key, int64_t arrivalUs);
+    void writeAudio(const uint8_t* data, int size, int64_t arrivalUs);
+    bool writePacket(Track& track, const uint8_t* data, int size, bool key, int64_t arrivalUs);
+
+    bool openFile(int64_t arrivalUs);
+    void closeFile();
+    bool shouldRotate(int64_t arrivalUs) const;
+    std::string nextPath();
+
+    Options     m_opt;
+    std::string m_path;
+    std::atomic<bool> m_open{ false };
+    std::chrono::steady_clock::time_point m_start;
+    FileClosedHandler m_onFileClosed;
+
+    AVPacketPool m_packetPool;
+
+    // 入队：受 m_mx 保护
+    std::mutex              m_mx;
+    std::condition_variable m_cv;
+    std::deque<AVPacketPool::UniquePtr> m_queue;
+    size_t                  m_queueBytes = 0;
+    bool                    m_closing = false;
+    std::thread             m_thread;
+
+    std::atomic<uint64_t> m_packets{ 0 };
+    std::atomic<uint64_t> m_dropped{ 0 };
+    std::atomic<uint32_t> m_files{ 0 };
+
+    // 以下只在后台线程上访问
+    bool  m_hasVideo = false;
+    bool  m_hasAudio = false;
+    Track m_video;
+    Track m_audio;
+    AVCodecParserContextUniquePtr m_parser;
+    AVCodecContextUniquePtr       m_parserCtx;
+    AVPacketUniquePtr             m_outPacket;
+    AVFormatContext* m_fmt = nullptr;
+    std::string      m_filePath;
+    int64_t          m_fileStartUs = 0;
+    uint32_t         m_fileIndex = 0;
+};
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_STREAMRECORDER_H_
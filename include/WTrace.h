@@ -0,0 +1,80 @@
+﻿#ifndef WMEDIAKITS_TRACE_H_
+#define WMEDIAKITS_TRACE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+namespace wmediakits {
+
+// 管线时间线追踪：ingest -> 队列等待 -> 解码 -> 渲染各段打成 span，按需导出成
+// Chrome trace-event JSON（chrome://tracing 或 ui.perfetto.dev 直接打开）。
+//
+// 只有定义了 WMEDIAKITS_ENABLE_TRACE 才编进来；否则 WMK_TRACE_* 宏展开为空，
+// 下面的函数是空实现（WriteChromeJson 返回 false），调用方不用加 #ifdef。
+// 编进来之后还要 SetEnabled(true) 才开始记录，没开时每个 span 只多一次原子读。
+//
+// 每个线程一块定长环形缓冲（约 384KB），线程第一次记录时才分配，之后记录时不加锁、
+// 不分配（满了覆盖最老的）；一个 span 只在结束时写一条 complete 事件。
+// span 名字必须是字符串字面量。已退出线程的缓冲只保留最近的几个，有新线程开始记录时释放其余的。
+class WTrace {
+public:
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // 导出时作为线程名显示；不分配缓冲，没开记录时也可以调用
+    static void SetThreadName(const char* name);
+
+    // 导出所有线程（包括保留着的已退出线程）缓冲里的事件，不清空
+    static bool WriteChromeJson(const std::string& path);
+    // 丢掉已记录的事件和已退出线程的缓冲
+    static void Clear();
+
+    static int64_t NowUs();
+    static void Record(const char* name, int64_t startUs, int64_t endUs);
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+#ifdef WMEDIAKITS_ENABLE_TRACE
+
+class WTraceScope {
+public:
+    explicit WTraceScope(const char* name)
+        : m_name(WTrace::IsEnabled() ? name : nullptr)
+        , m_startUs(m_name ? WTrace::NowUs() : 0)
+    {
+    }
+    ~WTraceScope()
+    {
+        if (m_name)
+            WTrace::Record(m_name, m_startUs, WTrace::NowUs());
+    }
+
+private:
+    WTraceScope(const WTraceScope&) = delete;
+    WTraceScope& operator=(const WTraceScope&) = delete;
+
+    const char* m_name;
+    int64_t     m_startUs;
+};
+
+#define WMK_TRACE_CONCAT_(a, b) a##b
+#define WMK_TRACE_CONCAT(a, b) WMK_TRACE_CONCAT_(a, b)
+// 从这里到所在作用域结束记为一个 span
+#define WMK_TRACE_SCOPE(name) \
+    ::wmediakits::WTraceScope WMK_TRACE_CONCAT(wmkTraceScope_, __LINE__)(name)
+#define WMK_TRACE_THREAD_NAME(name) ::wmediakits::WTrace::SetThreadName(name)
+
+#else
+
+#define WMK_TRACE_SCOPE(name) ((void)0)
+#define WMK_TRACE_THREAD_NAME(name) ((void)0)
+
+#endif // WMEDIAKITS_ENABLE_TRACE
+
+}  // namespace wmediakits
+
+#endif // WMEDIAKITS_TRACE_H_
@@ -8,8 +8,15 @@ extern "C" {
 #include <libavutil/samplefmt.h>
 }
 
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <utility>
+#include <vector>
 
 namespace wmediakits {
 
@@ -46,6 +53,317 @@ DEFINE_AV_UNIQUE_PTR(AVFrame, av_frame_alloc, av_frame_free(&obj));
 
 #undef DEFINE_AV_UNIQUE_PTR
 
+namespace internal {
+
+struct AVFramePoolTraits {
+  static AVFrame* Alloc() { return av_frame_alloc(); }
+  static void Reset(AVFrame* obj) { av_frame_unref(obj); }
+  static void Free(AVFrame* obj) { av_frame_free(&obj); }
+};
+
+struct AVPacketPoolTraits {
+  static AVPacket* Alloc() { return av_packet_alloc(); }
+  static void Reset(AVPacket* obj) { av_packet_unref(obj); }
+  static void Free(AVPacket* obj) { av_packet_free(&obj); }
+};
+
+}  // namespace internal
+
+// Thread-safe recycling pool of AVFrame/AVPacket shells. The UniquePtr
+// deleter unrefs the object and puts it back on the freelist instead of
+// freeing it, so steady-state acquire/release does not touch the allocator.
+// At most |max_free| idle objects are kept; extras are freed on release.
+// The pool must outlive every UniquePtr it hands out.
+template <typename T, typename Traits>
+class AVObjectPool {
+ public:
+  struct Stats {
+    size_t in_use = 0;
+    size_t free = 0;
+    size_t in_use_high_water = 0;
+    size_t free_high_water = 0;
+    uint64_t allocations = 0;  // Objects created with Traits::Alloc().
+    uint64_t reuses = 0;       // Acquires served from the freelist.
+  };
+
+  class Recycler {
+   public:
+    Recycler() = default;
+    explicit Recycler(AVObjectPool* pool) : pool_(pool) {}
+
+    void operator()(T* obj) const {
+      if (obj) {
+        pool_->Release(obj);
+      }
+    }
+
+   private:
+    AVObjectPool* pool_ = nullptr;
+  };
+
+  using UniquePtr = std::unique_ptr<T, Recycler>;
+
+  explicit AVObjectPool(size_t max_free = 32) : max_free_(max_free) {
+    free_.reserve(max_free_);
+  }
+
+  ~AVObjectPool() {
+    for (T* obj : free_) {
+      Traits::Free(obj);
+    }
+  }
+
+  // Returns null only if a new object had to be allocated and that failed.
+  UniquePtr Acquire() {
+    T* obj = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        obj = free_.back();
+        free_.pop_back();
+        stats_.free = free_.size();
+        ++stats_.reuses;
+        MarkInUseLocked();
+        return UniquePtr(obj, Recycler(this));
+      }
+    }
+
+    obj = Traits::Alloc();
+    if (!obj) {
+      return UniquePtr(nullptr, Recycler(this));
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.allocations;
+    MarkInUseLocked();
+    return UniquePtr(obj, Recycler(this));
+  }
+
+  Stats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  // Called with each object on release, before it is reset. Must be set
+  // before the first Acquire().
+  using ReleaseHook = void (*)(void* opaque, T* obj);
+  void SetReleaseHook(ReleaseHook hook, void* opaque) {
+    release_hook_ = hook;
+    release_hook_opaque_ = opaque;
+  }
+
+ private:
+  AVObjectPool(const AVObjectPool&) = delete;
+  AVObjectPool& operator=(const AVObjectPool&) = delete;
+
+  void MarkInUseLocked() {
+    ++stats_.in_use;
+    stats_.in_use_high_water =
+        std::max(stats_.in_use_high_water, stats_.in_use);
+  }
+
+  void Release(T* obj) {
+    if (release_hook_) {
+      release_hook_(release_hook_opaque_, obj);
+    }
+    // Unref outside the lock: it may free large buffers.
+    Traits::Reset(obj);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --stats_.in_use;
+      if (free_.size() < max_free_) {
+        free_.push_back(obj);
+        stats_.free = free_.size();
+        stats_.free_high_water = std::max(stats_.free_high_water, stats_.free);
+        return;
+      }
+    }
+    Traits::Free(obj);
+  }
+
+  const size_t max_free_;
+  mutable std::mutex mutex_;
+  std::vector<T*> free_;
+  Stats stats_;
+  ReleaseHook release_hook_ = nullptr;
+  void* release_hook_opaque_ = nullptr;
+};
+
+using AVFramePool = AVObjectPool<AVFrame, internal::AVFramePoolTraits>;
+
+// Bytes held by the data buffers of |frame| (sum of its AVBufferRef sizes,
+// including extended_buf). Buffers shared with other references are counted
+// in full, so this is what the frame keeps alive, not what it owns.
+inline size_t AVFrameBufferBytes(const AVFrame& frame) {
+  size_t bytes = 0;
+  for (const AVBufferRef* buf : frame.buf) {
+    if (buf) {
+      bytes += buf->size;
+    }
+  }
+  for (int i = 0; i < frame.nb_extended_buf; ++i) {
+    if (frame.extended_buf[i]) {
+      bytes += frame.extended_buf[i]->size;
+    }
+  }
+  return bytes;
+}
+
+// Pool of AVPackets whose payloads also come from pooled memory. Payload
+// buffers are served from power-of-two AVBufferPools that are created on
+// first use, so the pool grows to fit the largest packets seen and the
+// buffers go back to their bucket when the packet is unreffed.
+class AVPacketPool {
+ public:
+  using Shells = AVObjectPool<AVPacket, internal::AVPacketPoolTraits>;
+  using UniquePtr = Shells::UniquePtr;
+
+  static constexpr size_t kMinBucketBytes = 4 << 10;
+  static constexpr int kNumBuckets = 14;  // 4 KiB .. 32 MiB.
+
+  struct BucketStats {
+    size_t buffer_bytes = 0;  // Size of every buffer in this bucket.
+    size_t outstanding = 0;   // Buffers held by live packets.
+    size_t allocated = 0;     // Buffers the bucket owns; it never shrinks.
+  };
+
+  // Shell stats plus the payload memory, which is what actually matters.
+  struct Stats : Shells::Stats {
+    BucketStats buckets[kNumBuckets];
+    size_t oversized_outstanding = 0;        // Live packets above 32 MiB.
+    size_t oversized_bytes = 0;
+    size_t payload_bytes = 0;                // Owned by buckets + oversized.
+    size_t outstanding_payload_bytes = 0;    // Held by live packets.
+  };
+
+  explicit AVPacketPool(size_t max_free = 64) : shells_(max_free) {
+    shells_.SetReleaseHook(&AVPacketPool::OnPacketReleased, this);
+  }
+
+  ~AVPacketPool() {
+    // Buffers still referenced by live packets keep their pool alive.
+    for (AVBufferPool*& bucket : buckets_) {
+      av_buffer_pool_uninit(&bucket);
+    }
+  }
+
+  // Returns a packet holding a copy of |data| followed by
+  // AV_INPUT_BUFFER_PADDING_SIZE zero bytes, or null on allocation failure.
+  UniquePtr AcquireCopy(const uint8_t* data, int size) {
+    UniquePtr packet = shells_.Acquire();
+    if (!packet || size < 0) {
+      return UniquePtr(nullptr, packet.get_deleter());
+    }
+
+    AVBufferRef* buf = GetBuffer(static_cast<size_t>(size) +
+                                 AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!buf) {
+      return UniquePtr(nullptr, packet.get_deleter());
+    }
+    memcpy(buf->data, data, size);
+    memset(buf->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    packet->buf = buf;
+    packet->data = buf->data;
+    packet->size = size;
+    return packet;
+  }
+
+  Stats GetStats() const {
+    Stats stats;
+    static_cast<Shells::Stats&>(stats) = shells_.GetStats();
+    for (int i = 0; i < kNumBuckets; ++i) {
+      BucketStats& b = stats.buckets[i];
+      b.buffer_bytes = kMinBucketBytes << i;
+      b.outstanding = outstanding_[i].load(std::memory_order_relaxed);
+      b.allocated = high_water_[i].load(std::memory_order_relaxed);
+      stats.payload_bytes += b.allocated * b.buffer_bytes;
+      stats.outstanding_payload_bytes += b.outstanding * b.buffer_bytes;
+    }
+    stats.oversized_outstanding =
+        oversized_outstanding_.load(std::memory_order_relaxed);
+    stats.oversized_bytes = oversized_bytes_.load(std::memory_order_relaxed);
+    stats.payload_bytes += stats.oversized_bytes;
+    stats.outstanding_payload_bytes += stats.oversized_bytes;
+    return stats;
+  }
+
+ private:
+  AVPacketPool(const AVPacketPool&) = delete;
+  AVPacketPool& operator=(const AVPacketPool&) = delete;
+
+  // Bucket of a buffer from GetBuffer(), by its size; kNumBuckets if
+  // oversized.
+  static int BucketIndex(size_t buffer_bytes) {
+    int index = 0;
+    size_t bucket_bytes = kMinBucketBytes;
+    while (bucket_bytes < buffer_bytes && index < kNumBuckets) {
+      bucket_bytes <<= 1;
+      ++index;
+    }
+    return index;
+  }
+
+  // The shells only ever hold payloads from GetBuffer(). Pool buffers report
+  // exactly their bucket's size, so the size identifies the bucket.
+  static void OnPacketReleased(void* opaque, AVPacket* packet) {
+    if (!packet->buf) {
+      return;
+    }
+    AVPacketPool* self = static_cast<AVPacketPool*>(opaque);
+    const size_t bytes = packet->buf->size;
+    const int index = BucketIndex(bytes);
+    if (index == kNumBuckets) {
+      self->oversized_outstanding_.fetch_sub(1, std::memory_order_relaxed);
+      self->oversized_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    } else {
+      self->outstanding_[index].fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  AVBufferRef* GetBuffer(size_t size) {
+    const int index = BucketIndex(size);
+    if (index == kNumBuckets) {
+      AVBufferRef* buf = av_buffer_alloc(size);  // Rare oversized packet.
+      if (buf) {
+        oversized_outstanding_.fetch_add(1, std::memory_order_relaxed);
+        oversized_bytes_.fetch_add(buf->size, std::memory_order_relaxed);
+      }
+      return buf;
+    }
+    const size_t bucket_bytes = kMinBucketBytes << index;
+
+    AVBufferPool* bucket = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!buckets_[index]) {
+        buckets_[index] = av_buffer_pool_init(bucket_bytes, nullptr);
+      }
+      bucket = buckets_[index];
+    }
+    // av_buffer_pool_get() is thread-safe on its own.
+    AVBufferRef* buf = bucket ? av_buffer_pool_get(bucket) : nullptr;
+    if (buf) {
+      // AVBufferPool only allocates when all its buffers are out, so the
+      // high-water mark of outstanding buffers is what the bucket owns.
+      const size_t now =
+          outstanding_[index].fetch_add(1, std::memory_order_relaxed) + 1;
+      size_t high = high_water_[index].load(std::memory_order_relaxed);
+      while (now > high && !high_water_[index].compare_exchange_weak(
+                               high, now, std::memory_order_relaxed)) {
+      }
+    }
+    return buf;
+  }
+
+  Shells shells_;
+  std::mutex mutex_;
+  AVBufferPool* buckets_[kNumBuckets] = {};
+  std::atomic<size_t> outstanding_[kNumBuckets] = {};
+  std::atomic<size_t> high_water_[kNumBuckets] = {};
+  std::atomic<size_t> oversized_outstanding_{0};
+  std::atomic<size_t> oversized_bytes_{0};
+};
+
 // Macros to enable backwards compability codepaths for older versions of
 // ffmpeg, where newer versions have deprecated APIs.  Note that ffmpeg defines
 // its own FF_API* macros that are related to removing APIs (not deprecating
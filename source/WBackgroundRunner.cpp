@@ -0,0 +1,141 @@
+﻿#include "WBackgroundRunner.h"
+
+#include <iterator>
+#include <utility>
+
+namespace wmediakits {
+
+WBackgroundRunner& WBackgroundRunner::Shared()
+{
+    static WBackgroundRunner runner;
+    return runner;
+}
+
+WBackgroundRunner::WBackgroundRunner(size_t maxWorkers)
+    : m_maxWorkers(maxWorkers > 0 ? maxWorkers : 1)
+{
+}
+
+WBackgroundRunner::~WBackgroundRunner()
+{
+    Shutdown();
+}
+
+void WBackgroundRunner::PostDelayed(Task task, int delayMs)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        if (m_shutdown)
+            return;
+        m_timers.emplace(Clock::now() + std::chrono::milliseconds(delayMs > 0 ? delayMs : 0), std::move(task));
+        // 调度线程按需启动
+        if (!m_timerThread.joinable())
+            m_timerThread = std::thread(&WBackgroundRunner::timerFunc, this);
+    }
+    m_timerCV.notify_one();
+}
+
+void WBackgroundRunner::PostBlocking(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        if (!m_shutdown) {
+            enqueueLocked(m_blocking, std::move(task));
+            return;
+        }
+    }
+    // 已经关闭（进程退出中）：就地执行，保证清理工作不丢
+    task();
+}
+
+void WBackgroundRunner::PostCallback(Task task, int delayMs)
+{
+    if (delayMs > 0) {
+        // 调度线程到时只把任务转交给回调线程，自己不执行用户代码
+        PostDelayed([this, task] {
+            std::lock_guard<std::mutex> lk(m_mx);
+            if (!m_shutdown)
+                enqueueLocked(m_callbacks, task);
+        }, delayMs);
+        return;
+    }
+    std::lock_guard<std::mutex> lk(m_mx);
+    if (!m_shutdown)
+        enqueueLocked(m_callbacks, std::move(task));
+}
+
+void WBackgroundRunner::enqueueLocked(Lane& lane, Task task)
+{
+    lane.work.push_back(std::move(task));
+    if (lane.idle < lane.work.size() && lane.workers.size() < m_maxWorkers)
+        lane.workers.emplace_back(&WBackgroundRunner::workerFunc, this, &lane);
+    lane.cv.notify_one();
+}
+
+void WBackgroundRunner::Shutdown()
+{
+    std::thread timer;
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_shutdown = true;
+        timer.swap(m_timerThread);
+        workers.swap(m_blocking.workers);
+        workers.insert(workers.end(),
+                       std::make_move_iterator(m_callbacks.workers.begin()),
+                       std::make_move_iterator(m_callbacks.workers.end()));
+        m_callbacks.workers.clear();
+    }
+    m_timerCV.notify_all();
+    m_blocking.cv.notify_all();
+    m_callbacks.cv.notify_all();
+
+    if (timer.joinable())
+        timer.join();
+    for (std::thread& t : workers)
+        t.join();
+
+    std::lock_guard<std::mutex> lk(m_mx);
+    m_timers.clear();
+}
+
+void WBackgroundRunner::timerFunc()
+{
+    std::unique_lock<std::mutex> lk(m_mx);
+    while (!m_shutdown) {
+        if (m_timers.empty()) {
+            m_timerCV.wait(lk);
+            continue;
+        }
+        auto it = m_timers.begin();
+        if (it->first > Clock::now()) {
+            m_timerCV.wait_until(lk, it->first);
+            continue;
+        }
+        Task task = std::move(it->second);
+        m_timers.erase(it);
+        lk.unlock();
+        task();
+        lk.lock();
+    }
+}
+
+void WBackgroundRunner::workerFunc(Lane* lane)
+{
+    std::unique_lock<std::mutex> lk(m_mx);
+    for (;;) {
+        ++lane->idle;
+        lane->cv.wait(lk, [this, lane] { return m_shutdown || !lane->work.empty(); });
+        --lane->idle;
+        // 关闭时先把排队的任务做完再退出
+        if (lane->work.empty())
+            return;
+        Task task = std::move(lane->work.front());
+        lane->work.pop_front();
+        lk.unlock();
+        task();
+        lk.lock();
+    }
+}
+
+}  // namespace wmediakits
@@ -1,4 +1,5 @@
 ﻿#include "WDecoder.h"
+#include "WTrace.h"
 
 #include <libavcodec/version.h>
 #include <libavutil/intreadwrite.h>  // AV_WB32, AV_WB16, AV_INPUT_BUFFER_PADDING_SIZE
@@ -8,15 +9,15 @@
 #include <sstream>
 #include <thread>
 
-static bool FillAlacExtradataForAirPlay(AVCodecContext* ctx)
-{
-    const int extradata_size = 36;
-    ctx->extradata = (uint8_t*)av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
-    if (!ctx->extradata)
-        return false;
+// AirPlay 的 ALAC magic cookie 长度与 AAC-ELD 的 AudioSpecificConfig
+static const int kAirPlayAlacConfigSize = 36;
+static const uint8_t kAirPlayEldConfig[] = { 0xF8, 0xE8, 0x50, 0x00 };
+static const int kAirPlaySampleRate = 44100;
+static const int kAirPlayChannels = 2;
 
-    ctx->extradata_size = extradata_size;
-    uint8_t* ed = ctx->extradata;
+static void WriteAlacConfigForAirPlay(uint8_t* ed)
+{
+    const int extradata_size = kAirPlayAlacConfigSize;
 
     // 下面这些值对应 AirPlay 的 ALAC 配置：
     const int frames_per_packet = 352;   // spf
@@ -24,11 +25,11 @@ static bool FillAlacExtradataForAirPlay(AVCodecContext* ctx)
     const int history_mult = 40;
     const int initial_history = 10;
     const int rice_limit = 14;
-    const int channels = 2;
+    const int channels = kAirPlayChannels;
     const int max_run = 255;
     const int max_frame_bytes = 0;     // 0 = unknown / auto
     const int avg_bitrate = 0;     // 0 = unknown / auto
-    const int sample_rate = 44100;
+    const int sample_rate = kAirPlaySampleRate;
 
     // 注意：ALAC atom 使用 big-endian
     AV_WB32(ed + 0, extradata_size);                 // atom size
@@ -47,15 +48,25 @@ static bool FillAlacExtradataForAirPlay(AVCodecContext* ctx)
     AV_WB32(ed + 24, max_frame_bytes);               // max coded frame size
     AV_WB32(ed + 28, avg_bitrate);                   // average bitrate
     AV_WB32(ed + 32, sample_rate);                   // samplerate
+}
+
+static bool FillAlacExtradataForAirPlay(AVCodecContext* ctx)
+{
+    ctx->extradata = (uint8_t*)av_mallocz(kAirPlayAlacConfigSize + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!ctx->extradata)
+        return false;
+
+    ctx->extradata_size = kAirPlayAlacConfigSize;
+    WriteAlacConfigForAirPlay(ctx->extradata);
 
     // 可选：顺便把 ctx 的基础参数也填一下
-    ctx->sample_rate = sample_rate;
-    ctx->bits_per_coded_sample = sample_size;
+    ctx->sample_rate = kAirPlaySampleRate;
+    ctx->bits_per_coded_sample = 16;
 #if LIBAVUTIL_VERSION_MAJOR >= 57
     av_channel_layout_uninit(&ctx->ch_layout);
-    av_channel_layout_default(&ctx->ch_layout, channels);
+    av_channel_layout_default(&ctx->ch_layout, kAirPlayChannels);
 #else
-    ctx->channels = channels;
+    ctx->channels = kAirPlayChannels;
 #endif
 
     return true;
@@ -75,6 +86,24 @@ std::string AvErrorToString(int error_num) {
 }
 }  // namespace
 
+bool GetAirPlayAudioConfig(const std::string& codec_name,
+                           std::vector<uint8_t>* extradata,
+                           int* sample_rate,
+                           int* channels) {
+  if (codec_name == "alac") {
+    extradata->assign(kAirPlayAlacConfigSize, 0);
+    WriteAlacConfigForAirPlay(extradata->data());
+  } else if (codec_name == "aac-eld") {
+    extradata->assign(kAirPlayEldConfig,
+                      kAirPlayEldConfig + sizeof(kAirPlayEldConfig));
+  } else {
+    return false;
+  }
+  *sample_rate = kAirPlaySampleRate;
+  *channels = kAirPlayChannels;
+  return true;
+}
+
 WDecoder::Client::Client() = default;
 WDecoder::Client::~Client() = default;
 
@@ -121,8 +150,12 @@ void WDecoder::Decode(unsigned char* data, int data_len) {
       packet_->size = data_len;
 
       // Send the packet to the decoder.
-      const int send_packet_result =
-          avcodec_send_packet(context_.get(), packet_.get());
+      int send_packet_result;
+      {
+          WMK_TRACE_SCOPE("avcodec_send_packet");
+          send_packet_result =
+              avcodec_send_packet(context_.get(), packet_.get());
+      }
       if (send_packet_result < 0) {
           // The result should not be EAGAIN because this code always pulls out all
           // the decoded frames after feeding-in each AVPacket.
@@ -132,8 +165,12 @@ void WDecoder::Decode(unsigned char* data, int data_len) {
 
       // Receive zero or more frames from the decoder.
       for (;;) {
-          const int receive_frame_result =
-              avcodec_receive_frame(context_.get(), decoded_frame_.get());
+          int receive_frame_result;
+          {
+              WMK_TRACE_SCOPE("avcodec_receive_frame");
+              receive_frame_result =
+                  avcodec_receive_frame(context_.get(), decoded_frame_.get());
+          }
           if (receive_frame_result == AVERROR(EAGAIN)) {
               break;  // Decoder needs more input to produce another frame.
           }
@@ -142,6 +179,7 @@ void WDecoder::Decode(unsigned char* data, int data_len) {
               OnError("avcodec_receive_frame", receive_frame_result);
               return;
           }
+          UpdateBufferEstimate(*decoded_frame_);
           if (client_) {
               client_->OnFrameDecoded(*decoded_frame_);
           }
@@ -156,16 +194,24 @@ void WDecoder::Decode(unsigned char* data, int data_len) {
       packet_->data = data;
       packet_->size = data_len;
 
-      const int send_packet_result =
-          avcodec_send_packet(context_.get(), packet_.get());
+      int send_packet_result;
+      {
+          WMK_TRACE_SCOPE("avcodec_send_packet");
+          send_packet_result =
+              avcodec_send_packet(context_.get(), packet_.get());
+      }
       if (send_packet_result < 0) {
           OnError("avcodec_send_packet", send_packet_result);
           return;
       }
 
       for (;;) {
-          const int receive_frame_result =
-              avcodec_receive_frame(context_.get(), decoded_frame_.get());
+          int receive_frame_result;
+          {
+              WMK_TRACE_SCOPE("avcodec_receive_frame");
+              receive_frame_result =
+                  avcodec_receive_frame(context_.get(), decoded_frame_.get());
+          }
           if (receive_frame_result == AVERROR(EAGAIN)) {
               break;
           }
@@ -173,6 +219,7 @@ void WDecoder::Decode(unsigned char* data, int data_len) {
               OnError("avcodec_receive_frame", receive_frame_result);
               return;
           }
+          UpdateBufferEstimate(*decoded_frame_);
 
           if (client_) {
               client_->OnFrameDecoded(*decoded_frame_);
@@ -222,15 +269,14 @@ bool WDecoder::Initialize() {
   }
 
   if (codec_name_ == "aac-eld") {
-      uint8_t eld_conf[] = { 0xF8, 0xE8, 0x50, 0x00 };
-      context_->extradata = (uint8_t*)av_malloc(sizeof(eld_conf) + AV_INPUT_BUFFER_PADDING_SIZE);
-      memcpy(context_->extradata, eld_conf, sizeof(eld_conf));
-      memset(context_->extradata + sizeof(eld_conf), 0, AV_INPUT_BUFFER_PADDING_SIZE);
-      context_->extradata_size = sizeof(eld_conf);
+      context_->extradata = (uint8_t*)av_malloc(sizeof(kAirPlayEldConfig) + AV_INPUT_BUFFER_PADDING_SIZE);
+      memcpy(context_->extradata, kAirPlayEldConfig, sizeof(kAirPlayEldConfig));
+      memset(context_->extradata + sizeof(kAirPlayEldConfig), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+      context_->extradata_size = sizeof(kAirPlayEldConfig);
 
       AVChannelLayout ch_layout = AV_CHANNEL_LAYOUT_STEREO;
       av_channel_layout_copy(&context_->ch_layout, &ch_layout);
-      context_->sample_rate = 44100;
+      context_->sample_rate = kAirPlaySampleRate;
   }
 
   // 新增：ALAC 分支
@@ -272,6 +318,21 @@ bool WDecoder::Initialize() {
   return true;
 }
 
+void WDecoder::UpdateBufferEstimate(const AVFrame& frame) {
+  // libavcodec does not expose its internal pools, so approximate them as the
+  // number of frames it may keep alive at once: the output frame, reference
+  // frames, reorder delay and one in flight per extra frame thread.
+  size_t frames = 1;
+  if (frame.width > 0) {
+    frames += std::max(context_->refs, 1) + context_->has_b_frames;
+    if (context_->thread_count > 1) {
+      frames += context_->thread_count - 1;
+    }
+  }
+  buffer_bytes_.store(AVFrameBufferBytes(frame) * frames,
+                      std::memory_order_relaxed);
+}
+
 void WDecoder::HandleInitializationError(const char* what, int av_errnum) {
   // If the codec was found, get FFMPEG's canonical name for it.
   const char* const canonical_name =
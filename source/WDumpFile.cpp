@@ -1,40 +1,349 @@
 ﻿#include "WDumpFile.h"
-#include "WUtils.h"
+#include "WBigEndian.h"
 
-#include <vector>
+extern "C" {
+#include <libavutil/intreadwrite.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using wmediakits::WAudioFileWriter;
+using wmediakits::WDumpWriter;
+using wmediakits::WY4MWriter;
+
+namespace {
+
+constexpr int kMaxDumpChannels = 64;
+constexpr AVRational kDefaultY4MFrameRate = { 30, 1 };
+// 视频 dump 的环至少能放下这么多帧，写盘偶尔慢一点也不会退到阻塞写
+constexpr size_t kDumpFramesInRing = 4;
+
+bool EndsWith(const char* s, const char* suffix) {
+    const size_t n = strlen(s);
+    const size_t m = strlen(suffix);
+    if (n < m)
+        return false;
+    for (size_t i = 0; i < m; ++i) {
+        if (tolower((unsigned char)s[n - m + i]) != suffix[i])
+            return false;
+    }
+    return true;
+}
 
 /*
- *  Video Functions
+ *  Video helpers
  */
-int WWriteVideoFrame(const AVFrame* frame, const char* filename) {
-    FILE* file = fopen(filename, "ab");
-    if (!file) {
-        perror("fopen");
-        return -1;
+
+// 每个平面的有效行宽（字节）与行数；linesize 里的对齐填充不写出
+struct PlaneLayout {
+    int  planes = 0;
+    int  rowBytes[4] = {};
+    int  rows[4] = {};
+    bool bigEndian16 = false; // 16 位容器且为大端
+};
+
+bool GetPlaneLayout(const AVFrame* frame, PlaneLayout* layout) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+        return false;
+
+    // 只接受每个分量独占一个平面的格式（NV12 等半平面/打包格式不在此列）
+    const int planes = av_pix_fmt_count_planes((AVPixelFormat)frame->format);
+    if (planes != desc->nb_components || planes > 4)
+        return false;
+
+    layout->planes = planes;
+    for (int p = 0; p < planes; ++p) {
+        const int step = desc->comp[p].step;
+        if (desc->comp[p].plane != p || step > 2)
+            return false;
+        const bool chroma = (p == 1 || p == 2) && planes >= 3;
+        const int w = chroma ? AV_CEIL_RSHIFT(frame->width, desc->log2_chroma_w) : frame->width;
+        const int h = chroma ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+        layout->rowBytes[p] = w * step;
+        layout->rows[p] = h;
+    }
+    layout->bigEndian16 = (desc->flags & AV_PIX_FMT_FLAG_BE) && desc->comp[0].step == 2;
+    return true;
+}
+
+// 逐字节交换写入：输出第 j 字节 = src[j ^ 1]。环尾可能把一个采样拆成两段。
+void AppendSwapped16(WDumpWriter::ScopedRecord& record, const uint8_t* src, size_t bytes) {
+    size_t i = 0;
+    while (i < bytes) {
+        size_t got = 0;
+        uint8_t* dst = record.AppendSpan(bytes - i, &got);
+        if (!got)
+            return;
+        size_t k = 0;
+        if (i & 1) {
+            dst[k++] = src[i - 1];
+        }
+        const size_t pairs = (got - k) / 2;
+        ByteSwapSamples16(src + i + k, dst + k, pairs);
+        k += pairs * 2;
+        if (k < got) {
+            dst[k] = src[i + k + 1];
+        }
+        i += got;
     }
+}
 
-    int width = frame->width;
-    int height = frame->height;
-    enum AVPixelFormat pix_fmt = (AVPixelFormat)frame->format;
+void AppendPlanes(WDumpWriter::ScopedRecord& record, const AVFrame* frame,
+                  const PlaneLayout& layout, bool toLittleEndian) {
+    const bool swap = toLittleEndian && layout.bigEndian16 != IsBigEndianArchitecture();
+    for (int p = 0; p < layout.planes; ++p) {
+        const uint8_t* row = frame->data[p];
+        for (int y = 0; y < layout.rows[p]; ++y) {
+            if (swap)
+                AppendSwapped16(record, row, layout.rowBytes[p]);
+            else
+                record.Append(row, layout.rowBytes[p]);
+            row += frame->linesize[p];
+        }
+    }
+}
 
-    // TODO: rescale if fmt is not AV_PIX_FMT_YUV420P
+size_t FrameBytes(const PlaneLayout& layout) {
+    size_t bytes = 0;
+    for (int p = 0; p < layout.planes; ++p)
+        bytes += (size_t)layout.rowBytes[p] * layout.rows[p];
+    return bytes;
+}
+
+// Y4M 的色彩空间标记，与 FFmpeg yuv4mpegenc 的命名一致
+bool GetY4MColorspace(AVPixelFormat format, std::string* out) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_RGB))
+        return false;
+
+    const int depth = desc->comp[0].depth;
+    if (desc->nb_components == 1) {
+        *out = depth == 8 ? "mono" : "mono" + std::to_string(depth);
+        return true;
+    }
+
+    std::string sub;
+    if (desc->log2_chroma_w == 1 && desc->log2_chroma_h == 1)
+        sub = "420";
+    else if (desc->log2_chroma_w == 1 && desc->log2_chroma_h == 0)
+        sub = "422";
+    else if (desc->log2_chroma_w == 0 && desc->log2_chroma_h == 0)
+        sub = "444";
+    else if (desc->log2_chroma_w == 2 && desc->log2_chroma_h == 0)
+        sub = "411";
+    else
+        return false;
+
+    if (desc->nb_components == 4) {
+        if (sub != "444" || depth != 8)
+            return false;
+        *out = "444alpha";
+        return true;
+    }
+    if (depth == 8) {
+        *out = sub == "420" ? "420jpeg" : sub;
+        return true;
+    }
+    if (sub == "411")
+        return false;
+    *out = sub + "p" + std::to_string(depth);
+    return true;
+}
+
+/*
+ *  Audio helpers
+ */
 
-    // assume AV_PIX_FMT_YUV420P
-    if (pix_fmt != AV_PIX_FMT_YUV420P) {
-        fprintf(stderr, "This function currently only supports YUV420p format.\n");
-        fclose(file);
+// 从 planar 帧取交错后第 j 个字节
+inline uint8_t InterleavedByteAt(const AVFrame* frame, int channels, int bps, size_t j) {
+    const size_t frameBytes = (size_t)channels * bps;
+    const size_t sample = j / frameBytes;
+    const size_t within = j % frameBytes;
+    return frame->extended_data[within / bps][sample * bps + within % bps];
+}
+
+// 与 WUtils.h 的 InterleaveAudioSamples 相同，但目标地址可以不对齐（环内任意位置）
+template <size_t kBytes>
+void InterleaveUnaligned(const uint8_t* const planes[], int channels, size_t samples, uint8_t* dst) {
+    for (size_t i = 0; i < samples; ++i) {
+        for (int ch = 0; ch < channels; ++ch) {
+            memcpy(dst, planes[ch] + i * kBytes, kBytes);
+            dst += kBytes;
+        }
+    }
+}
+
+// 把 planar 采样直接交错进环形缓冲，不经过中间缓冲
+void AppendInterleaved(WDumpWriter::ScopedRecord& record, const AVFrame* frame,
+                       int channels, int bps, size_t total) {
+    const size_t frameBytes = (size_t)channels * bps;
+    const uint8_t* planes[kMaxDumpChannels];
+
+    size_t done = 0;
+    while (done < total) {
+        size_t got = 0;
+        uint8_t* dst = record.AppendSpan(total - done, &got);
+        if (!got)
+            return;
+
+        size_t k = 0;
+        // 上一段在环尾截断了一个采样帧：逐字节补齐
+        while (k < got && (done + k) % frameBytes != 0) {
+            dst[k] = InterleavedByteAt(frame, channels, bps, done + k);
+            ++k;
+        }
+
+        const size_t whole = (got - k) / frameBytes;
+        if (whole > 0) {
+            const size_t first = (done + k) / frameBytes;
+            for (int ch = 0; ch < channels; ++ch)
+                planes[ch] = frame->extended_data[ch] + first * bps;
+            switch (bps) {
+            case 1: InterleaveUnaligned<1>(planes, channels, whole, dst + k); break;
+            case 2: InterleaveUnaligned<2>(planes, channels, whole, dst + k); break;
+            case 4: InterleaveUnaligned<4>(planes, channels, whole, dst + k); break;
+            case 8: InterleaveUnaligned<8>(planes, channels, whole, dst + k); break;
+            default: break;
+            }
+            k += whole * frameBytes;
+        }
+
+        while (k < got) {
+            dst[k] = InterleavedByteAt(frame, channels, bps, done + k);
+            ++k;
+        }
+        done += got;
+    }
+}
+
+// 写一帧音频（planar 就地交错），返回写入的字节数，0 表示丢弃
+size_t AppendAudioFrame(WDumpWriter& writer, const AVFrame* frame) {
+    const int channels = frame->ch_layout.nb_channels;
+    const int bps = av_get_bytes_per_sample((AVSampleFormat)frame->format);
+    if (channels <= 0 || channels > kMaxDumpChannels || bps <= 0)
+        return 0;
+
+    const size_t total = (size_t)frame->nb_samples * channels * bps;
+    WDumpWriter::ScopedRecord record(writer, total);
+    if (!record)
+        return 0;
+
+    if (av_sample_fmt_is_planar((AVSampleFormat)frame->format))
+        AppendInterleaved(record, frame, channels, bps, total);
+    else
+        record.Append(frame->data[0], total);
+    return total;
+}
+
+/*
+ *  每个文件名对应一个常驻的写入器，首次写入时打开，之后每帧只做内存拷贝。
+ *  裸数据文件以追加模式打开，与原先 fopen("ab") 的语义一致。
+ */
+std::mutex s_dumpMutex;
+// 取出的写入器在锁外使用：用 shared_ptr，WCloseDumpFiles() 并发执行时由最后一个使用者关闭
+std::map<std::string, std::shared_ptr<WDumpWriter>> s_rawWriters;
+std::map<std::string, std::shared_ptr<WY4MWriter>> s_y4mWriters;
+std::map<std::string, std::shared_ptr<WAudioFileWriter>> s_audioWriters;
+
+// 按首条记录的大小定环的大小：大帧也走非阻塞路径
+WDumpWriter::Options DumpOptionsFor(size_t recordBytes) {
+    WDumpWriter::Options opts;
+    opts.ringBytes = std::max(opts.ringBytes, recordBytes * kDumpFramesInRing);
+    return opts;
+}
+
+std::shared_ptr<WDumpWriter> GetRawWriter(const char* filename, size_t recordBytes) {
+    std::lock_guard<std::mutex> lock(s_dumpMutex);
+    std::shared_ptr<WDumpWriter>& writer = s_rawWriters[filename];
+    if (!writer) {
+        writer.reset(new WDumpWriter());
+        WDumpWriter::Options opts = DumpOptionsFor(recordBytes);
+        opts.truncate = false;
+        if (!writer->Open(filename, opts)) {
+            perror("fopen");
+        }
+    }
+    return writer->IsOpen() ? writer : nullptr;
+}
+
+std::shared_ptr<WY4MWriter> GetY4MWriter(const char* filename, AVRational frameRate, size_t frameBytes) {
+    std::lock_guard<std::mutex> lock(s_dumpMutex);
+    std::shared_ptr<WY4MWriter>& writer = s_y4mWriters[filename];
+    if (!writer) {
+        writer.reset(new WY4MWriter());
+        writer->Open(filename, frameRate, DumpOptionsFor(frameBytes));
+    }
+    return writer->IsOpen() ? writer : nullptr;
+}
+
+std::shared_ptr<WAudioFileWriter> GetAudioWriter(const char* filename, WAudioFileWriter::Container container) {
+    std::lock_guard<std::mutex> lock(s_dumpMutex);
+    std::shared_ptr<WAudioFileWriter>& writer = s_audioWriters[filename];
+    if (!writer) {
+        writer.reset(new WAudioFileWriter());
+        writer->Open(filename, container);
+    }
+    return writer->IsOpen() ? writer : nullptr;
+}
+
+}  // namespace
+
+void WCloseDumpFiles() {
+    std::map<std::string, std::shared_ptr<WDumpWriter>> raw;
+    std::map<std::string, std::shared_ptr<WY4MWriter>> y4m;
+    std::map<std::string, std::shared_ptr<WAudioFileWriter>> audio;
+    {
+        std::lock_guard<std::mutex> lock(s_dumpMutex);
+        raw.swap(s_rawWriters);
+        y4m.swap(s_y4mWriters);
+        audio.swap(s_audioWriters);
+    }
+    // 析构时刷盘、回填头部并关闭
+}
+
+/*
+ *  Video Functions
+ */
+int WWriteVideoFrame(const AVFrame* frame, const char* filename) {
+    return WWriteVideoFrame(frame, filename, kDefaultY4MFrameRate);
+}
+
+int WWriteVideoFrame(const AVFrame* frame, const char* filename, AVRational frameRate) {
+    PlaneLayout layout;
+    const bool known = GetPlaneLayout(frame, &layout);
+    if (EndsWith(filename, ".y4m")) {
+        std::shared_ptr<WY4MWriter> writer = GetY4MWriter(filename,
+            frameRate.num > 0 && frameRate.den > 0 ? frameRate : kDefaultY4MFrameRate,
+            known ? FrameBytes(layout) : 0);
+        return writer ? writer->WriteFrame(frame) : -1;
+    }
+
+    if (!known) {
+        fprintf(stderr, "WWriteVideoFrame: unsupported pixel format %s.\n",
+                av_get_pix_fmt_name((AVPixelFormat)frame->format));
         return -1;
     }
 
-    // 写入 YUV 数据
-    // Y plane
-    fwrite(frame->data[0], 1, width * height, file);
-    // U plane
-    fwrite(frame->data[1], 1, width * height / 4, file);
-    // V plane
-    fwrite(frame->data[2], 1, width * height / 4, file);
+    std::shared_ptr<WDumpWriter> writer = GetRawWriter(filename, FrameBytes(layout));
+    if (!writer) {
+        return -1;
+    }
 
-    fclose(file);
+    // 所有平面作为一条记录整体提交，按 linesize 逐行拷贝
+    WDumpWriter::ScopedRecord record(*writer, FrameBytes(layout));
+    if (!record) {
+        return -1;
+    }
+    AppendPlanes(record, frame, layout, false);
     return 0;
 }
 
@@ -42,27 +351,246 @@ int WWriteVideoFrame(const AVFrame* frame, const char* filename) {
  *  Audio Functions
  */
 int WWriteAudioFrame(const AVFrame* frame, const char* filename) {
-    // 打开文件用于写入
-    FILE* file = fopen(filename, "ab");
-    if (!file) {
-        perror("fopen");
+    if (EndsWith(filename, ".wav") || EndsWith(filename, ".caf")) {
+        std::shared_ptr<WAudioFileWriter> writer = GetAudioWriter(filename,
+            EndsWith(filename, ".wav") ? WAudioFileWriter::Container::Wav : WAudioFileWriter::Container::Caf);
+        return writer ? writer->WriteFrame(frame) : -1;
+    }
+
+    std::shared_ptr<WDumpWriter> writer = GetRawWriter(filename, 0);
+    if (!writer) {
+        return -1;
+    }
+    return AppendAudioFrame(*writer, frame) > 0 ? 0 : -1;
+}
+
+namespace wmediakits {
+
+/*
+ *  WY4MWriter
+ */
+WY4MWriter::WY4MWriter()
+{
+}
+
+WY4MWriter::~WY4MWriter()
+{
+    Close();
+}
+
+bool WY4MWriter::Open(const std::string& path, AVRational frameRate)
+{
+    return Open(path, frameRate, WDumpWriter::Options());
+}
+
+bool WY4MWriter::Open(const std::string& path, AVRational frameRate, const WDumpWriter::Options& opts)
+{
+    m_frameRate = frameRate;
+    m_headerWritten = false;
+    return m_writer.Open(path, opts);
+}
+
+void WY4MWriter::Close()
+{
+    m_writer.Close();
+}
+
+bool WY4MWriter::writeHeader(const AVFrame* frame)
+{
+    std::string colorspace;
+    if (!GetY4MColorspace((AVPixelFormat)frame->format, &colorspace)) {
+        fprintf(stderr, "WY4MWriter: %s cannot be stored in Y4M.\n",
+                av_get_pix_fmt_name((AVPixelFormat)frame->format));
+        return false;
+    }
+
+    const AVRational sar = frame->sample_aspect_ratio;
+    char header[256];
+    const int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d Ip A%d:%d C%s%s\n",
+                             frame->width, frame->height, m_frameRate.num, m_frameRate.den,
+                             sar.num, sar.den, colorspace.c_str(),
+                             frame->color_range == AVCOL_RANGE_JPEG ? " XCOLORRANGE=FULL" : "");
+    if (len <= 0 || !m_writer.Write(header, len))
+        return false;
+
+    m_width = frame->width;
+    m_height = frame->height;
+    m_format = frame->format;
+    m_headerWritten = true;
+    return true;
+}
+
+int WY4MWriter::WriteFrame(const AVFrame* frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_headerMx);
+        if (!m_headerWritten && !writeHeader(frame))
+            return -1;
+
+        // Y4M 流内不能改变尺寸/格式
+        if (frame->width != m_width || frame->height != m_height || frame->format != m_format)
+            return -1;
+    }
+
+    PlaneLayout layout;
+    if (!GetPlaneLayout(frame, &layout))
+        return -1;
+
+    static const char kFrameTag[] = "FRAME\n";
+    WDumpWriter::ScopedRecord record(m_writer, sizeof(kFrameTag) - 1 + FrameBytes(layout));
+    if (!record)
         return -1;
+    record.Append(kFrameTag, sizeof(kFrameTag) - 1);
+    AppendPlanes(record, frame, layout, true);
+    return 0;
+}
+
+/*
+ *  WAudioFileWriter
+ */
+WAudioFileWriter::WAudioFileWriter()
+{
+}
+
+WAudioFileWriter::~WAudioFileWriter()
+{
+    Close();
+}
+
+bool WAudioFileWriter::Open(const std::string& path, Container container)
+{
+    m_container = container;
+    m_headerWritten = false;
+    m_dataBytes = 0;
+    return m_writer.Open(path);
+}
+
+void WAudioFileWriter::Close()
+{
+    if (!m_writer.IsOpen())
+        return;
+
+    std::lock_guard<std::mutex> lock(m_headerMx);
+    if (m_headerWritten) {
+        if (m_container == Container::Wav) {
+            // RIFF 长度字段只有 32 位，超过 4GB 时封顶
+            const uint64_t riff = m_headerBytes - 8 + m_dataBytes;
+            uint8_t size[4];
+            AV_WL32(size, (uint32_t)(riff > 0xFFFFFFFFu ? 0xFFFFFFFFu : riff));
+            m_writer.PatchOnClose(4, size, 4);
+            AV_WL32(size, (uint32_t)(m_dataBytes > 0xFFFFFFFFu ? 0xFFFFFFFFu : m_dataBytes));
+            m_writer.PatchOnClose(m_headerBytes - 4, size, 4);
+        }
+        else {
+            // CAF 的 data 块长度写成 -1 也合法（崩溃后仍可读），这里补上真实值（含 edit count）
+            uint8_t size[8];
+            WriteBigEndian64(size, m_dataBytes + 4);
+            m_writer.PatchOnClose(m_headerBytes - 12, size, 8);
+        }
     }
+    m_writer.Close();
+}
 
-    // 获取音频的帧大小、声道数、采样格式
-    int channels = frame->ch_layout.nb_channels;
-    int sample_size = av_get_bytes_per_sample((AVSampleFormat)frame->format);  // 每个样本的字节数
-    int frame_size = frame->nb_samples;
+bool WAudioFileWriter::writeHeader(const AVFrame* frame)
+{
+    const AVSampleFormat packed = av_get_packed_sample_fmt((AVSampleFormat)frame->format);
+    const int bps = av_get_bytes_per_sample(packed);
+    const int channels = frame->ch_layout.nb_channels;
+    const bool isFloat = packed == AV_SAMPLE_FMT_FLT || packed == AV_SAMPLE_FMT_DBL;
+    if (bps <= 0 || channels <= 0 || channels > kMaxDumpChannels || packed == AV_SAMPLE_FMT_S64) {
+        fprintf(stderr, "WAudioFileWriter: unsupported sample format.\n");
+        return false;
+    }
 
-    if (av_sample_fmt_is_planar((AVSampleFormat)frame->format)) {
-        std::vector<uint8_t> interleaved_audio_buffer;
-        InterleaveAudioSamples(frame, interleaved_audio_buffer);
-        fwrite(interleaved_audio_buffer.data(), sample_size, frame_size * channels, file);
+    uint8_t h[80];
+    size_t n = 0;
+    if (m_container == Container::Wav) {
+        const bool extensible = channels > 2;
+        const uint16_t tag = isFloat ? 3 : 1;
+        memcpy(h + n, "RIFF", 4); n += 4;
+        AV_WL32(h + n, 0); n += 4;                     // 关闭时回填
+        memcpy(h + n, "WAVEfmt ", 8); n += 8;
+        AV_WL32(h + n, extensible ? 40 : 16); n += 4;
+        AV_WL16(h + n, extensible ? 0xFFFE : tag); n += 2;
+        AV_WL16(h + n, channels); n += 2;
+        AV_WL32(h + n, frame->sample_rate); n += 4;
+        AV_WL32(h + n, frame->sample_rate * channels * bps); n += 4;
+        AV_WL16(h + n, channels * bps); n += 2;
+        AV_WL16(h + n, bps * 8); n += 2;
+        if (extensible) {
+            static const uint8_t kSubFormatTail[14] = {
+                0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+            const uint32_t mask = frame->ch_layout.order == AV_CHANNEL_ORDER_NATIVE
+                ? (uint32_t)frame->ch_layout.u.mask : 0;
+            AV_WL16(h + n, 22); n += 2;
+            AV_WL16(h + n, bps * 8); n += 2;
+            AV_WL32(h + n, mask); n += 4;
+            AV_WL16(h + n, tag); n += 2;
+            memcpy(h + n, kSubFormatTail, sizeof(kSubFormatTail)); n += sizeof(kSubFormatTail);
+        }
+        memcpy(h + n, "data", 4); n += 4;
+        AV_WL32(h + n, 0); n += 4;                     // 关闭时回填
     }
     else {
-        fwrite(frame->data[0], sample_size, frame_size * channels, file);
+        // CAF 的 lpcm 不支持无符号 8 位
+        if (packed == AV_SAMPLE_FMT_U8) {
+            fprintf(stderr, "WAudioFileWriter: CAF cannot store unsigned 8-bit PCM.\n");
+            return false;
+        }
+        uint32_t flags = isFloat ? 1 : 0;              // kCAFLinearPCMFormatFlagIsFloat
+        if (!IsBigEndianArchitecture())
+            flags |= 2;                                // kCAFLinearPCMFormatFlagIsLittleEndian
+        const double rate = frame->sample_rate;
+        uint64_t rateBits;
+        memcpy(&rateBits, &rate, sizeof(rateBits));
+
+        memcpy(h + n, "caff", 4); n += 4;
+        WriteBigEndian16(h + n, 1); n += 2;            // version
+        WriteBigEndian16(h + n, 0); n += 2;            // flags
+        memcpy(h + n, "desc", 4); n += 4;
+        WriteBigEndian64(h + n, 32); n += 8;
+        WriteBigEndian64(h + n, rateBits); n += 8;
+        memcpy(h + n, "lpcm", 4); n += 4;
+        WriteBigEndian32(h + n, flags); n += 4;
+        WriteBigEndian32(h + n, channels * bps); n += 4; // bytes per packet
+        WriteBigEndian32(h + n, 1); n += 4;            // frames per packet
+        WriteBigEndian32(h + n, channels); n += 4;
+        WriteBigEndian32(h + n, bps * 8); n += 4;
+        memcpy(h + n, "data", 4); n += 4;
+        WriteBigEndian64(h + n, UINT64_MAX); n += 8;   // 未知长度，关闭时回填
+        WriteBigEndian32(h + n, 0); n += 4;            // edit count
+    }
+
+    if (!m_writer.Write(h, n))
+        return false;
+
+    m_headerBytes = n;
+    m_format = packed;
+    m_channels = channels;
+    m_sampleRate = frame->sample_rate;
+    m_headerWritten = true;
+    return true;
+}
+
+int WAudioFileWriter::WriteFrame(const AVFrame* frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_headerMx);
+        if (!m_headerWritten && !writeHeader(frame))
+            return -1;
+
+        // 格式中途变化无法写进同一个文件
+        if (av_get_packed_sample_fmt((AVSampleFormat)frame->format) != m_format ||
+            frame->ch_layout.nb_channels != m_channels || frame->sample_rate != m_sampleRate)
+            return -1;
     }
 
-    fclose(file);
+    const size_t bytes = AppendAudioFrame(m_writer, frame);
+    if (bytes == 0)
+        return -1;
+    std::lock_guard<std::mutex> lock(m_headerMx);
+    m_dataBytes += bytes;
     return 0;
-}
\ No newline at end of file
+}
+
+}  // namespace wmediakits
@@ -0,0 +1,503 @@
+﻿#include "WDumpWriter.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace wmediakits {
+
+namespace {
+
+// 覆盖常见的扇区/页大小，满足 O_DIRECT 与 FILE_FLAG_NO_BUFFERING 的对齐要求
+constexpr size_t kIoAlignment = 4096;
+constexpr intptr_t kInvalidFile = -1;
+
+size_t AlignUp(size_t v, size_t a) {
+    return (v + a - 1) / a * a;
+}
+
+uint8_t* AllocAligned(size_t size) {
+#ifdef _WIN32
+    return static_cast<uint8_t*>(_aligned_malloc(size, kIoAlignment));
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, kIoAlignment, size) == 0 ? static_cast<uint8_t*>(p) : nullptr;
+#endif
+}
+
+void FreeAligned(uint8_t* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+#ifdef _WIN32
+
+intptr_t OpenFileRaw(const std::string& path, bool truncate, bool direct) {
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+    if (direct)
+        flags |= FILE_FLAG_NO_BUFFERING;
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                           truncate ? CREATE_ALWAYS : OPEN_ALWAYS, flags, nullptr);
+    return h == INVALID_HANDLE_VALUE ? kInvalidFile : reinterpret_cast<intptr_t>(h);
+}
+
+uint64_t FileSizeRaw(intptr_t file) {
+    LARGE_INTEGER size{};
+    GetFileSizeEx(reinterpret_cast<HANDLE>(file), &size);
+    return static_cast<uint64_t>(size.QuadPart);
+}
+
+bool WriteAtRaw(intptr_t file, const uint8_t* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        const DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(reinterpret_cast<HANDLE>(file), data, chunk, &written, &ov) || written == 0)
+            return false;
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+void TruncateRaw(intptr_t file, uint64_t size) {
+    // 对 NO_BUFFERING 句柄也允许设置非对齐的文件尾
+    FILE_END_OF_FILE_INFO eof{};
+    eof.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+    SetFileInformationByHandle(reinterpret_cast<HANDLE>(file), FileEndOfFileInfo, &eof, sizeof(eof));
+}
+
+void CloseRaw(intptr_t file) {
+    CloseHandle(reinterpret_cast<HANDLE>(file));
+}
+
+#else
+
+intptr_t OpenFileRaw(const std::string& path, bool truncate, bool direct) {
+    int flags = O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0);
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+#ifdef O_DIRECT
+    if (direct)
+        flags |= O_DIRECT;
+#endif
+    const int fd = open(path.c_str(), flags, 0644);
+    if (fd < 0)
+        return kInvalidFile;
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if (direct)
+        fcntl(fd, F_NOCACHE, 1);
+#endif
+    return fd;
+}
+
+uint64_t FileSizeRaw(intptr_t file) {
+    struct stat st {};
+    if (fstat(static_cast<int>(file), &st) != 0)
+        return 0;
+    return static_cast<uint64_t>(st.st_size);
+}
+
+bool WriteAtRaw(intptr_t file, const uint8_t* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        const ssize_t n = pwrite(static_cast<int>(file), data, size, static_cast<off_t>(offset));
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+void TruncateRaw(intptr_t file, uint64_t size) {
+    if (ftruncate(static_cast<int>(file), static_cast<off_t>(size)) != 0)
+        perror("ftruncate");
+}
+
+void CloseRaw(intptr_t file) {
+    close(static_cast<int>(file));
+}
+
+#endif  // _WIN32
+
+}  // namespace
+
+WDumpWriter::ScopedRecord::ScopedRecord(WDumpWriter& writer, size_t size)
+    : m_writer(writer), m_lock(writer.m_mx)
+{
+    if (m_writer.m_ring && size > m_writer.m_ringBytes)
+        m_ok = m_large = m_writer.beginLargeLocked();
+    else
+        m_ok = m_writer.reserveLocked(size);
+}
+
+WDumpWriter::ScopedRecord::~ScopedRecord()
+{
+    if (!m_ok)
+        return;
+    m_writer.commitLocked();
+    if (m_large)
+        m_writer.m_largeActive = false;
+}
+
+void WDumpWriter::ScopedRecord::Append(const void* data, size_t size)
+{
+    if (!m_ok)
+        return;
+    if (m_large)
+        m_writer.appendBlockingLocked(m_lock, static_cast<const uint8_t*>(data), size);
+    else
+        m_writer.appendLocked(data, size);
+}
+
+uint8_t* WDumpWriter::ScopedRecord::AppendSpan(size_t size, size_t* got)
+{
+    if (!m_ok) {
+        *got = 0;
+        return nullptr;
+    }
+    if (m_large)
+        return m_writer.appendSpanBlockingLocked(m_lock, size, got);
+    return m_writer.appendSpanLocked(size, got);
+}
+
+WDumpWriter::WDumpWriter()
+{
+}
+
+WDumpWriter::~WDumpWriter()
+{
+    Close();
+}
+
+bool WDumpWriter::Open(const std::string& path)
+{
+    return Open(path, Options());
+}
+
+bool WDumpWriter::Open(const std::string& path, const Options& opts)
+{
+    Close();
+
+    m_blockBytes = AlignUp(std::max<size_t>(opts.blockBytes, kIoAlignment), kIoAlignment);
+    m_ringBytes = AlignUp(std::max(opts.ringBytes, m_blockBytes * 2), m_blockBytes);
+
+    // 直写要求文件偏移也对齐：追加到非对齐长度的已有文件时退回普通写
+    m_direct = opts.directIO;
+    m_file = OpenFileRaw(path, opts.truncate, m_direct);
+    if (m_file != kInvalidFile && m_direct && !opts.truncate && FileSizeRaw(m_file) % kIoAlignment != 0) {
+        CloseRaw(m_file);
+        m_direct = false;
+        m_file = OpenFileRaw(path, false, false);
+    }
+    if (m_file == kInvalidFile && m_direct) {
+        // tmpfs 等文件系统不支持 O_DIRECT
+        m_direct = false;
+        m_file = OpenFileRaw(path, opts.truncate, false);
+    }
+    if (m_file == kInvalidFile) {
+        fprintf(stderr, "WDumpWriter: failed to open %s\n", path.c_str());
+        return false;
+    }
+    m_path = path;
+    m_startOffset = opts.truncate ? 0 : FileSizeRaw(m_file);
+    m_fileOffset = m_startOffset;
+    m_patches.clear();
+
+    uint8_t* ring = AllocAligned(m_ringBytes);
+    if (!ring) {
+        CloseRaw(m_file);
+        m_file = kInvalidFile;
+        return false;
+    }
+
+    {
+        // 其它线程可能正在对已关闭的写入器调用 Write()，发布状态要持锁
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_ring = ring;
+        m_reserved = 0;
+        m_cursor = 0;
+        m_head.store(0);
+        m_tail.store(0);
+        m_closing = false;
+    }
+    m_diskBytes.store(0);
+    m_droppedBytes.store(0);
+    m_droppedRecords.store(0);
+
+    m_open.store(true, std::memory_order_release);
+    m_thread = std::thread(&WDumpWriter::threadFunc, this);
+    return true;
+}
+
+void WDumpWriter::Close()
+{
+    if (!m_open.exchange(false))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_closing = true;
+    }
+    m_cv.notify_one();
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    uint8_t* ring = nullptr;
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        std::swap(ring, m_ring);
+    }
+    FreeAligned(ring);
+}
+
+bool WDumpWriter::Write(const void* data, size_t size)
+{
+    std::unique_lock<std::mutex> lk(m_mx);
+    if (m_ring && size > m_ringBytes) {
+        if (!beginLargeLocked())
+            return false;
+        const bool ok = appendBlockingLocked(lk, static_cast<const uint8_t*>(data), size);
+        m_largeActive = false;
+        return ok;
+    }
+    if (!reserveLocked(size))
+        return false;
+    appendLocked(data, size);
+    commitLocked();
+    return true;
+}
+
+bool WDumpWriter::WriteBlocking(const void* data, size_t size)
+{
+    std::unique_lock<std::mutex> lk(m_mx);
+    if (!beginLargeLocked())
+        return false;
+    const bool ok = appendBlockingLocked(lk, static_cast<const uint8_t*>(data), size);
+    m_largeActive = false;
+    return ok;
+}
+
+void WDumpWriter::PatchOnClose(uint64_t offset, const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    std::lock_guard<std::mutex> lk(m_mx);
+    m_patches.push_back(Patch{ m_startOffset + offset, std::vector<uint8_t>(p, p + size) });
+}
+
+bool WDumpWriter::reserveLocked(size_t size)
+{
+    if (!m_ring || m_closing)
+        return false;
+
+    const uint64_t used = m_reserved - m_tail.load(std::memory_order_acquire);
+    if (m_largeActive || size > m_ringBytes - used) {
+        m_droppedBytes.fetch_add(size, std::memory_order_relaxed);
+        m_droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_reserved += size;
+    return true;
+}
+
+bool WDumpWriter::beginLargeLocked()
+{
+    if (!m_ring || m_closing || m_largeActive) {
+        m_droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_largeActive = true;
+    return true;
+}
+
+bool WDumpWriter::waitRoomLocked(std::unique_lock<std::mutex>& lk, size_t* room)
+{
+    // 先把已追加的部分发布出去，后台线程才能写盘腾空间
+    commitLocked();
+    for (;;) {
+        if (!m_ring || m_closing)
+            return false;
+        const uint64_t used = m_reserved - m_tail.load(std::memory_order_acquire);
+        *room = static_cast<size_t>(m_ringBytes - used);
+        if (*room > 0)
+            return true;
+        // 缓冲满说明至少有整块待写，后台线程已被唤醒；超时兜底漏掉的通知
+        m_spaceCV.wait_for(lk, std::chrono::milliseconds(5));
+    }
+}
+
+bool WDumpWriter::appendBlockingLocked(std::unique_lock<std::mutex>& lk, const uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        size_t room = 0;
+        if (!waitRoomLocked(lk, &room))
+            return false;
+        const size_t n = std::min(size, room);
+        m_reserved += n;
+        appendLocked(data, n);
+        data += n;
+        size -= n;
+    }
+    commitLocked();
+    return true;
+}
+
+uint8_t* WDumpWriter::appendSpanBlockingLocked(std::unique_lock<std::mutex>& lk, size_t size, size_t* got)
+{
+    size_t room = 0;
+    if (size == 0 || !waitRoomLocked(lk, &room)) {
+        *got = 0;
+        return nullptr;
+    }
+    m_reserved += std::min(size, room);
+    return appendSpanLocked(size, got);
+}
+
+void WDumpWriter::appendLocked(const void* data, size_t size)
+{
+    size = static_cast<size_t>(std::min<uint64_t>(size, m_reserved - m_cursor));
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        const size_t pos = static_cast<size_t>(m_cursor % m_ringBytes);
+        const size_t n = std::min(size, m_ringBytes - pos);
+        memcpy(m_ring + pos, src, n);
+        src += n;
+        size -= n;
+        m_cursor += n;
+    }
+}
+
+uint8_t* WDumpWriter::appendSpanLocked(size_t size, size_t* got)
+{
+    const size_t pos = static_cast<size_t>(m_cursor % m_ringBytes);
+    size = static_cast<size_t>(std::min<uint64_t>(size, m_reserved - m_cursor));
+    *got = std::min(size, m_ringBytes - pos);
+    m_cursor += *got;
+    return m_ring + pos;
+}
+
+void WDumpWriter::commitLocked()
+{
+    const uint64_t oldHead = m_head.load(std::memory_order_relaxed);
+    m_reserved = m_cursor;
+    m_head.store(m_cursor, std::memory_order_release);
+
+    // 只有凑满新的一整块时才唤醒后台线程
+    if (oldHead / m_blockBytes != m_cursor / m_blockBytes)
+        m_cv.notify_one();
+}
+
+void WDumpWriter::threadFunc()
+{
+    uint64_t tail = 0;
+    for (;;) {
+        uint64_t head = 0;
+        bool closing = false;
+        {
+            std::unique_lock<std::mutex> lk(m_mx);
+            m_cv.wait(lk, [this, tail] {
+                return m_closing || m_head.load(std::memory_order_relaxed) - tail >= m_blockBytes;
+            });
+            head = m_head.load(std::memory_order_acquire);
+            closing = m_closing;
+        }
+
+        // m_ringBytes 是 m_blockBytes 的整数倍，整块在环里一定连续且对齐
+        while (head - tail >= m_blockBytes) {
+            writeBlock(m_ring + tail % m_ringBytes, m_blockBytes);
+            tail += m_blockBytes;
+            m_tail.store(tail, std::memory_order_release);
+            m_spaceCV.notify_all();
+        }
+
+        if (closing) {
+            // 生产者已全部停止，写出不足一块的尾部
+            const size_t rest = static_cast<size_t>(head - tail);
+            const uint64_t logicalSize = m_fileOffset + rest;
+            if (rest > 0) {
+                uint8_t* p = m_ring + tail % m_ringBytes;
+                size_t len = rest;
+                if (m_direct) {
+                    len = AlignUp(rest, kIoAlignment);
+                    memset(p + rest, 0, len - rest);
+                }
+                if (writeBlock(p, len))
+                    m_diskBytes.fetch_sub(len - rest, std::memory_order_relaxed);
+                m_tail.store(head, std::memory_order_release);
+            }
+            finishFile(logicalSize);
+            return;
+        }
+    }
+}
+
+bool WDumpWriter::writeBlock(const uint8_t* data, size_t size)
+{
+    if (m_file == kInvalidFile)
+        return false;
+
+    if (!WriteAtRaw(m_file, data, size, m_fileOffset)) {
+        fprintf(stderr, "WDumpWriter: write failed, dropping the rest of the dump\n");
+        CloseRaw(m_file);
+        m_file = kInvalidFile;
+        return false;
+    }
+    m_fileOffset += size;
+    m_diskBytes.fetch_add(size, std::memory_order_relaxed);
+    return true;
+}
+
+void WDumpWriter::finishFile(uint64_t logicalSize)
+{
+    if (m_file == kInvalidFile)
+        return;
+
+    // 直写时尾块补了零，截回真实长度
+    if (m_direct && logicalSize != m_fileOffset)
+        TruncateRaw(m_file, logicalSize);
+
+    std::vector<Patch> patches;
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        patches.swap(m_patches);
+    }
+    if (!patches.empty() && m_direct) {
+        // 回填的偏移/长度不满足直写对齐，换成普通句柄
+        CloseRaw(m_file);
+        m_file = OpenFileRaw(m_path, false, false);
+    }
+    if (m_file == kInvalidFile)
+        return;
+    for (const Patch& patch : patches) {
+        WriteAtRaw(m_file, patch.data.data(), patch.data.size(), patch.offset);
+    }
+
+    CloseRaw(m_file);
+    m_file = kInvalidFile;
+}
+
+}  // namespace wmediakits
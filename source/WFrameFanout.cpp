@@ -0,0 +1,264 @@
+﻿#include "WFrameFanout.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace wmediakits {
+
+struct WFrameFanout::Sink {
+    int         id = 0;
+    FrameSink   fn;
+    SinkOptions opt;
+
+    std::mutex              mx;
+    std::condition_variable cv;
+    std::deque<AVFramePool::UniquePtr> queue;
+    size_t queuedBytes = 0;
+    bool stop = false;
+    std::atomic<size_t>* totalBytes = nullptr;  // 所属 WFrameFanout 的 m_queuedBytes
+
+    // 持 mx：出队一帧时扣掉它的字节数
+    AVFramePool::UniquePtr popLocked(bool front)
+    {
+        AVFramePool::UniquePtr frame;
+        if (front) {
+            frame = std::move(queue.front());
+            queue.pop_front();
+        } else {
+            frame = std::move(queue.back());
+            queue.pop_back();
+        }
+        const size_t bytes = AVFrameBufferBytes(*frame);
+        queuedBytes -= bytes;
+        *totalBytes -= bytes;
+        return frame;
+    }
+
+    std::atomic<uint64_t> delivered{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+    std::thread thread;
+};
+
+WFrameFanout::WFrameFanout()
+    : m_framePool(64)
+    , m_sinks(std::make_shared<SinkList>())
+{
+}
+
+WFrameFanout::~WFrameFanout()
+{
+    std::shared_ptr<const SinkList> sinks;
+    std::vector<std::thread> retired;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        sinks = m_sinks;
+        m_sinks = std::make_shared<SinkList>();
+        retired.swap(m_retired);
+    }
+    for (const std::shared_ptr<Sink>& sink : *sinks)
+        stopSink(sink);
+    for (std::thread& t : retired)
+        t.join();
+}
+
+int WFrameFanout::AddSink(FrameSink sink)
+{
+    return AddSink(std::move(sink), SinkOptions());
+}
+
+int WFrameFanout::AddSink(FrameSink sink, const SinkOptions& options)
+{
+    if (!sink)
+        return 0;
+    auto s = std::make_shared<Sink>();
+    s->fn = std::move(sink);
+    s->opt = options;
+    s->opt.capacity = std::max<size_t>(options.capacity, 1);
+    s->totalBytes = &m_queuedBytes;
+    s->thread = std::thread(&WFrameFanout::sinkThreadFunc, s);
+
+    std::lock_guard<std::mutex> lock(m_mx);
+    s->id = m_nextId++;
+    auto list = std::make_shared<SinkList>(*m_sinks);
+    list->push_back(s);
+    m_sinks = list;
+    m_sinkCount.store(static_cast<int>(list->size()), std::memory_order_relaxed);
+    return s->id;
+}
+
+void WFrameFanout::RemoveSink(int id)
+{
+    std::shared_ptr<Sink> removed;
+    std::vector<std::thread> retired;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        auto list = std::make_shared<SinkList>(*m_sinks);
+        auto it = std::find_if(list->begin(), list->end(),
+                               [id](const std::shared_ptr<Sink>& s) { return s->id == id; });
+        if (it == list->end())
+            return;
+        removed = *it;
+        list->erase(it);
+        m_sinks = list;
+        m_sinkCount.store(static_cast<int>(list->size()), std::memory_order_relaxed);
+        retired.swap(m_retired);
+    }
+    stopSink(removed);
+
+    // 之前在回调里移除的线程已经（或马上）退出，顺手 join；当前线程自己除外
+    for (std::thread& t : retired) {
+        if (t.get_id() == std::this_thread::get_id()) {
+            std::lock_guard<std::mutex> lock(m_mx);
+            m_retired.push_back(std::move(t));
+        } else {
+            t.join();
+        }
+    }
+}
+
+void WFrameFanout::stopSink(const std::shared_ptr<Sink>& sink)
+{
+    {
+        std::lock_guard<std::mutex> lock(sink->mx);
+        sink->stop = true;
+    }
+    sink->cv.notify_all();
+
+    if (sink->thread.get_id() == std::this_thread::get_id()) {
+        // 在它自己的回调里：不能 join 自己，线程看到 stop 后退出，留给之后 join。
+        // 线程函数自己持有 Sink 的引用，这里只需要把 thread 对象交出去
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_retired.push_back(std::move(sink->thread));
+        return;
+    }
+    if (sink->thread.joinable())
+        sink->thread.join();
+}
+
+void WFrameFanout::sinkThreadFunc(std::shared_ptr<Sink> sink)
+{
+    for (;;) {
+        AVFramePool::UniquePtr frame;
+        {
+            std::unique_lock<std::mutex> lock(sink->mx);
+            sink->cv.wait(lock, [&sink] { return sink->stop || !sink->queue.empty(); });
+            if (sink->stop) {
+                // 没送出去的帧直接还回池
+                sink->queue.clear();
+                *sink->totalBytes -= sink->queuedBytes;
+                sink->queuedBytes = 0;
+                return;
+            }
+            frame = sink->popLocked(true);
+        }
+        sink->fn(*frame);
+        sink->delivered.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void WFrameFanout::Push(const AVFrame& frame)
+{
+    if (!HasSinks())
+        return;
+    std::shared_ptr<const SinkList> sinks;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        sinks = m_sinks;
+    }
+
+    for (const std::shared_ptr<Sink>& sink : *sinks) {
+        AVFramePool::UniquePtr ref = m_framePool.Acquire();
+        if (!ref || av_frame_ref(ref.get(), &frame) < 0) {
+            sink->dropped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // 被挤掉的帧在锁外释放
+        AVFramePool::UniquePtr victim;
+        {
+            std::lock_guard<std::mutex> lock(sink->mx);
+            if (sink->stop)
+                continue;
+            if (sink->queue.size() >= sink->opt.capacity) {
+                sink->dropped.fetch_add(1, std::memory_order_relaxed);
+                if (sink->opt.policy == DropPolicy::DropNewest)
+                    continue;
+                victim = sink->popLocked(true);
+            }
+            const size_t bytes = AVFrameBufferBytes(*ref);
+            sink->queuedBytes += bytes;
+            m_queuedBytes += bytes;
+            sink->queue.push_back(std::move(ref));
+        }
+        sink->cv.notify_one();
+    }
+}
+
+std::vector<WFrameFanout::SinkStats> WFrameFanout::GetStats() const
+{
+    std::shared_ptr<const SinkList> sinks;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        sinks = m_sinks;
+    }
+
+    std::vector<SinkStats> out;
+    out.reserve(sinks->size());
+    for (const std::shared_ptr<Sink>& sink : *sinks) {
+        SinkStats s;
+        s.id = sink->id;
+        s.name = sink->opt.name;
+        s.delivered = sink->delivered.load(std::memory_order_relaxed);
+        s.dropped = sink->dropped.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(sink->mx);
+            s.queued = sink->queue.size();
+            s.queued_bytes = sink->queuedBytes;
+        }
+        out.push_back(s);
+    }
+    return out;
+}
+
+size_t WFrameFanout::Trim(size_t keep)
+{
+    std::shared_ptr<const SinkList> sinks;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        sinks = m_sinks;
+    }
+
+    size_t dropped = 0;
+    for (const std::shared_ptr<Sink>& sink : *sinks) {
+        // 丢掉的帧在锁外释放
+        std::vector<AVFramePool::UniquePtr> victims;
+        {
+            std::lock_guard<std::mutex> lock(sink->mx);
+            const bool oldest = sink->opt.policy == DropPolicy::DropOldest;
+            while (sink->queue.size() > keep)
+                victims.push_back(sink->popLocked(oldest));
+        }
+        sink->dropped.fetch_add(victims.size(), std::memory_order_relaxed);
+        dropped += victims.size();
+    }
+    return dropped;
+}
+
+void WFrameFanout::OnFrameDecoded(const AVFrame& frame)
+{
+    Push(frame);
+}
+
+void WFrameFanout::OnDecodeError(const std::string& message)
+{
+    if (m_errorClient)
+        m_errorClient->OnDecodeError(message);
+}
+
+void WFrameFanout::OnFatalError(const std::string& message)
+{
+    if (m_errorClient)
+        m_errorClient->OnFatalError(message);
+}
+
+}  // namespace wmediakits
@@ -0,0 +1,175 @@
+﻿#include "WMPVMemoryStream.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace wmediakits {
+
+WMPVMemoryStream::WMPVMemoryStream(size_t capacity)
+    : m_ring(std::max<size_t>(capacity, 64 << 10))
+{
+}
+
+WMPVMemoryStream::~WMPVMemoryStream()
+{
+    Abort();
+}
+
+bool WMPVMemoryStream::Write(const void* data, size_t size, int timeoutMs)
+{
+    // 一次写入超过整个环永远等不到空间
+    if (size > m_ring.size())
+        return false;
+
+    std::unique_lock<std::mutex> lk(m_mx);
+    auto writable = [this, size] { return m_aborted || m_eof || freeLocked() >= size; };
+    if (timeoutMs < 0) {
+        m_spaceCV.wait(lk, writable);
+    } else if (!m_spaceCV.wait_for(lk, std::chrono::milliseconds(timeoutMs), writable)) {
+        return false;
+    }
+    if (m_aborted || m_eof)
+        return false;
+
+    writeLocked(static_cast<const uint8_t*>(data), size);
+    lk.unlock();
+    m_dataCV.notify_all();
+    return true;
+}
+
+bool WMPVMemoryStream::TryWrite(const void* data, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        if (m_aborted || m_eof || freeLocked() < size)
+            return false;
+        writeLocked(static_cast<const uint8_t*>(data), size);
+    }
+    m_dataCV.notify_all();
+    return true;
+}
+
+void WMPVMemoryStream::writeLocked(const uint8_t* data, size_t size)
+{
+    const size_t cap = m_ring.size();
+    // 空间不够时先淘汰最老的已读数据（调用方已保证未读部分放得下）
+    if (m_end + size - m_start > cap)
+        m_start = m_end + size - cap;
+
+    size_t pos = static_cast<size_t>(m_end % cap);
+    while (size > 0) {
+        const size_t n = std::min(size, cap - pos);
+        memcpy(&m_ring[pos], data, n);
+        data += n;
+        size -= n;
+        m_end += n;
+        pos = 0;
+    }
+}
+
+void WMPVMemoryStream::EndOfStream()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_eof = true;
+    }
+    m_dataCV.notify_all();
+    m_spaceCV.notify_all();
+}
+
+void WMPVMemoryStream::Abort()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_aborted = true;
+    }
+    m_dataCV.notify_all();
+    m_spaceCV.notify_all();
+}
+
+uint64_t WMPVMemoryStream::BufferStart() const
+{
+    std::lock_guard<std::mutex> lk(m_mx);
+    return m_start;
+}
+
+uint64_t WMPVMemoryStream::BufferEnd() const
+{
+    std::lock_guard<std::mutex> lk(m_mx);
+    return m_end;
+}
+
+uint64_t WMPVMemoryStream::ReadPosition() const
+{
+    std::lock_guard<std::mutex> lk(m_mx);
+    return m_read;
+}
+
+void WMPVMemoryStream::OpenReader()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_base = m_start;
+        m_read = m_start;
+        m_cancelled = false;
+    }
+    m_spaceCV.notify_all();
+}
+
+int64_t WMPVMemoryStream::Read(void* buf, uint64_t size)
+{
+    std::unique_lock<std::mutex> lk(m_mx);
+    m_dataCV.wait(lk, [this] { return m_aborted || m_cancelled || m_eof || m_end > m_read; });
+    if (m_aborted || m_cancelled)
+        return -1;
+    if (m_end == m_read)
+        return 0; // EOF
+
+    const size_t cap = m_ring.size();
+    uint8_t* out = static_cast<uint8_t*>(buf);
+    const uint64_t total = std::min<uint64_t>(size, m_end - m_read);
+    uint64_t left = total;
+    while (left > 0) {
+        const size_t pos = static_cast<size_t>(m_read % cap);
+        const size_t n = static_cast<size_t>(std::min<uint64_t>(left, cap - pos));
+        memcpy(out, &m_ring[pos], n);
+        out += n;
+        left -= n;
+        m_read += n;
+    }
+    lk.unlock();
+    m_spaceCV.notify_all();
+    return static_cast<int64_t>(total);
+}
+
+bool WMPVMemoryStream::Seek(uint64_t offset)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        // 相对偏移换成流偏移；先比较再相加，避免溢出
+        if (offset > m_end - m_base || m_base + offset < m_start)
+            return false;
+        m_read = m_base + offset;
+    }
+    m_spaceCV.notify_all();
+    return true;
+}
+
+int64_t WMPVMemoryStream::Size() const
+{
+    std::lock_guard<std::mutex> lk(m_mx);
+    return m_eof ? static_cast<int64_t>(m_end - m_base) : -1;
+}
+
+void WMPVMemoryStream::CancelRead()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_cancelled = true;
+    }
+    m_dataCV.notify_all();
+}
+
+}  // namespace wmediakits
@@ -1,28 +1,355 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <chrono>
 #include <thread>
 
 #include "WMPVPlayer.h"
+#include "WMPVMemoryStream.h"
+#include "WMPVPlayerHost.h"
+#include "WSegmentCache.h"
+#include "WBackgroundRunner.h"
 
 extern "C" {
 #include <mpv/client.h>
+#include <mpv/render.h>
 #include <mpv/render_gl.h>
+#include <mpv/stream_cb.h>
 }
 
 namespace wmediakits {
 
+namespace {
+
+// 观察的属性；reply_userdata 即 PropertyId，事件分发直接 switch，不做字符串比较
+enum PropertyId : uint64_t {
+    kPropTimePos = 1,
+    kPropDuration,
+    kPropPause,
+    kPropSpeed,
+    kPropSeekable,
+    kPropDWidth,
+    kPropDHeight,
+    kPropVideoCodec,
+    kPropAudioCodec,
+    kPropCacheBufferingState,
+    kPropCacheBufferingPercent,
+    kPropDemuxerCacheState,
+    kPropFrameDropCount,
+    kPropDecoderFrameDropCount,
+    kPropVoDelayedFrameCount,
+    kPropAvsync,
+    kPropEstimatedVfFps,
+    kPropVideoBitrate,
+};
+
+struct ObservedProperty {
+    PropertyId  id;
+    const char* name;
+    mpv_format  format;
+};
+
+const ObservedProperty kObservedProperties[] = {
+    { kPropTimePos,               "time-pos",                MPV_FORMAT_DOUBLE },
+    { kPropDuration,              "duration",                MPV_FORMAT_DOUBLE },
+    { kPropPause,                 "pause",                   MPV_FORMAT_FLAG },
+    { kPropSpeed,                 "speed",                   MPV_FORMAT_DOUBLE },
+    { kPropSeekable,              "seekable",                MPV_FORMAT_FLAG },
+    { kPropDWidth,                "dwidth",                  MPV_FORMAT_INT64 },
+    { kPropDHeight,               "dheight",                 MPV_FORMAT_INT64 },
+    { kPropVideoCodec,            "video-codec",             MPV_FORMAT_STRING },
+    { kPropAudioCodec,            "audio-codec",             MPV_FORMAT_STRING },
+    { kPropCacheBufferingState,   "cache-buffering-state",   MPV_FORMAT_INT64 },
+    { kPropCacheBufferingPercent, "cache-buffering-percent", MPV_FORMAT_INT64 },
+    { kPropDemuxerCacheState,     "demuxer-cache-state",     MPV_FORMAT_NODE },
+    { kPropFrameDropCount,        "frame-drop-count",        MPV_FORMAT_INT64 },
+    { kPropDecoderFrameDropCount, "decoder-frame-drop-count", MPV_FORMAT_INT64 },
+    { kPropVoDelayedFrameCount,   "vo-delayed-frame-count",  MPV_FORMAT_INT64 },
+    { kPropAvsync,                "avsync",                  MPV_FORMAT_DOUBLE },
+    { kPropEstimatedVfFps,        "estimated-vf-fps",        MPV_FORMAT_DOUBLE },
+    { kPropVideoBitrate,          "video-bitrate",           MPV_FORMAT_DOUBLE },
+};
+
+// 遥测采样间隔
+constexpr int kTelemetryIntervalMs = 1000;
+
+// 命令回复的 reply_userdata，与属性 ID 不重叠
+constexpr uint64_t kReplySeek = 1000;
+constexpr uint64_t kReplyScreenshot = 1001;
+
+// 夹紧时离片尾保留的余量，避免 seek 到结尾直接触发 EOF
+constexpr double kSeekEndMargin = 0.05;
+
+// 内存流协议，url 形如 wmkmem://name
+const char kMemoryStreamProtocol[] = "wmkmem";
+
+// stream_cb 的 cookie：持有一份引用，流在 mpv 关闭前不会被释放
+typedef std::shared_ptr<WMPVMemoryStream> StreamRef;
+
+int64_t StreamRead(void* cookie, char* buf, uint64_t nbytes)
+{
+    // read_fn 约定：0 为 EOF，-1 为出错（不是 mpv_error）
+    return (*static_cast<StreamRef*>(cookie))->Read(buf, nbytes);
+}
+
+int64_t StreamSeek(void* cookie, int64_t offset)
+{
+    if (offset < 0 || !(*static_cast<StreamRef*>(cookie))->Seek(static_cast<uint64_t>(offset)))
+        return MPV_ERROR_GENERIC;
+    return offset;
+}
+
+int64_t StreamSize(void* cookie)
+{
+    const int64_t size = (*static_cast<StreamRef*>(cookie))->Size();
+    if (size < 0)
+        return MPV_ERROR_UNSUPPORTED;
+    return size;
+}
+
+void StreamCancel(void* cookie)
+{
+    (*static_cast<StreamRef*>(cookie))->CancelRead();
+}
+
+void StreamClose(void* cookie)
+{
+    delete static_cast<StreamRef*>(cookie);
+}
+
+// 把档位展开成 mpv 选项；初始化前用 mpv_set_option_string，运行时用 set_property
+void BuildOptionList(const WMPVPlayer::PlaybackOptions& o, std::vector<std::pair<std::string, std::string>>& out)
+{
+    char buf[64];
+    out.clear();
+    out.emplace_back("cache", o.cache ? "yes" : "no");
+    std::snprintf(buf, sizeof(buf), "%lld", (long long)o.cache_max_bytes);
+    out.emplace_back("demuxer-max-bytes", buf);
+    std::snprintf(buf, sizeof(buf), "%lld", (long long)o.cache_max_back_bytes);
+    out.emplace_back("demuxer-max-back-bytes", buf);
+    out.emplace_back("cache-pause", o.cache_pause ? "yes" : "no");
+    out.emplace_back("force-seekable", o.force_seekable ? "yes" : "no");
+    out.emplace_back("hwdec", o.hwdec);
+    std::snprintf(buf, sizeof(buf), "%d", o.decoder_threads);
+    out.emplace_back("vd-lavc-threads", buf);
+    out.emplace_back("untimed", o.untimed ? "yes" : "no");
+    out.emplace_back("user-agent", o.user_agent);
+
+    // 与 mpv 内置 low-latency profile 等价，显式列出以免依赖配置文件
+    out.emplace_back("audio-buffer", o.low_latency ? "0" : "0.2");
+    out.emplace_back("demuxer-lavf-o", o.low_latency ? "fflags=+nobuffer" : "");
+    out.emplace_back("demuxer-lavf-probe-info", o.low_latency ? "nostreams" : "auto");
+    out.emplace_back("demuxer-lavf-analyzeduration", o.low_latency ? "0.1" : "0");
+    out.emplace_back("stream-buffer-size", o.low_latency ? "4k" : "128k");
+    out.emplace_back("video-latency-hacks", o.low_latency ? "yes" : "no");
+}
+
+// 持有 mpv 核心的播放器（缓存分配和遥测汇总都基于它）及进程总缓存上限
+struct PlayerRegistry {
+    std::mutex               mx;
+    std::vector<WMPVPlayer*> players;
+    int64_t                  limit = 0;
+};
+
+PlayerRegistry& GetPlayerRegistry()
+{
+    static PlayerRegistry registry;
+    return registry;
+}
+
+// 分配下限：再挤也给前向缓存留一点，不至于完全无法播放
+constexpr int64_t kMinForwardCacheBytes = 1 << 20;
+
+const mpv_node* FindNode(const mpv_node* map, const char* name)
+{
+    if (!map || map->format != MPV_FORMAT_NODE_MAP)
+        return nullptr;
+    for (int i = 0; i < map->u.list->num; ++i) {
+        if (map->u.list->keys[i] && std::strcmp(map->u.list->keys[i], name) == 0)
+            return map->u.list->values + i;
+    }
+    return nullptr;
+}
+
+// 4 字节像素的缩小：每个目标像素取对应源区域内 2x2 个采样点的平均，
+// 开销只和目标尺寸有关，与源分辨率无关
+void Downscale4(const uint8_t* src, int sw, int sh, size_t sstride,
+                uint8_t* dst, int dw, int dh, size_t dstride)
+{
+    for (int y = 0; y < dh; ++y) {
+        int sy[2];
+        for (int k = 0; k < 2; ++k)
+            sy[k] = std::min(sh - 1, (int)(((int64_t)(4 * y + 2 * k + 1) * sh) / (4 * dh)));
+        uint8_t* out = dst + (size_t)y * dstride;
+        for (int x = 0; x < dw; ++x) {
+            int sx[2];
+            for (int k = 0; k < 2; ++k)
+                sx[k] = std::min(sw - 1, (int)(((int64_t)(4 * x + 2 * k + 1) * sw) / (4 * dw)));
+            for (int c = 0; c < 4; ++c) {
+                const unsigned sum = src[sy[0] * sstride + sx[0] * 4 + c] + src[sy[0] * sstride + sx[1] * 4 + c]
+                                   + src[sy[1] * sstride + sx[0] * 4 + c] + src[sy[1] * sstride + sx[1] * 4 + c];
+                out[x * 4 + c] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+template <size_t N>
+void CopyString(char (&dst)[N], const char* src)
+{
+    std::snprintf(dst, N, "%s", src ? src : "");
+}
+
+}  // namespace
+
+struct WMPVPlayer::Notifier {
+    struct Subscriber {
+        int              id;
+        uint32_t         fields;
+        PlaybackListener listener;
+    };
+    typedef std::chrono::steady_clock Clock;
+    static constexpr int kFieldCount = 9;
+
+    std::mutex              mx;
+    std::condition_variable cv;
+    WMPVPlayer*             player = nullptr;   // 析构时置空
+    // 写时复制：派发时只拿一个引用，不拷贝回调
+    std::shared_ptr<const std::vector<Subscriber>> subscribers = std::make_shared<std::vector<Subscriber>>();
+    int      nextId = 1;
+    uint32_t dirty = 0;
+    bool     scheduled = false;
+    uint64_t flushSeq = 0;         // 只有最新排的那次 flush 生效，提前补发后旧的自动作废
+    Clock::time_point dueAt;       // scheduled 时最新那次 flush 的到期时间
+    bool     dispatching = false;
+    std::thread::id dispatchThread;
+    int               intervalMs[kFieldCount] = { 250, 0, 0, 0, 0, 0, 0, 0, 500 };
+    Clock::time_point lastSent[kFieldCount];
+
+    // 持 mx：fields 中最早可以发出的时间距现在多少毫秒，fields 为空返回 -1
+    int delayLocked(uint32_t fields, Clock::time_point now) const
+    {
+        int delay = -1;
+        for (int i = 0; i < kFieldCount; ++i) {
+            if (!(fields & (1u << i)))
+                continue;
+            const int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                lastSent[i] + std::chrono::milliseconds(intervalMs[i]) - now).count();
+            const int d = std::max(0, left);
+            delay = delay < 0 ? d : std::min(delay, d);
+        }
+        return delay;
+    }
+
+    // 持 mx：等正在进行的派发结束（派发线程自己调用时不等）
+    void waitDispatchLocked(std::unique_lock<std::mutex>& lk)
+    {
+        if (std::this_thread::get_id() == dispatchThread)
+            return;
+        cv.wait(lk, [this] { return !dispatching; });
+    }
+};
+
 WMPVPlayer::WMPVPlayer() 
+    : m_notifier(std::make_shared<Notifier>())
 {
+    m_notifier->player = this;
+    for (TelemetrySlot& slot : m_telemetry) {
+        slot.seq.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t>& w : slot.words)
+            w.store(0, std::memory_order_relaxed);
+    }
+    // 发布初始快照，读者从一开始就能拿到默认值
+    publishInfoLocked();
 }
 
 WMPVPlayer::~WMPVPlayer()
 { 
+    // StopAsync 的后台任务引用着 this，等它们结束
+    {
+        std::unique_lock<std::mutex> lk(m_asyncStopMx);
+        m_asyncStopCv.wait(lk, [this] { return m_asyncStops == 0; });
+    }
     Stop(); 
+
+    // 断开订阅：之后的合并通知直接丢弃，并等正在进行的回调结束
+    std::unique_lock<std::mutex> lk(m_notifier->mx);
+    m_notifier->player = nullptr;
+    m_notifier->waitDispatchLocked(lk);
 }
 
+WMPVPlayer::PlaybackOptions WMPVPlayer::PlaybackOptions::Vod()
+{
+    return PlaybackOptions();
+}
+
+WMPVPlayer::PlaybackOptions WMPVPlayer::PlaybackOptions::Live()
+{
+    PlaybackOptions o;
+    o.cache_max_bytes = 16 << 20;
+    o.cache_max_back_bytes = 0;
+    o.readahead_secs = 0.5;
+    o.cache_pause = false;      // 宁可掉帧也不要停下来缓冲
+    o.force_seekable = false;
+    o.decoder_threads = 1;      // 帧级多线程会多攒几帧延迟
+    o.low_latency = true;
+    return o;
+}
+
+// 软件渲染的缓冲池：行宽和首地址按 64 字节对齐（mpv 的 SIMD 路径要求），
+// 帧交出去后由持有者释放时还回池里
+struct WMPVPlayer::SwBufferPool : std::enable_shared_from_this<SwBufferPool> {
+    struct Buffer {
+        std::unique_ptr<uint8_t[]> raw;
+        uint8_t* aligned = nullptr;
+    };
+
+    SwBufferPool(size_t bytes, size_t maxFree) : bytes(bytes), maxFree(maxFree) {}
+    ~SwBufferPool()
+    {
+        for (Buffer* b : free)
+            delete b;
+    }
+
+    std::shared_ptr<uint8_t> Acquire()
+    {
+        Buffer* b = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(mx);
+            if (!free.empty()) {
+                b = free.back();
+                free.pop_back();
+            }
+        }
+        if (!b) {
+            b = new Buffer;
+            b->raw.reset(new uint8_t[bytes + 63]);
+            b->aligned = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(b->raw.get()) + 63) & ~uintptr_t(63));
+        }
+        std::shared_ptr<SwBufferPool> self = shared_from_this();
+        std::shared_ptr<Buffer> holder(b, [self](Buffer* p) { self->Release(p); });
+        return std::shared_ptr<uint8_t>(holder, b->aligned);
+    }
+
+    void Release(Buffer* b)
+    {
+        std::lock_guard<std::mutex> lk(mx);
+        if (free.size() < maxFree)
+            free.push_back(b);
+        else
+            delete b;
+    }
+
+    const size_t         bytes;
+    const size_t         maxFree;
+    std::mutex           mx;
+    std::vector<Buffer*> free;
+};
+
 bool WMPVPlayer::Init(const std::string& title, int default_w, int default_h, FillMode defaultFill)
 {
+    m_headless = false;
     m_title = title;
     m_defaultW = default_w;
     m_defaultH = default_h;
@@ -30,31 +357,339 @@ bool WMPVPlayer::Init(const std::string& title, int default_w, int default_h, Fi
     return true; // 轻量，不做 SDL/mpv 初始化
 }
 
+bool WMPVPlayer::Init(const std::string& title, int default_w, int default_h,
+                      FillMode defaultFill, const PlaybackOptions& options)
+{
+    SetPlaybackOptions(options);
+    return Init(title, default_w, default_h, defaultFill);
+}
+
+bool WMPVPlayer::InitHeadless(const HeadlessOptions& options, FrameCallback onFrame)
+{
+    if (m_running.load() || options.width <= 0 || options.height <= 0)
+        return false;
+    if (options.target) {
+        if (options.target_stride != 0 && options.target_stride < (size_t)options.width * 4)
+            return false;
+        // sw 渲染按 32 位像素写，未对齐的地址/行宽不接受
+        if ((reinterpret_cast<uintptr_t>(options.target) | options.target_stride) & 3)
+            return false;
+    }
+
+    m_headless = true;
+    m_headlessOpts = options;
+    m_onFrame = std::move(onFrame);
+    m_defaultW = options.width;
+    m_defaultH = options.height;
+    m_swPool.reset();
+    if (!options.target) {
+        const size_t stride = ((size_t)options.width * 4 + 63) & ~size_t(63);
+        m_swPool = std::make_shared<SwBufferPool>(stride * options.height, options.pool_size);
+    }
+    return true;
+}
+
+void WMPVPlayer::SetPlaybackOptions(const PlaybackOptions& options)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_optionsMx);
+        m_options = options;
+    }
+    if (!m_mpv)
+        return;
+
+    // 已在播放：逐项设为属性。mpv 不允许运行时修改的项会在回复里报错，忽略即可
+    std::vector<std::pair<std::string, std::string>> list;
+    BuildOptionList(options, list);
+    for (const auto& kv : list) {
+        const char* value = kv.second.c_str();
+        mpv_set_property_async(m_mpv, 0, kv.first.c_str(), MPV_FORMAT_STRING, &value);
+    }
+    // 缓存字节数以进程内分配的结果为准
+    m_cacheDirty.store(true);
+    rebalanceCaches();
+}
+
+void WMPVPlayer::SetCacheBudget(const CacheBudget& budget)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_optionsMx);
+        m_options.cache_max_bytes = budget.forward_bytes;
+        m_options.cache_max_back_bytes = budget.back_bytes;
+        m_options.readahead_secs = budget.forward_secs;
+    }
+    m_cacheDirty.store(true);
+    rebalanceCaches();
+}
+
+WMPVPlayer::CacheBudget WMPVPlayer::GetCacheBudget() const
+{
+    CacheBudget out;
+    {
+        std::lock_guard<std::mutex> lk(m_optionsMx);
+        out.forward_bytes = m_options.cache_max_bytes;
+        out.back_bytes = m_options.cache_max_back_bytes;
+        out.forward_secs = m_options.readahead_secs;
+    }
+    // 在跑时以分到的为准
+    if (m_grantedFwBytes.load() > 0) {
+        out.forward_bytes = m_grantedFwBytes.load();
+        out.back_bytes = m_grantedBackBytes.load();
+    }
+    return out;
+}
+
+void WMPVPlayer::SetProcessCacheLimit(int64_t bytes)
+{
+    {
+        PlayerRegistry& reg = GetPlayerRegistry();
+        std::lock_guard<std::mutex> lk(reg.mx);
+        reg.limit = std::max<int64_t>(bytes, 0);
+    }
+    rebalanceCaches();
+}
+
+int64_t WMPVPlayer::GetProcessCacheLimit()
+{
+    PlayerRegistry& reg = GetPlayerRegistry();
+    std::lock_guard<std::mutex> lk(reg.mx);
+    return reg.limit;
+}
+
+void WMPVPlayer::registerCacheUser(WMPVPlayer* player, bool live)
+{
+    {
+        PlayerRegistry& reg = GetPlayerRegistry();
+        std::lock_guard<std::mutex> lk(reg.mx);
+        auto it = std::find(reg.players.begin(), reg.players.end(), player);
+        if (live && it == reg.players.end())
+            reg.players.push_back(player);
+        else if (!live && it != reg.players.end())
+            reg.players.erase(it);
+    }
+    if (!live) {
+        player->m_grantedFwBytes.store(0);
+        player->m_grantedBackBytes.store(0);
+    }
+    rebalanceCaches();
+}
+
+void WMPVPlayer::rebalanceCaches()
+{
+    PlayerRegistry& reg = GetPlayerRegistry();
+    std::lock_guard<std::mutex> lk(reg.mx);
+
+    // 先收集各自请求的预算（锁顺序：注册表 -> 播放器的 m_optionsMx）；关了缓存的不参与
+    std::vector<std::pair<int64_t, int64_t>> wants(reg.players.size());
+    std::vector<bool> cached(reg.players.size());
+    size_t cachedCount = 0;
+    for (size_t i = 0; i < reg.players.size(); ++i) {
+        WMPVPlayer* p = reg.players[i];
+        std::lock_guard<std::mutex> olk(p->m_optionsMx);
+        cached[i] = p->m_options.cache;
+        if (!cached[i])
+            continue;
+        wants[i].first = std::max<int64_t>(p->m_options.cache_max_bytes, 0);
+        wants[i].second = std::max<int64_t>(p->m_options.cache_max_back_bytes, 0);
+        ++cachedCount;
+    }
+
+    // 下限也算在总上限里：先给每个播放器留出前向下限（总上限太小时平分），
+    // 剩下的按各自超出下限的请求等比例分；不超总上限时各取所需
+    int64_t floorBytes = kMinForwardCacheBytes;
+    double scale = 1.0;
+    if (reg.limit > 0 && cachedCount > 0) {
+        floorBytes = std::min<int64_t>(kMinForwardCacheBytes, reg.limit / (int64_t)cachedCount);
+        double rest = 0.0;
+        for (size_t i = 0; i < reg.players.size(); ++i) {
+            if (cached[i])
+                rest += (double)std::max<int64_t>(wants[i].first - floorBytes, 0) + (double)wants[i].second;
+        }
+        const double spare = (double)(reg.limit - floorBytes * (int64_t)cachedCount);
+        if (rest > spare)
+            scale = spare / rest;
+    }
+    for (size_t i = 0; i < reg.players.size(); ++i) {
+        WMPVPlayer* p = reg.players[i];
+        int64_t fw = 0;
+        int64_t back = 0;
+        if (cached[i]) {
+            fw = floorBytes + (int64_t)(std::max<int64_t>(wants[i].first - floorBytes, 0) * scale);
+            back = (int64_t)(wants[i].second * scale);
+        }
+        const bool changed = p->m_grantedFwBytes.exchange(fw) != fw;
+        const Uint32 wake = p->m_evWake.load();
+        if ((p->m_grantedBackBytes.exchange(back) != back || changed || p->m_cacheDirty.load()) && wake) {
+            p->m_cacheDirty.store(true);
+            SDL_Event ev{}; ev.type = wake;
+            SDL_PushEvent(&ev);
+        }
+    }
+}
+
+void WMPVPlayer::cacheBudgetOptions(std::vector<std::pair<std::string, std::string>>& out) const
+{
+    double readahead = 0.0;
+    bool cache = true;
+    {
+        std::lock_guard<std::mutex> lk(m_optionsMx);
+        readahead = m_options.readahead_secs;
+        cache = m_options.cache;
+    }
+    char buf[64];
+    out.clear();
+    // 关了缓存的播放器没有分到预算，保留 BuildOptionList 设的字节数
+    if (cache) {
+        std::snprintf(buf, sizeof(buf), "%lld", (long long)m_grantedFwBytes.load());
+        out.emplace_back("demuxer-max-bytes", buf);
+        std::snprintf(buf, sizeof(buf), "%lld", (long long)m_grantedBackBytes.load());
+        out.emplace_back("demuxer-max-back-bytes", buf);
+    }
+    if (readahead > 0.0) {
+        std::snprintf(buf, sizeof(buf), "%f", readahead);
+        out.emplace_back("demuxer-readahead-secs", buf);
+        out.emplace_back("cache-secs", buf);
+    } else if (!m_defaultReadahead.empty()) {
+        // 未指定：恢复 mpv 自己的默认值（从直播档切回点播时需要）
+        out.emplace_back("demuxer-readahead-secs", m_defaultReadahead);
+        out.emplace_back("cache-secs", m_defaultCacheSecs);
+    }
+}
+
+void WMPVPlayer::applyCacheBudget()
+{
+    std::vector<std::pair<std::string, std::string>> list;
+    cacheBudgetOptions(list);
+    for (const auto& kv : list) {
+        const char* value = kv.second.c_str();
+        mpv_set_property_async(m_mpv, 0, kv.first.c_str(), MPV_FORMAT_STRING, &value);
+    }
+}
+
+bool WMPVPlayer::Play(const std::string& url, double startSeconds, const PlaybackOptions& options)
+{
+    SetPlaybackOptions(options);
+    return Play(url, startSeconds);
+}
+
 bool WMPVPlayer::Play(const std::string& url, double startSeconds)
 {
+    reapEndedSession();
     if (m_running.exchange(true)) {
-        // 已在运行；简化起见返回 false（可扩展为切流）
-        return false;
+        // 已在运行（或已预热）：保留窗口、GL 上下文和 mpv 核心，直接切流
+        markPlayRequested();
+        m_showWindow.store(true);
+        if (const Uint32 wake = m_evWake.load()) {
+            SDL_Event ev{}; ev.type = wake;
+            SDL_PushEvent(&ev);
+        }
+
+        std::lock_guard<std::mutex> lk(m_loadMx);
+        m_url = url;
+        m_startSeconds = startSeconds;
+        if (!m_coreReady)
+            return true; // 线程还没发 loadfile，启动完成后会直接加载最新的 m_url
+
+        resetFileState();
+        if (!m_preloadUrl.empty() && m_preloadUrl == url && startSeconds <= 0.0) {
+            // 预加载过的下一项：切到播放列表下一项，复用已经打开/缓冲的流
+            const char* cmd[] = { "playlist-next", "force", nullptr };
+            mpv_command_async(m_mpv, 0, cmd);
+        }
+        else {
+            loadLocked(url, startSeconds);
+        }
+        m_preloadUrl.clear();
+        return true;
     }
 
-    m_url = url;
-    m_startSeconds = startSeconds;
+    {
+        std::lock_guard<std::mutex> lk(m_loadMx);
+        m_url = url;
+        m_startSeconds = startSeconds;
+        m_coreReady = false;
+        m_startupDone = false;
+    }
+    {
+        std::lock_guard<std::mutex> lk(m_timingMx);
+        m_startup = StartupTimings();
+    }
+    markPlayRequested();
     m_quit.store(false);
+    resetFileState();
 
-    m_thread = std::thread([this] { threadFunc(); });
+    if (!startThread()) {
+        m_running.store(false);
+        return false;
+    }
+    return true;
+}
+
+void WMPVPlayer::StopAsync(OnStopped done, int deadlineMs)
+{
+    // 先发出退出请求（播放器线程/host 会尽快开始拆），调用方不等
+    m_quit.store(true);
+    if (const Uint32 wake = m_evWake.load()) {
+        SDL_Event ev{}; ev.type = wake;
+        SDL_PushEvent(&ev);
+    }
+    {
+        std::lock_guard<std::mutex> lk(m_asyncStopMx);
+        ++m_asyncStops;
+    }
+
+    // 完成和截止时间谁先到谁回调，只回调一次
+    struct StopState {
+        std::atomic<bool> fired{ false };
+        OnStopped         done;
+    };
+    auto state = std::make_shared<StopState>();
+    state->done = std::move(done);
+    auto finish = [state](bool finished) {
+        if (!state->fired.exchange(true) && state->done)
+            state->done(finished);
+    };
+
+    WBackgroundRunner& runner = WBackgroundRunner::Shared();
+    if (deadlineMs >= 0)
+        runner.PostCallback([finish] { finish(false); }, deadlineMs);
+    runner.PostBlocking([this, finish] {
+        Stop();
+        {
+            std::lock_guard<std::mutex> lk(m_asyncStopMx);
+            --m_asyncStops;
+            m_asyncStopCv.notify_all();
+        }
+        // 之后不再碰 this：回调里可以直接销毁播放器
+        finish(true);
+    });
+}
+
+bool WMPVPlayer::SetHost(WMPVPlayerHost* host)
+{
+    if (m_running.load())
+        return false;
+    m_host = host;
     return true;
 }
 
 void WMPVPlayer::Stop()
 {
+    std::lock_guard<std::mutex> stopLock(m_stopMx);
     if (!m_running.load())
         return;
+    if (m_host) {
+        // 挂在 host 上：由 host 线程拆掉，这里等它完成
+        m_host->detach(this);
+        m_running.store(false);
+        return;
+    }
     m_quit.store(true);
 
     // 唤醒 SDL_WaitEvent
-    if (m_evWake) {
+    if (const Uint32 wake = m_evWake.load()) {
         SDL_Event ev{};
-        ev.type = m_evWake;
+        ev.type = wake;
         SDL_PushEvent(&ev);
     }
     else {
@@ -71,62 +706,350 @@ void WMPVPlayer::Stop()
 }
 
 
+void WMPVPlayer::reapEndedSession()
+{
+    if (!m_running.load())
+        return;
+    // 还在启动（m_startupDone 为 false）或正在跑的会话不动；
+    // 窗口被关掉（m_quit）或启动失败/已拆完（启动完成但没有核心）时线程已经或正在退出，
+    // 不会再处理 Play/Warmup，先 join 掉，调用方接着冷启动
+    bool ended = m_quit.load();
+    if (!ended) {
+        std::lock_guard<std::mutex> lk(m_loadMx);
+        ended = m_startupDone && !m_coreReady;
+    }
+    if (ended)
+        Stop();
+}
+
+bool WMPVPlayer::Warmup()
+{
+    reapEndedSession();
+    if (!m_running.exchange(true)) {
+        {
+            std::lock_guard<std::mutex> lk(m_loadMx);
+            m_url.clear();
+            m_startSeconds = 0.0;
+            m_coreReady = false;
+            m_startupDone = false;
+        }
+        m_showWindow.store(false);
+        {
+            std::lock_guard<std::mutex> lk(m_timingMx);
+            m_startup = StartupTimings();
+            m_startup.warm = true;
+        }
+        m_quit.store(false);
+        resetFileState();
+        if (!startThread()) {
+            m_running.store(false);
+            return false;
+        }
+    }
+
+    bool ready = false;
+    {
+        std::unique_lock<std::mutex> lk(m_loadMx);
+        m_readyCv.wait(lk, [this] { return m_startupDone; });
+        ready = m_coreReady;
+    }
+    if (!ready)
+        Stop();
+    return ready;
+}
+
+bool WMPVPlayer::GetStartupTimings(StartupTimings& out) const
+{
+    std::lock_guard<std::mutex> lk(m_timingMx);
+    out = m_startup;
+    return true;
+}
+
+bool WMPVPlayer::Preload(const std::string& url)
+{
+    std::lock_guard<std::mutex> lk(m_loadMx);
+    m_preloadUrl = url;
+    if (m_coreReady && !url.empty())
+        appendLocked(url);
+    return true;
+}
+
+std::string WMPVPlayer::AddMemoryStream(const std::string& name, const std::shared_ptr<WMPVMemoryStream>& stream)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_streamsMx);
+        m_streams[name] = stream;
+    }
+    return std::string(kMemoryStreamProtocol) + "://" + name;
+}
+
+void WMPVPlayer::RemoveMemoryStream(const std::string& name)
+{
+    std::lock_guard<std::mutex> lk(m_streamsMx);
+    m_streams.erase(name);
+}
+
+void WMPVPlayer::SetSegmentCache(const std::shared_ptr<WSegmentCache>& cache)
+{
+    std::lock_guard<std::mutex> lk(m_streamsMx);
+    m_segmentCache = cache;
+}
+
+std::string WMPVPlayer::sourceUrl(const std::string& url)
+{
+    // m_url/m_preloadUrl 保留原地址（切流、预加载按它比较），只在发 loadfile 时换成代理地址
+    std::lock_guard<std::mutex> lk(m_streamsMx);
+    return m_segmentCache ? m_segmentCache->ProxyUrl(url) : url;
+}
+
 void WMPVPlayer::RegisterOnDisconnect(OnDisconnect handler)
 {
     m_onDisconnect = handler;
 }
 
-void WMPVPlayer::TogglePause()
+template <typename Fn>
+void WMPVPlayer::updateInfo(Fn&& fn)
 {
-    if (!m_mpv) return;
-    const char* cmd[] = { "cycle", "pause", nullptr };
-    mpv_command_async(m_mpv, 0, cmd);
+    uint32_t changed = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_infoWriteMx);
+        const InfoState before = m_infoState;
+        fn(m_infoState);
+        publishInfoLocked();
+        changed = diffInfo(before, m_infoState);
+    }
+    if (changed)
+        notifyChanged(changed);
 }
 
-void WMPVPlayer::SeekRelative(double sec)
+uint32_t WMPVPlayer::diffInfo(const InfoState& a, const InfoState& b)
 {
-    if (!m_mpv) return;
+    uint32_t f = 0;
+    if (a.position != b.position) f |= FieldPosition;
+    if (a.duration != b.duration) f |= FieldDuration;
+    if (a.paused != b.paused) f |= FieldPause;
+    if (a.rate != b.rate) f |= FieldRate;
+    if (a.seekable != b.seekable) f |= FieldSeekable;
+    if (a.width != b.width || a.height != b.height) f |= FieldDimensions;
+    if (std::strcmp(a.vcodec, b.vcodec) != 0 || std::strcmp(a.acodec, b.acodec) != 0) f |= FieldCodecs;
+    if (a.buffering_state != b.buffering_state || a.buffering_percent != b.buffering_percent) f |= FieldBuffering;
+    if (a.cache_duration != b.cache_duration || a.fw_bytes != b.fw_bytes || a.bw_bytes != b.bw_bytes ||
+        a.seek_ranges != b.seek_ranges ||
+        std::memcmp(a.seek_start, b.seek_start, sizeof(a.seek_start)) != 0 ||
+        std::memcmp(a.seek_end, b.seek_end, sizeof(a.seek_end)) != 0)
+        f |= FieldCache;
+    return f;
+}
+
+int WMPVPlayer::Subscribe(PlaybackListener listener, uint32_t fields)
+{
+    if (!listener || !(fields & FieldAll))
+        return 0;
+    std::lock_guard<std::mutex> lk(m_notifier->mx);
+    auto list = std::make_shared<std::vector<Notifier::Subscriber>>(*m_notifier->subscribers);
+    const int id = m_notifier->nextId++;
+    list->push_back(Notifier::Subscriber{ id, fields & FieldAll, std::move(listener) });
+    m_notifier->subscribers = list;
+    return id;
+}
 
-    // 1) 读当前 time-pos
-    double cur = 0.0;
-    if (mpv_get_property(m_mpv, "time-pos", MPV_FORMAT_DOUBLE, &cur) < 0)
+void WMPVPlayer::Unsubscribe(int id)
+{
+    std::unique_lock<std::mutex> lk(m_notifier->mx);
+    auto list = std::make_shared<std::vector<Notifier::Subscriber>>(*m_notifier->subscribers);
+    list->erase(std::remove_if(list->begin(), list->end(),
+                               [id](const Notifier::Subscriber& s) { return s.id == id; }),
+                list->end());
+    m_notifier->subscribers = list;
+    m_notifier->waitDispatchLocked(lk);
+}
+
+void WMPVPlayer::SetNotifyInterval(uint32_t fields, int intervalMs)
+{
+    std::lock_guard<std::mutex> lk(m_notifier->mx);
+    for (int i = 0; i < Notifier::kFieldCount; ++i) {
+        if (fields & (1u << i))
+            m_notifier->intervalMs[i] = std::max(0, intervalMs);
+    }
+}
+
+void WMPVPlayer::notifyChanged(uint32_t fields)
+{
+    Notifier& n = *m_notifier;
+    int delay = 0;
+    uint64_t seq = 0;
+    {
+        std::lock_guard<std::mutex> lk(n.mx);
+        if (n.subscribers->empty())
+            return;
+        const uint32_t added = fields & ~n.dirty;
+        n.dirty |= fields;
+        const Notifier::Clock::time_point now = Notifier::Clock::now();
+        if (n.scheduled) {
+            // 已有待发的合并通知，这次变化会一起带上；
+            // 但新变脏的字段比它更早能发（如间隔为 0 的字段）时，按新的时间补排一次
+            delay = n.delayLocked(added, now);
+            if (delay < 0 || now + std::chrono::milliseconds(delay) >= n.dueAt)
+                return;
+        } else {
+            delay = n.delayLocked(n.dirty, now);
+        }
+        n.scheduled = true;
+        n.dueAt = now + std::chrono::milliseconds(delay);
+        seq = ++n.flushSeq;
+    }
+    std::weak_ptr<Notifier> weak = m_notifier;
+    WBackgroundRunner::Shared().PostCallback([weak, seq] { flushNotifications(weak, seq); }, delay);
+}
+
+void WMPVPlayer::flushNotifications(const std::weak_ptr<Notifier>& weak, uint64_t seq)
+{
+    std::shared_ptr<Notifier> n = weak.lock();
+    if (!n)
         return;
 
-    // 2) 读 duration（可选，用于夹紧范围）
-    double dur = 0.0;
-    if (mpv_get_property(m_mpv, "duration", MPV_FORMAT_DOUBLE, &dur) < 0)
-        dur = 0.0;
+    std::unique_lock<std::mutex> lk(n->mx);
+    if (seq != n->flushSeq)
+        return; // 已被更早到期的一次取代
+    // flush 在回调线程池上跑，可能和上一次派发重叠：等它派发完，保证同一播放器的通知按顺序、不并发。
+    // 作废的 flush 上面已经返回，每个播放器最多占一个线程在这里等
+    n->cv.wait(lk, [&n] { return !n->dispatching; });
+    if (seq != n->flushSeq)
+        return;
+    n->scheduled = false;
+    if (!n->player)
+        return;
+
+    // 到了间隔的字段现在发；没到的留着，按最早到期的时间再排一次
+    const Notifier::Clock::time_point now = Notifier::Clock::now();
+    uint32_t ready = 0;
+    for (int i = 0; i < Notifier::kFieldCount; ++i) {
+        const uint32_t bit = 1u << i;
+        if ((n->dirty & bit) && now >= n->lastSent[i] + std::chrono::milliseconds(n->intervalMs[i])) {
+            ready |= bit;
+            n->lastSent[i] = now;
+        }
+    }
+    n->dirty &= ~ready;
+    if (n->dirty) {
+        const int delay = n->delayLocked(n->dirty, now);
+        const uint64_t next = ++n->flushSeq;
+        n->scheduled = true;
+        n->dueAt = now + std::chrono::milliseconds(delay);
+        WBackgroundRunner::Shared().PostCallback([weak, next] { flushNotifications(weak, next); }, delay);
+    }
+    if (!ready)
+        return;
 
-    // 3) 计算目标，并夹在 [0, dur-0.05]
-    double dst = cur + sec;
-    if (dst < 0.0) dst = 0.0;
-    if (dur > 0.0 && dst > dur - 0.05) dst = dur - 0.05;
+    // 所有订阅者共用一份快照
+    PlaybackInfo info;
+    n->player->GetPlaybackInfo(info);
+    std::shared_ptr<const std::vector<Notifier::Subscriber>> subscribers = n->subscribers;
+    n->dispatching = true;
+    n->dispatchThread = std::this_thread::get_id();
+    lk.unlock();
+
+    for (const Notifier::Subscriber& s : *subscribers) {
+        if (s.fields & ready)
+            s.listener(s.fields & ready, info);
+    }
 
-    // 4) 直接设置 time-pos（异步、线程安全）
-    mpv_set_property_async(m_mpv, 0, "time-pos", MPV_FORMAT_DOUBLE, &dst);
+    lk.lock();
+    n->dispatching = false;
+    n->dispatchThread = std::thread::id();
+    n->cv.notify_all();
 }
 
-void WMPVPlayer::SeekTo(double pos_sec)
+void WMPVPlayer::publishInfoLocked()
+{
+    uint64_t words[kInfoWords] = {};
+    std::memcpy(words, &m_infoState, sizeof(InfoState));
+
+    const uint32_t seq = m_infoSeq.load(std::memory_order_relaxed);
+    m_infoSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kInfoWords; ++i)
+        m_infoWords[i].store(words[i], std::memory_order_relaxed);
+    m_infoSeq.store(seq + 2, std::memory_order_release);
+}
+
+void WMPVPlayer::readInfo(InfoState& out) const
+{
+    uint64_t words[kInfoWords];
+    for (;;) {
+        const uint32_t seq = m_infoSeq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < kInfoWords; ++i)
+            words[i] = m_infoWords[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_infoSeq.load(std::memory_order_relaxed) == seq)
+            break;
+    }
+    std::memcpy(&out, words, sizeof(InfoState));
+}
+
+void WMPVPlayer::TogglePause()
 {
     if (!m_mpv) return;
+    const char* cmd[] = { "cycle", "pause", nullptr };
+    mpv_command_async(m_mpv, 0, cmd);
+}
 
-    if (!file_loaded.load()) {
-        pending_seek_pos.store(pos_sec);
-        have_pending_seek.store(true);
-        return;
+void WMPVPlayer::SeekRelative(double sec)
+{
+    // 不读 mpv 属性：有待发请求就在上面累加（待发的绝对目标同样平移）
+    std::lock_guard<std::mutex> lk(m_seekMx);
+    if (m_seekPending) {
+        m_seekPendingValue += sec;
+    }
+    else {
+        m_seekPending = true;
+        m_seekPendingAbsolute = false;
+        m_seekPendingValue = sec;
     }
+    issueSeekLocked();
+}
 
-    // 可选夹紧（避免负值；有时 duration 取不到就不做上限夹紧）
-    if (pos_sec < 0.0) pos_sec = 0.0;
+void WMPVPlayer::SeekTo(double pos_sec)
+{
+    // 绝对 seek 覆盖之前所有未发出的请求；文件未加载时等 FILE_LOADED 再发
+    std::lock_guard<std::mutex> lk(m_seekMx);
+    m_seekPending = true;
+    m_seekPendingAbsolute = true;
+    m_seekPendingValue = pos_sec;
+    issueSeekLocked();
+}
 
-    // 夹在时长范围内
-    double dur = 0.0;
-    if (mpv_get_property(m_mpv, "duration", MPV_FORMAT_DOUBLE, &dur) == 0 && dur > 0.0) {
-        if (pos_sec > dur - 0.05) pos_sec = dur - 0.05;
+void WMPVPlayer::issueSeekLocked()
+{
+    if (!m_mpv || !file_loaded.load() || m_seekInFlight || !m_seekPending)
+        return;
+
+    bool absolute = m_seekPendingAbsolute;
+    double value = m_seekPendingValue;
+    m_seekPending = false;
+
+    // 相对 seek 交给 mpv 原生处理；只有会越过片尾时才借助本地快照换成绝对位置夹紧
+    InfoState info;
+    readInfo(info);
+    if (!absolute && info.duration > 0.0 && info.position + value > info.duration - kSeekEndMargin) {
+        absolute = true;
+        value = info.position + value;
+    }
+    if (absolute) {
+        if (value < 0.0) value = 0.0;
+        if (info.duration > 0.0 && value > info.duration - kSeekEndMargin)
+            value = info.duration - kSeekEndMargin;
     }
 
-    // 绝对 seek：直接设置 time-pos
-    mpv_set_property_async(m_mpv, 0, "time-pos", MPV_FORMAT_DOUBLE, &pos_sec);
+    char arg[64];
+    std::snprintf(arg, sizeof(arg), "%f", value);
+    const char* cmd[] = { "seek", arg, absolute ? "absolute" : "relative", nullptr };
+    if (mpv_command_async(m_mpv, kReplySeek, cmd) >= 0)
+        m_seekInFlight = true;
 }
 
 void WMPVPlayer::AddVolume(int delta)
@@ -147,11 +1070,10 @@ void WMPVPlayer::SetRate(double rate)
         mpv_set_property_async(m_mpv, 0, "pause", MPV_FORMAT_FLAG, &paused);
 
         // 立刻更新本地快照（更快的 UI 反馈），后续以 PROPERTY_CHANGE 为准
-        {
-            std::lock_guard<std::mutex> lk(m_infoMx);
-            m_info.paused = true;
-            m_info.rate = 0.0;  // 有效速率
-        }
+        updateInfo([](InfoState& info) {
+            info.paused = true;
+            info.rate = 0.0;  // 有效速率
+        });
         return;
     }
 
@@ -162,84 +1084,245 @@ void WMPVPlayer::SetRate(double rate)
     mpv_set_property_async(m_mpv, 0, "speed", MPV_FORMAT_DOUBLE, &rate);
 
     // 本地更新（立即生效，之后 PROPERTY_CHANGE 会再确认）
-    {
-        std::lock_guard<std::mutex> lk(m_infoMx);
-        m_info.paused = false;
-        m_info.rate = rate;   // 有效速率
-    }
+    updateInfo([rate](InfoState& info) {
+        info.paused = false;
+        info.rate = rate;   // 有效速率
+    });
 
     // 保存 nominal speed
     m_speedRaw.store(rate, std::memory_order_release);
 }
 
+void WMPVPlayer::SetPresentMode(PresentMode m)
+{
+    m_presentMode.store(m);
+    // swap interval 必须在 GL 线程上设置；此处只唤醒
+    if (const Uint32 wake = m_evWake.load()) {
+        SDL_Event ev{}; ev.type = wake;
+        SDL_PushEvent(&ev);
+    }
+}
+
+bool WMPVPlayer::GetFrameTimings(FrameTimings& out) const
+{
+    std::lock_guard<std::mutex> lk(m_timingMx);
+    out = m_timings;
+    return true;
+}
+
 void WMPVPlayer::SetFillMode(FillMode m)
 {
     m_fill = m;
     // 若已创建 mpv core，在播放器线程里应用；此处只唤醒
-    if (m_evWake) {
-        SDL_Event ev{}; ev.type = m_evWake;
+    if (const Uint32 wake = m_evWake.load()) {
+        SDL_Event ev{}; ev.type = wake;
         SDL_PushEvent(&ev);
     }
 }
 
 bool WMPVPlayer::GetPlaybackInfo(PlaybackInfo& out) const
 {
-    std::lock_guard<std::mutex> lk(m_infoMx);
-    out = m_info;
-    return true;
+    InfoState info;
+    readInfo(info);
+
+    out.position = info.position;
+    out.duration = info.duration;
+    out.rate = info.rate;
+    out.paused = info.paused;
+    out.seekable = info.seekable;
+    out.width = info.width;
+    out.height = info.height;
+    out.buffering_state = info.buffering_state;
+    out.buffering_percent = info.buffering_percent;
+    out.cache_duration = info.cache_duration;
+    out.bw_bytes = info.bw_bytes;
+    out.fw_bytes = info.fw_bytes;
+    out.vcodec = info.vcodec;
+    out.acodec = info.acodec;
+    out.seekable_ranges.clear();
+    for (int i = 0; i < info.seek_ranges; ++i)
+        out.seekable_ranges.push_back(PlaybackInfo::TimeRange{ info.seek_start[i], info.seek_end[i] });
+    return true;
+}
+
+void WMPVPlayer::threadFunc()
+{
+    if (!beginSession())
+        return;
+
+    while (!m_quit.load()) {
+        SDL_Event e{};
+        if (SDL_WaitEvent(&e) != 1) {
+            std::fprintf(stderr, "SDL_WaitEvent error\n");
+            break;
+        }
+
+        // 先取完队列里已有的事件再渲染：同一轮里的多次更新只绘制最新一帧
+        bool need_redraw = false;
+        do {
+            handleEvent(e, need_redraw);
+        } while (!m_quit.load() && SDL_PollEvent(&e) == 1);
+
+        if (need_redraw && m_renderReady) {
+            renderFrame();
+        }
+    }
+
+    endSession();
+}
+
+bool WMPVPlayer::startThread()
+{
+    if (m_host)
+        return m_host->attach(this);
+    m_thread = std::thread([this] { threadFunc(); });
+    return true;
+}
+
+bool WMPVPlayer::beginSession()
+{
+    const bool ok = startup();
+    {
+        // 之后的 Play()/Preload() 直接对这个 mpv 核心发命令；预热时还没有 url
+        std::lock_guard<std::mutex> lk(m_loadMx);
+        if (ok) {
+            if (!m_url.empty())
+                loadLocked(m_url, m_startSeconds);
+            if (!m_preloadUrl.empty())
+                appendLocked(m_preloadUrl);
+            m_coreReady = true;
+        }
+        m_startupDone = true;
+    }
+    m_readyCv.notify_all();
+    return ok;
+}
+
+void WMPVPlayer::endSession()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_loadMx);
+        m_coreReady = false;
+    }
+    // 之后的 Play()/Stop() 不再往这一轮的事件队列里发唤醒
+    m_evWake.store(0);
+    destroyWindow();
+    destroyMpv();
+    SDL_QuitSubSystem(sdlSubsystems());
+
+    // 核心没了，在途的截图不会再有回复
+    std::lock_guard<std::mutex> lk(m_thumbMx);
+    m_thumbInFlight = false;
+    m_thumbDone = nullptr;
+}
+
+Uint32 WMPVPlayer::sdlSubsystems() const
+{
+    // 无窗口模式只用 SDL 的事件队列驱动播放器线程
+    return m_headless ? (SDL_INIT_EVENTS | SDL_INIT_TIMER) : (SDL_INIT_VIDEO | SDL_INIT_TIMER);
 }
 
-void WMPVPlayer::threadFunc()
+bool WMPVPlayer::startup()
 {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point last = Clock::now();
+    // 记录一个阶段的耗时并开始下一个阶段
+    auto phaseDone = [this, &last](double StartupTimings::* field) {
+        const Clock::time_point now = Clock::now();
+        std::lock_guard<std::mutex> lk(m_timingMx);
+        m_startup.*field = std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+    };
+    m_swFrames = 0;
+
     // 不要让 SDL 接管信号，避免和 mpv/你的程序冲突
     SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
     SDL_SetHint(SDL_HINT_WINDOWS_DPI_AWARENESS, "permonitorv2");
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) < 0) {
+    if (SDL_Init(m_headless ? sdlSubsystems() : (SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) < 0) {
         std::fprintf(stderr, "SDL init failed: %s\n", SDL_GetError());
-        return;
+        return false;
     }
 
     // SDL 自定义事件
     m_evRenderUpdate = SDL_RegisterEvents(1);
     m_evMpvEvents = SDL_RegisterEvents(1);
-    m_evWake = SDL_RegisterEvents(1);
-    if (m_evRenderUpdate == (Uint32)-1 || m_evMpvEvents == (Uint32)-1 || m_evWake == (Uint32)-1) {
+    const Uint32 wake = SDL_RegisterEvents(1);
+    if (m_evRenderUpdate == (Uint32)-1 || m_evMpvEvents == (Uint32)-1 || wake == (Uint32)-1) {
         std::fprintf(stderr, "SDL_RegisterEvents failed\n");
-        return;
+        return false;
     }
+    m_evWake.store(wake);
+    phaseDone(&StartupTimings::sdl_init_ms);
 
     if (!createMpv()) {
         destroyMpv();
-        SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_TIMER);
-        return;
+        SDL_QuitSubSystem(sdlSubsystems());
+        return false;
     }
+    phaseDone(&StartupTimings::mpv_init_ms);
 
-    if (!createWindow(m_title, m_defaultW, m_defaultH)) {
+    // 预热时还没有流，窗口先隐藏，Play() 时再显示。Play() 先置 m_showWindow 再读 m_evWake：
+    // 它没读到唤醒事件时，这里一定能看到 m_showWindow
+    bool hidden = false;
+    {
+        std::lock_guard<std::mutex> lk(m_loadMx);
+        hidden = m_url.empty() && !m_showWindow.load();
+    }
+    if (!m_headless && !createWindow(m_title, m_defaultW, m_defaultH, hidden)) {
         destroyWindow();
         destroyMpv();
-        SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_TIMER);
-        return;
+        SDL_QuitSubSystem(sdlSubsystems());
+        return false;
+    }
+    phaseDone(&StartupTimings::window_ms);
+
+    if (!createRenderContext()) {
+        destroyWindow();
+        destroyMpv();
+        SDL_QuitSubSystem(sdlSubsystems());
+        return false;
     }
+    phaseDone(&StartupTimings::render_context_ms);
+
+    applyFillMode();
+    return true;
+}
 
-	applyFillMode();
+void WMPVPlayer::markPlayRequested()
+{
+    std::lock_guard<std::mutex> lk(m_timingMx);
+    m_playAt = std::chrono::steady_clock::now();
+    m_startup.play_to_load_ms = 0.0;
+    m_startup.play_to_file_loaded_ms = 0.0;
+    m_startup.play_to_first_frame_ms = 0.0;
+    m_awaitLoad = m_awaitFileLoaded = m_awaitFirstFrame = true;
+}
 
-    //const char* cmd[] = { "loadfile", m_url.c_str(), nullptr };
-    //mpv_command_async(m_mpv, 0, cmd);
+void WMPVPlayer::notePlayPhase(double StartupTimings::* field, bool& pending)
+{
+    std::lock_guard<std::mutex> lk(m_timingMx);
+    if (!pending)
+        return;
+    pending = false;
+    m_startup.*field = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - m_playAt).count();
+}
 
-    //if (m_startSeconds > 0.0) {
-    //    double pos = m_startSeconds;
-    //    mpv_set_property_async(m_mpv, 0, "time-pos", MPV_FORMAT_DOUBLE, &pos);
-    //}
+void WMPVPlayer::loadLocked(const std::string& url, double startSeconds)
+{
+    notePlayPhase(&StartupTimings::play_to_load_ms, m_awaitLoad);
+    const std::string src = sourceUrl(url);
 
-    if (m_startSeconds > 0.0) {
+    // replace 会清空播放列表（包括预加载项）
+    if (startSeconds > 0.0) {
         char start_opt[64];
         // 按 mpv 语法来，支持小数即可
-        snprintf(start_opt, sizeof(start_opt), "start=%f", m_startSeconds);
+        snprintf(start_opt, sizeof(start_opt), "start=%f", startSeconds);
 
         const char* cmd[] = {
             "loadfile",
-            m_url.c_str(),
+            src.c_str(),
             "replace",   // flags
             "-1",        // index: -1 表示不特别指定，只是占位，兼容 0.38+ 的签名
             start_opt,   // per-file options：这里就带上 start
@@ -250,95 +1333,115 @@ void WMPVPlayer::threadFunc()
     else {
         const char* cmd[] = {
             "loadfile",
-            m_url.c_str(),
+            src.c_str(),
+            "replace",
             nullptr
         };
         mpv_command_async(m_mpv, 0, cmd);
     }
+}
 
-    while (!m_quit.load()) {
-        SDL_Event e{};
-        if (SDL_WaitEvent(&e) != 1) {
-            std::fprintf(stderr, "SDL_WaitEvent error\n");
-            break;
-        }
+void WMPVPlayer::appendLocked(const std::string& url)
+{
+    // 播放列表里只保留当前项 + 一个预加载项；prefetch-playlist 会提前打开它
+    const char* clear[] = { "playlist-clear", nullptr };
+    mpv_command_async(m_mpv, 0, clear);
+    const std::string src = sourceUrl(url);
+    const char* cmd[] = { "loadfile", src.c_str(), "append", nullptr };
+    mpv_command_async(m_mpv, 0, cmd);
+}
 
-        bool need_redraw = false;
+void WMPVPlayer::resetFileState()
+{
+    file_loaded.store(false);
+    std::lock_guard<std::mutex> lk(m_seekMx);
+    m_seekInFlight = false;
+    m_seekPending = false;
+}
 
-        switch (e.type) {
-        case SDL_WINDOWEVENT:
-            if (e.window.event == SDL_WINDOWEVENT_EXPOSED ||
-                e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
-                need_redraw = true;
-
-            if (e.window.event == SDL_WINDOWEVENT_CLOSE) {
-                if (IsEventForWindow(e, m_win)) {
-                    m_quit = true;
-                    
-                    std::thread([this] { 
-                        TogglePause();
-                        std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-                        if (m_onDisconnect) {
-                            m_onDisconnect();
-                        }
-                    }).detach();
+void WMPVPlayer::handleEvent(const SDL_Event& e, bool& need_redraw)
+{
+    switch (e.type) {
+    case SDL_WINDOWEVENT:
+        if (e.window.event == SDL_WINDOWEVENT_EXPOSED ||
+            e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+            need_redraw = true;
+
+        // 换到别的显示器后刷新率可能变化
+        if (e.window.event == SDL_WINDOWEVENT_MOVED && IsEventForWindow(e, m_win))
+            updateRefreshRate();
+
+        if (e.window.event == SDL_WINDOWEVENT_CLOSE) {
+            if (IsEventForWindow(e, m_win)) {
+                m_quit = true;
+                TogglePause();
 
+                // 2 秒后在回调线程上通知断开，不再为此起 detach 线程。
+                // 拷贝一份回调，播放器先被销毁也不受影响
+                if (m_onDisconnect) {
+                    OnDisconnect onDisconnect = m_onDisconnect;
+                    WBackgroundRunner::Shared().PostCallback(onDisconnect, 2000);
                 }
             }
-            break;
-        case SDL_KEYDOWN:
-            if (e.key.keysym.sym == SDLK_SPACE) {
-                TogglePause();
-            }
-            else if (e.key.keysym.sym == SDLK_RIGHT) {
-                SeekRelative(+5.0);
-            }
-            else if (e.key.keysym.sym == SDLK_LEFT) {
-                SeekRelative(-5.0);
-            }
-            else if (e.key.keysym.sym == SDLK_UP) {
-                AddVolume(+5);
-            }
-            else if (e.key.keysym.sym == SDLK_DOWN) {
-                AddVolume(-5);
-            }
-            break;
-        default:
-            if (e.type == m_evWake) {
-                // 外部唤醒：可能是 Stop() 或 SetFillMode()
-                if (m_mpv && m_renderReady) 
-                    applyFillMode();
-            }
-            // 普通事件：处理 mpv 事件队列
-            if (e.type == m_evMpvEvents) {
-                handleMpvEvents();
+        }
+        break;
+    case SDL_KEYDOWN:
+        if (e.key.keysym.sym == SDLK_SPACE) {
+            TogglePause();
+        }
+        else if (e.key.keysym.sym == SDLK_RIGHT) {
+            SeekRelative(+5.0);
+        }
+        else if (e.key.keysym.sym == SDLK_LEFT) {
+            SeekRelative(-5.0);
+        }
+        else if (e.key.keysym.sym == SDLK_UP) {
+            AddVolume(+5);
+        }
+        else if (e.key.keysym.sym == SDLK_DOWN) {
+            AddVolume(-5);
+        }
+        break;
+    default:
+        if (e.type == m_evWake.load()) {
+            // 外部唤醒：可能是 Stop()、Play()、SetFillMode() 或 SetPresentMode()
+            if (m_showWindow.exchange(false) && m_win)
+                SDL_ShowWindow(m_win);
+            if (m_mpv && m_cacheDirty.exchange(false))
+                applyCacheBudget();
+            if (m_mpv && m_renderReady) {
+                applyFillMode();
+                if (m_presentMode.load() != m_appliedPresentMode)
+                    applyPresentMode();
             }
-            // 渲染更新：需要调用 update 拉取 flags
-            if (e.type == m_evRenderUpdate) {
-                if (m_renderReady) {
-                    uint64_t flags = mpv_render_context_update(m_mpvGL);
-                    if (flags & MPV_RENDER_UPDATE_FRAME)
-                        need_redraw = true;
+        }
+        // 普通事件：处理 mpv 事件队列
+        if (e.type == m_evMpvEvents) {
+            handleMpvEvents();
+        }
+        // 渲染更新：需要调用 update 拉取 flags
+        if (e.type == m_evRenderUpdate) {
+            if (m_renderReady) {
+                uint64_t flags = mpv_render_context_update(m_mpvGL);
+                if (flags & MPV_RENDER_UPDATE_FRAME) {
+                    if (!m_frameWaiting) {
+                        m_frameWaiting = true;
+                        m_frameReadyAt = std::chrono::steady_clock::now();
+                    }
+                    need_redraw = true;
                 }
             }
- 
-            break;
-        }
-
-        if (need_redraw && m_renderReady) {
-            renderFrame();
         }
+ 
+        break;
     }
-
-    destroyWindow();
-    destroyMpv();
-    SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_TIMER);
 }
 
-bool WMPVPlayer::createWindow(const std::string& title, int w, int h)
+bool WMPVPlayer::createWindow(const std::string& title, int w, int h, bool hidden)
 {
     m_win = SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                             w, h, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+                             w, h, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE |
+                             (hidden ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN));
     if (!m_win) {
         std::fprintf(stderr, "CreateWindow failed: %s\n", SDL_GetError());
         return false;
@@ -350,8 +1453,11 @@ bool WMPVPlayer::createWindow(const std::string& title, int w, int h)
         return false;
     }
     SDL_GL_MakeCurrent(m_win, m_gl);
-    SDL_GL_SetSwapInterval(0); // 关 vsync（你也可设 1）
+    return true;
+}
 
+bool WMPVPlayer::createRenderContext()
+{
     // Render API：绑定到当前 GL 上下文
     mpv_opengl_init_params gl_init{};
     gl_init.get_proc_address = &WMPVPlayer::getProcAddr;
@@ -363,8 +1469,14 @@ bool WMPVPlayer::createWindow(const std::string& title, int w, int h)
         { MPV_RENDER_PARAM_ADVANCED_CONTROL,       &adv },
         { MPV_RENDER_PARAM_INVALID,                nullptr }
     };
+    // 无窗口模式：软件渲染，不需要 GL
+    mpv_render_param swParams[] = {
+        { MPV_RENDER_PARAM_API_TYPE,               (void*)MPV_RENDER_API_TYPE_SW },
+        { MPV_RENDER_PARAM_ADVANCED_CONTROL,       &adv },
+        { MPV_RENDER_PARAM_INVALID,                nullptr }
+    };
 
-    if (mpv_render_context_create(&m_mpvGL, m_mpv, params) < 0) {
+    if (mpv_render_context_create(&m_mpvGL, m_mpv, m_headless ? swParams : params) < 0) {
         std::fprintf(stderr, "mpv_render_context_create failed\n");
         return false;
     }
@@ -373,9 +1485,45 @@ bool WMPVPlayer::createWindow(const std::string& title, int w, int h)
     mpv_render_context_set_update_callback(m_mpvGL, &WMPVPlayer::onMpvRender, this);
 
     m_renderReady = true;
+    applyPresentMode();
     return true;
 }
 
+void WMPVPlayer::applyPresentMode()
+{
+    const PresentMode mode = m_presentMode.load();
+    m_appliedPresentMode = mode;
+
+    // Immediate 关 vsync；另两种开 vsync 并回报 swap。无窗口模式没有 GL，也没有显示器可同步；
+    // 挂在 host 上时多个窗口轮流 swap，不能每个都等 vblank，由 host 统一限速
+    if (m_host && !m_headless) {
+        SDL_GL_SetSwapInterval(0);
+    }
+    else if (!m_headless) {
+        if (mode == PresentMode::Immediate) {
+            SDL_GL_SetSwapInterval(0);
+        }
+        else if (SDL_GL_SetSwapInterval(1) != 0) {
+            std::fprintf(stderr, "SDL_GL_SetSwapInterval(1) failed: %s\n", SDL_GetError());
+        }
+    }
+
+    // VSync 下让 mpv 按显示器节奏重采样音频（display-sync），其余按音频时钟
+    const char* videoSync = (!m_headless && !m_host && mode == PresentMode::VSync) ? "display-resample" : "audio";
+    mpv_set_property_async(m_mpv, 0, "video-sync", MPV_FORMAT_STRING, &videoSync);
+
+    updateRefreshRate();
+}
+
+void WMPVPlayer::updateRefreshRate()
+{
+    SDL_DisplayMode dm{};
+    const int display = m_win ? SDL_GetWindowDisplayIndex(m_win) : -1;
+    const double hz = (display >= 0 && SDL_GetCurrentDisplayMode(display, &dm) == 0) ? (double)dm.refresh_rate : 0.0;
+    std::lock_guard<std::mutex> lk(m_timingMx);
+    m_timings.refresh_hz = hz;
+}
+
 void WMPVPlayer::destroyWindow()
 {
     if (m_mpvGL) {
@@ -399,6 +1547,10 @@ void WMPVPlayer::renderFrame()
 {
     if (!m_renderReady) 
         return;
+    if (m_headless) {
+        renderSoftware();
+        return;
+    }
 
     // 必须保证当前 GL 上下文是我们的
     SDL_GL_MakeCurrent(m_win, m_gl);
@@ -416,14 +1568,114 @@ void WMPVPlayer::renderFrame()
     fbo.w = w;
     fbo.h = h;
 
+    // LowLatency：不等 mpv 的目标显示时间，有帧就画，由 vsync 限速
+    const PresentMode mode = m_appliedPresentMode;
     int flip = 1;
+    int block = (mode == PresentMode::LowLatency || m_host) ? 0 : 1;
     mpv_render_param rp[] = {
-        { MPV_RENDER_PARAM_OPENGL_FBO, &fbo },
-        { MPV_RENDER_PARAM_FLIP_Y,     &flip },
-        { MPV_RENDER_PARAM_INVALID,    nullptr }
+        { MPV_RENDER_PARAM_OPENGL_FBO,             &fbo },
+        { MPV_RENDER_PARAM_FLIP_Y,                 &flip },
+        { MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME,  &block },
+        { MPV_RENDER_PARAM_INVALID,                nullptr }
     };
+
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point t0 = Clock::now();
     mpv_render_context_render(m_mpvGL, rp);
+    const Clock::time_point t1 = Clock::now();
     SDL_GL_SwapWindow(m_win);
+    const Clock::time_point t2 = Clock::now();
+
+    // 告诉 mpv 实际上屏时间，它据此估计 vsync 并做 display-sync
+    if (mode != PresentMode::Immediate && !m_host)
+        mpv_render_context_report_swap(m_mpvGL);
+
+    noteFrameTiming(std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                    std::chrono::duration<double, std::milli>(t2 - t1).count(), t2);
+}
+
+void WMPVPlayer::renderSoftware()
+{
+    const HeadlessOptions& o = m_headlessOpts;
+    SoftwareFrame frame;
+    frame.width = o.width;
+    frame.height = o.height;
+
+    std::shared_ptr<uint8_t> storage;
+    uint8_t* dst = o.target;
+    if (dst) {
+        frame.stride = o.target_stride ? o.target_stride : (size_t)o.width * 4;
+    }
+    else {
+        storage = m_swPool->Acquire();
+        dst = storage.get();
+        frame.stride = ((size_t)o.width * 4 + 63) & ~size_t(63);
+    }
+
+    int size[2] = { o.width, o.height };
+    char format[] = "rgb0";
+    mpv_render_param rp[] = {
+        { MPV_RENDER_PARAM_SW_SIZE,    size },
+        { MPV_RENDER_PARAM_SW_FORMAT,  format },
+        { MPV_RENDER_PARAM_SW_STRIDE,  &frame.stride },
+        { MPV_RENDER_PARAM_SW_POINTER, dst },
+        { MPV_RENDER_PARAM_INVALID,    nullptr }
+    };
+
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point t0 = Clock::now();
+    const int rc = mpv_render_context_render(m_mpvGL, rp);
+    const Clock::time_point t1 = Clock::now();
+    if (rc < 0) {
+        std::fprintf(stderr, "mpv software render failed: %s\n", mpv_error_string(rc));
+        return;
+    }
+
+    InfoState info;
+    readInfo(info);
+    frame.data = dst;
+    frame.index = m_swFrames++;
+    frame.position = info.position;
+    frame.render_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    frame.storage = storage;
+    if (m_onFrame)
+        m_onFrame(frame);
+
+    noteFrameTiming(frame.render_ms, 0.0, t1);
+}
+
+void WMPVPlayer::noteFrameTiming(double renderMs, double swapMs, std::chrono::steady_clock::time_point presentedAt)
+{
+    const PresentMode mode = m_appliedPresentMode;
+    double latencyMs = 0.0;
+    const bool hasLatency = m_frameWaiting;
+    if (m_frameWaiting) {
+        latencyMs = std::chrono::duration<double, std::milli>(presentedAt - m_frameReadyAt).count();
+        m_frameWaiting = false;
+    }
+
+    notePlayPhase(&StartupTimings::play_to_first_frame_ms, m_awaitFirstFrame);
+
+    std::lock_guard<std::mutex> lk(m_timingMx);
+    FrameTimings& t = m_timings;
+    // 指数滑动平均，约 32 帧的窗口
+    const double alpha = t.frames == 0 ? 1.0 : 1.0 / 32.0;
+    t.avg_render_ms += (renderMs - t.avg_render_ms) * alpha;
+    t.avg_swap_ms += (swapMs - t.avg_swap_ms) * alpha;
+    t.max_render_ms = std::max(t.max_render_ms, renderMs);
+    t.max_swap_ms = std::max(t.max_swap_ms, swapMs);
+    t.last_render_ms = renderMs;
+    t.last_swap_ms = swapMs;
+    t.last_latency_ms = latencyMs;
+    if (hasLatency) {
+        // 只统计确实等到了 mpv 新帧通知的帧
+        t.avg_latency_ms += (latencyMs - t.avg_latency_ms) * (t.max_latency_ms == 0.0 ? 1.0 : 1.0 / 32.0);
+        t.max_latency_ms = std::max(t.max_latency_ms, latencyMs);
+    }
+    ++t.frames;
+    // 帧就绪后超过一个半刷新周期才上屏，说明错过了一个 vblank
+    if (mode != PresentMode::Immediate && t.refresh_hz > 0.0 && latencyMs > 1500.0 / t.refresh_hz)
+        ++t.vsync_misses;
 }
 
 bool WMPVPlayer::IsEventForWindow(const SDL_Event& e, SDL_Window* window)
@@ -437,16 +1689,56 @@ bool WMPVPlayer::createMpv()
 {
     m_mpv = mpv_create();
     if (!m_mpv) { std::fprintf(stderr, "mpv_create failed\n"); return false; }
+    // 记下 mpv 的默认预读秒数，未指定 readahead_secs 时沿用
+    if (char* s = mpv_get_property_string(m_mpv, "demuxer-readahead-secs")) {
+        m_defaultReadahead = s;
+        mpv_free(s);
+    }
+    if (char* s = mpv_get_property_string(m_mpv, "cache-secs")) {
+        m_defaultCacheSecs = s;
+        mpv_free(s);
+    }
+    if (m_defaultReadahead.empty() || m_defaultCacheSecs.empty())
+        m_defaultReadahead.clear();
+    // 参与进程级缓存分配，destroyMpv() 时退出
+    registerCacheUser(this, true);
 
     // 强制 Render API 模式，不自建窗口
     mpv_set_option_string(m_mpv, "config", "no");
+    if (m_headless) {
+        // 无窗口模式：不出声，硬解必须拷回内存；需要时降帧率
+        mpv_set_option_string(m_mpv, "ao", "null");
+        if (m_headlessOpts.fps > 0.0) {
+            char vf[64];
+            std::snprintf(vf, sizeof(vf), "fps=%g", m_headlessOpts.fps);
+            mpv_set_option_string(m_mpv, "vf", vf);
+        }
+    }
     mpv_set_option_string(m_mpv, "vo", "libmpv");
-    // 可选优化
-    mpv_set_option_string(m_mpv, "hwdec", "auto-safe");
     mpv_set_option_string(m_mpv, "osc", "no");
-    mpv_set_option_string(m_mpv, "user-agent", "AppleCoreMedia/1.0");
-    mpv_set_option_string(m_mpv, "cache", "yes");
-    mpv_set_option_string(m_mpv, "force-seekable", "yes");
+    // 有预加载项时提前打开下一项，切换/自然播完时无缝衔接
+    mpv_set_option_string(m_mpv, "prefetch-playlist", "yes");
+    mpv_set_option_string(m_mpv, "gapless-audio", "weak");
+
+    // 播放档位：取一份快照，整组在 mpv_initialize 前生效
+    PlaybackOptions options;
+    {
+        std::lock_guard<std::mutex> lk(m_optionsMx);
+        options = m_options;
+    }
+    std::vector<std::pair<std::string, std::string>> list;
+    BuildOptionList(options, list);
+    for (const auto& kv : list) {
+        if (mpv_set_option_string(m_mpv, kv.first.c_str(), kv.second.c_str()) < 0)
+            std::fprintf(stderr, "mpv option %s=%s rejected\n", kv.first.c_str(), kv.second.c_str());
+    }
+    if (m_headless && options.hwdec != "no")
+        mpv_set_option_string(m_mpv, "hwdec", "auto-copy-safe");
+    // 缓存预算用分到的值覆盖
+    cacheBudgetOptions(list);
+    for (const auto& kv : list)
+        mpv_set_option_string(m_mpv, kv.first.c_str(), kv.second.c_str());
+    m_cacheDirty.store(false);
 
     if (mpv_initialize(m_mpv) < 0) {
         std::fprintf(stderr, "mpv_initialize failed\n");
@@ -456,18 +1748,12 @@ bool WMPVPlayer::createMpv()
     // 绑定事件唤醒（线程安全，只发 SDL 事件）
     mpv_set_wakeup_callback(m_mpv, &WMPVPlayer::onMpvEvents, this);
 
-    mpv_observe_property(m_mpv, 0, "time-pos", MPV_FORMAT_DOUBLE);
-    mpv_observe_property(m_mpv, 0, "duration", MPV_FORMAT_DOUBLE);
-    mpv_observe_property(m_mpv, 0, "pause", MPV_FORMAT_FLAG);
-    mpv_observe_property(m_mpv, 0, "speed", MPV_FORMAT_DOUBLE);
-    mpv_observe_property(m_mpv, 0, "seekable", MPV_FORMAT_FLAG);
-    mpv_observe_property(m_mpv, 0, "dwidth", MPV_FORMAT_INT64);
-    mpv_observe_property(m_mpv, 0, "dheight", MPV_FORMAT_INT64);
-    mpv_observe_property(m_mpv, 0, "video-codec", MPV_FORMAT_STRING);
-    mpv_observe_property(m_mpv, 0, "audio-codec", MPV_FORMAT_STRING);
-    mpv_observe_property(m_mpv, 0, "cache-buffering-state", MPV_FORMAT_INT64);
-    mpv_observe_property(m_mpv, 0, "cache-buffering-percent", MPV_FORMAT_INT64);
-    mpv_observe_property(m_mpv, 0, "demuxer-cache-state", MPV_FORMAT_NODE);
+    // 进程内内存流：mpv 直接从 WMPVMemoryStream 的环里读
+    if (mpv_stream_cb_add_ro(m_mpv, kMemoryStreamProtocol, this, &WMPVPlayer::onStreamOpen) < 0)
+        std::fprintf(stderr, "mpv_stream_cb_add_ro(%s) failed\n", kMemoryStreamProtocol);
+
+    for (const ObservedProperty& prop : kObservedProperties)
+        mpv_observe_property(m_mpv, prop.id, prop.name, prop.format);
 
     return true;
 }
@@ -475,6 +1761,7 @@ bool WMPVPlayer::createMpv()
 void WMPVPlayer::destroyMpv()
 {
     if (m_mpv) {
+        registerCacheUser(this, false);
         mpv_terminate_destroy(m_mpv);
         m_mpv = nullptr;
     }
@@ -489,125 +1776,452 @@ void WMPVPlayer::handleMpvEvents()
 
         // 这里可以根据需要处理更多事件
         switch (ev->event_id) {
-        case MPV_EVENT_FILE_LOADED:
+        case MPV_EVENT_FILE_LOADED: {
+            file_loaded.store(true);
+            notePlayPhase(&StartupTimings::play_to_file_loaded_ms, m_awaitFileLoaded);
+
             // 初始化一次快照
+            int seekable = 0, paused = 0;
+            double pos = 0.0, dur = 0.0, speed = 1.0;
+            int64_t dw = 0, dh = 0;
+            mpv_get_property(m_mpv, "time-pos", MPV_FORMAT_DOUBLE, &pos);
+            mpv_get_property(m_mpv, "duration", MPV_FORMAT_DOUBLE, &dur);
+            mpv_get_property(m_mpv, "seekable", MPV_FORMAT_FLAG, &seekable);
+            mpv_get_property(m_mpv, "pause", MPV_FORMAT_FLAG, &paused);
+            mpv_get_property(m_mpv, "speed", MPV_FORMAT_DOUBLE, &speed);
+            mpv_get_property(m_mpv, "dwidth", MPV_FORMAT_INT64, &dw);
+            mpv_get_property(m_mpv, "dheight", MPV_FORMAT_INT64, &dh);
+            m_speedRaw.store(speed, std::memory_order_release);
+            updateInfo([&](InfoState& info) {
+                info.position = pos;
+                info.duration = dur;
+                info.seekable = !!seekable;
+                info.paused = !!paused;
+                info.rate = speed;
+                info.width = (int)dw;
+                info.height = (int)dh;
+            });
+
+            // 加载前收到的 seek（快照里已有 duration，可以夹紧）
             {
-                std::lock_guard<std::mutex> lk(m_infoMx);
-
-                file_loaded.store(true);
-
-                if (have_pending_seek.exchange(false)) {
-                    double pos = pending_seek_pos.load();
-                    mpv_set_property_async(m_mpv, 0, "time-pos", MPV_FORMAT_DOUBLE, &pos);
+                std::lock_guard<std::mutex> lk(m_seekMx);
+                issueSeekLocked();
+            }
+            break;
+        }
+        case MPV_EVENT_END_FILE: {
+            // 自然播完会自动进入预加载项，它就成了当前项
+            auto* end = (mpv_event_end_file*)ev->data;
+            if (end && end->reason == MPV_END_FILE_REASON_EOF) {
+                std::lock_guard<std::mutex> lk(m_loadMx);
+                if (!m_preloadUrl.empty()) {
+                    m_url = m_preloadUrl;
+                    m_startSeconds = 0.0;
+                    m_preloadUrl.clear();
                 }
-
-                int seekable = 0, paused = 0;
-                double pos = 0.0, dur = 0.0, speed = 1.0;
-                int64_t dw = 0, dh = 0;
-                mpv_get_property(m_mpv, "time-pos", MPV_FORMAT_DOUBLE, &pos);
-                mpv_get_property(m_mpv, "duration", MPV_FORMAT_DOUBLE, &dur);
-                mpv_get_property(m_mpv, "seekable", MPV_FORMAT_FLAG, &seekable);
-                mpv_get_property(m_mpv, "pause", MPV_FORMAT_FLAG, &paused);
-                mpv_get_property(m_mpv, "speed", MPV_FORMAT_DOUBLE, &speed);
-                mpv_get_property(m_mpv, "dwidth", MPV_FORMAT_INT64, &dw);
-                mpv_get_property(m_mpv, "dheight", MPV_FORMAT_INT64, &dh);
-                m_speedRaw.store(speed, std::memory_order_release);
-                m_info.position = pos;
-                m_info.duration = dur;
-                m_info.seekable = !!seekable;
-                m_info.paused = !!paused;
-                m_info.rate = speed;
-                m_info.width = (int)dw;
-                m_info.height = (int)dh;
+            }
+            break;
+        }
+        case MPV_EVENT_COMMAND_REPLY:
+            if (ev->reply_userdata == kReplySeek) {
+                // 上一个 seek 已被 mpv 接收，发出期间合并的请求
+                std::lock_guard<std::mutex> lk(m_seekMx);
+                m_seekInFlight = false;
+                issueSeekLocked();
+            }
+            else if (ev->reply_userdata == kReplyScreenshot) {
+                auto* cmd = (mpv_event_command*)ev->data;
+                deliverThumbnail(ev->error, cmd ? &cmd->result : nullptr);
             }
             break;
         case MPV_EVENT_PROPERTY_CHANGE: {
             auto* p = (mpv_event_property*)ev->data;
-            if (!p || !p->name) break;
+            if (p)
+                handlePropertyChange(ev->reply_userdata, p);
+            break;
+        }
+        default:
+            break;
+        }
+    }
 
-            std::lock_guard<std::mutex> lk(m_infoMx);
-            if (std::strcmp(p->name, "time-pos") == 0 && p->format == MPV_FORMAT_DOUBLE) {
-                m_info.position = *(double*)p->data;
-            }
-            else if (std::strcmp(p->name, "duration") == 0 && p->format == MPV_FORMAT_DOUBLE) {
-                m_info.duration = *(double*)p->data;
-            }
-            else if (std::strcmp(p->name, "pause") == 0 && p->format == MPV_FORMAT_FLAG) {
-                bool paused = !!*(int*)p->data;
-                m_info.paused = paused;
-                double raw = m_speedRaw.load(std::memory_order_acquire);
-                m_info.rate = paused ? 0.0 : raw;        // 统一用有效速率
-            }
-            else if (std::strcmp(p->name, "speed") == 0 && p->format == MPV_FORMAT_DOUBLE) {
-                double raw = *(double*)p->data;
-                m_speedRaw.store(raw, std::memory_order_release);
-                m_info.rate = m_info.paused ? 0.0 : raw; // 有效速率
-            }
-            else if (std::strcmp(p->name, "seekable") == 0 && p->format == MPV_FORMAT_FLAG) {
-                m_info.seekable = !!*(int*)p->data;
-            }
-            else if (std::strcmp(p->name, "dwidth") == 0 && p->format == MPV_FORMAT_INT64) {
-                m_info.width = (int)*(int64_t*)p->data;
-            }
-            else if (std::strcmp(p->name, "dheight") == 0 && p->format == MPV_FORMAT_INT64) {
-                m_info.height = (int)*(int64_t*)p->data;
-            }
-            else if (std::strcmp(p->name, "video-codec") == 0 && p->format == MPV_FORMAT_STRING) {
-                m_info.vcodec = (const char*)p->data;
-            }
-            else if (std::strcmp(p->name, "audio-codec") == 0 && p->format == MPV_FORMAT_STRING) {
-                m_info.acodec = (const char*)p->data;
+    // 播放中 time-pos 等属性持续变化，这里顺带按间隔采样，不额外起定时器
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - m_telemetryLast >= std::chrono::milliseconds(kTelemetryIntervalMs)) {
+        m_telemetryLast = now;
+        sampleTelemetry(now);
+    }
+}
+
+bool WMPVPlayer::RequestThumbnail(int width, int height, ThumbnailCallback done)
+{
+    if (!m_mpv || !done || (width <= 0 && height <= 0))
+        return false;
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lk(m_thumbMx);
+        if (m_thumbInFlight)
+            return false;
+        if (m_thumbMaxRate > 0.0 && m_thumbLast.time_since_epoch().count() != 0 &&
+            std::chrono::duration<double>(now - m_thumbLast).count() < 1.0 / m_thumbMaxRate)
+            return false;
+        m_thumbInFlight = true;
+        m_thumbLast = now;
+        m_thumbW = width;
+        m_thumbH = height;
+        m_thumbDone = std::move(done);
+    }
+
+    // 只要视频本身，mpv 不用再叠加字幕/OSD
+    const char* args[] = { "screenshot-raw", "video", nullptr };
+    if (mpv_command_async(m_mpv, kReplyScreenshot, args) < 0) {
+        std::lock_guard<std::mutex> lk(m_thumbMx);
+        m_thumbInFlight = false;
+        m_thumbDone = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void WMPVPlayer::SetThumbnailMaxRate(double perSecond)
+{
+    std::lock_guard<std::mutex> lk(m_thumbMx);
+    m_thumbMaxRate = perSecond;
+}
+
+void WMPVPlayer::deliverThumbnail(int error, const mpv_node* result)
+{
+    ThumbnailCallback done;
+    int dw = 0, dh = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_thumbMx);
+        done = std::move(m_thumbDone);
+        m_thumbDone = nullptr;
+        m_thumbInFlight = false;
+        dw = m_thumbW;
+        dh = m_thumbH;
+    }
+    if (!done)
+        return;
+    // 这里在播放器线程上：只做必须趁 data 有效时做的拷贝/缩小，回调交给回调线程
+    auto post = [&done](const Thumbnail& t) {
+        WBackgroundRunner::Shared().PostCallback([done, t] { done(t); });
+    };
+
+    Thumbnail thumb;
+    InfoState info;
+    readInfo(info);
+    thumb.position = info.position;
+
+    // 结果是 {w, h, stride, format, data} 的 map，data 在下一次 mpv_wait_event 前有效
+    const mpv_node* w = FindNode(result, "w");
+    const mpv_node* h = FindNode(result, "h");
+    const mpv_node* stride = FindNode(result, "stride");
+    const mpv_node* format = FindNode(result, "format");
+    const mpv_node* data = FindNode(result, "data");
+    static const char* const kFormats[] = { "bgr0", "bgra", "rgba", "rgb0" };
+    const char* fmt = nullptr;
+    if (format && format->format == MPV_FORMAT_STRING) {
+        for (const char* f : kFormats) {
+            if (std::strcmp(format->u.string, f) == 0)
+                fmt = f;
+        }
+    }
+    if (error < 0 || !w || !h || !stride || !data || !fmt ||
+        w->format != MPV_FORMAT_INT64 || h->format != MPV_FORMAT_INT64 ||
+        stride->format != MPV_FORMAT_INT64 || data->format != MPV_FORMAT_BYTE_ARRAY) {
+        post(thumb);
+        return;
+    }
+
+    const int sw = (int)w->u.int64;
+    const int sh = (int)h->u.int64;
+    const size_t sstride = (size_t)stride->u.int64;
+    if (sw <= 0 || sh <= 0 || data->u.ba->size < sstride * (size_t)sh) {
+        post(thumb);
+        return;
+    }
+    if (dw <= 0)
+        dw = std::max(1, (int)((int64_t)sw * dh / sh));
+    if (dh <= 0)
+        dh = std::max(1, (int)((int64_t)sh * dw / sw));
+    // 只缩小，不放大
+    dw = std::min(dw, sw);
+    dh = std::min(dh, sh);
+
+    const size_t dstride = ((size_t)dw * 4 + 63) & ~size_t(63);
+    if (!m_thumbPool || m_thumbPool->bytes != dstride * dh)
+        m_thumbPool = std::make_shared<SwBufferPool>(dstride * dh, 2);
+    std::shared_ptr<uint8_t> buf = m_thumbPool->Acquire();
+    Downscale4(static_cast<const uint8_t*>(data->u.ba->data), sw, sh, sstride, buf.get(), dw, dh, dstride);
+
+    thumb.data = buf.get();
+    thumb.width = dw;
+    thumb.height = dh;
+    thumb.stride = dstride;
+    thumb.format = fmt;
+    thumb.storage = buf;
+    post(thumb);
+}
+
+void WMPVPlayer::sampleTelemetry(std::chrono::steady_clock::time_point now)
+{
+    InfoState info;
+    readInfo(info);
+
+    TelemetrySample s = m_telemetryCur;
+    s.time_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    s.position = info.position;
+    s.cache_duration = info.cache_duration;
+    s.fw_bytes = info.fw_bytes;
+    s.buffering_state = info.buffering_state;
+    s.buffering_percent = info.buffering_percent;
+
+    uint64_t words[kTelemetryWords] = {};
+    std::memcpy(words, &s, sizeof(s));
+
+    // 单写者：槽序号置奇数 -> 写内容 -> 置为 2*i+2，读者据此判断槽是否完整且仍是第 i 个样本
+    const uint64_t i = m_telemetryCount.load(std::memory_order_relaxed);
+    TelemetrySlot& slot = m_telemetry[i % kTelemetrySamples];
+    slot.seq.store(2 * i + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t w = 0; w < kTelemetryWords; ++w)
+        slot.words[w].store(words[w], std::memory_order_relaxed);
+    slot.seq.store(2 * i + 2, std::memory_order_release);
+    m_telemetryCount.store(i + 1, std::memory_order_release);
+}
+
+bool WMPVPlayer::readTelemetrySlot(uint64_t i, TelemetrySample& out) const
+{
+    const TelemetrySlot& slot = m_telemetry[i % kTelemetrySamples];
+    const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq != 2 * i + 2)
+        return false; // 正在写或已被更新的样本覆盖
+    uint64_t words[kTelemetryWords];
+    for (size_t w = 0; w < kTelemetryWords; ++w)
+        words[w] = slot.words[w].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq)
+        return false;
+    std::memcpy(&out, words, sizeof(out));
+    return true;
+}
+
+size_t WMPVPlayer::GetTelemetry(std::vector<TelemetrySample>& out) const
+{
+    out.clear();
+    const uint64_t count = m_telemetryCount.load(std::memory_order_acquire);
+    const uint64_t first = count > kTelemetrySamples ? count - kTelemetrySamples : 0;
+    out.reserve((size_t)(count - first));
+    TelemetrySample s;
+    for (uint64_t i = first; i < count; ++i) {
+        if (readTelemetrySlot(i, s))
+            out.push_back(s);
+    }
+    return out.size();
+}
+
+bool WMPVPlayer::GetLatestTelemetry(TelemetrySample& out) const
+{
+    const uint64_t count = m_telemetryCount.load(std::memory_order_acquire);
+    return count > 0 && readTelemetrySlot(count - 1, out);
+}
+
+WMPVPlayer::TelemetryAggregate WMPVPlayer::GetProcessTelemetry()
+{
+    TelemetryAggregate agg;
+    double fpsSum = 0.0;
+    int fpsCount = 0;
+
+    PlayerRegistry& reg = GetPlayerRegistry();
+    std::lock_guard<std::mutex> lk(reg.mx);
+    for (const WMPVPlayer* p : reg.players) {
+        ++agg.players;
+        TelemetrySample s;
+        if (!p->GetLatestTelemetry(s))
+            continue;
+        agg.frame_drops += s.frame_drops;
+        agg.decoder_drops += s.decoder_drops;
+        agg.vo_delayed += s.vo_delayed;
+        agg.max_abs_avsync = std::max(agg.max_abs_avsync, std::fabs(s.avsync));
+        agg.total_video_bitrate += s.video_bitrate;
+        agg.total_fw_bytes += s.fw_bytes;
+        if (s.vf_fps > 0.0) {
+            fpsSum += s.vf_fps;
+            ++fpsCount;
+        }
+        if (s.buffering_state > 0)
+            ++agg.buffering_players;
+    }
+    agg.avg_vf_fps = fpsCount > 0 ? fpsSum / fpsCount : 0.0;
+    return agg;
+}
+
+void WMPVPlayer::handlePropertyChange(uint64_t id, const mpv_event_property* p)
+{
+    // 属性暂不可用时 format 为 NONE，保留旧值；其余情况格式与 observe 时一致
+    if (p->format == MPV_FORMAT_NONE || !p->data)
+        return;
+
+    switch (id) {
+    case kPropTimePos: {
+        const double v = *(double*)p->data;
+        updateInfo([v](InfoState& info) { info.position = v; });
+        break;
+    }
+    case kPropDuration: {
+        const double v = *(double*)p->data;
+        updateInfo([v](InfoState& info) { info.duration = v; });
+        break;
+    }
+    case kPropPause: {
+        const bool paused = !!*(int*)p->data;
+        const double raw = m_speedRaw.load(std::memory_order_acquire);
+        updateInfo([paused, raw](InfoState& info) {
+            info.paused = paused;
+            info.rate = paused ? 0.0 : raw;        // 统一用有效速率
+        });
+        break;
+    }
+    case kPropSpeed: {
+        const double raw = *(double*)p->data;
+        m_speedRaw.store(raw, std::memory_order_release);
+        updateInfo([raw](InfoState& info) {
+            info.rate = info.paused ? 0.0 : raw; // 有效速率
+        });
+        break;
+    }
+    case kPropSeekable: {
+        const bool v = !!*(int*)p->data;
+        updateInfo([v](InfoState& info) { info.seekable = v; });
+        break;
+    }
+    case kPropDWidth: {
+        const int v = (int)*(int64_t*)p->data;
+        updateInfo([v](InfoState& info) { info.width = v; });
+        break;
+    }
+    case kPropDHeight: {
+        const int v = (int)*(int64_t*)p->data;
+        updateInfo([v](InfoState& info) { info.height = v; });
+        break;
+    }
+    case kPropVideoCodec: {
+        const char* v = *(const char**)p->data;
+        updateInfo([v](InfoState& info) { CopyString(info.vcodec, v); });
+        break;
+    }
+    case kPropAudioCodec: {
+        const char* v = *(const char**)p->data;
+        updateInfo([v](InfoState& info) { CopyString(info.acodec, v); });
+        break;
+    }
+    case kPropCacheBufferingState: {
+        const int v = (int)*(int64_t*)p->data; // 0/1
+        updateInfo([v](InfoState& info) { info.buffering_state = v; });
+        break;
+    }
+    case kPropCacheBufferingPercent: {
+        const int v = (int)*(int64_t*)p->data;
+        updateInfo([v](InfoState& info) { info.buffering_percent = v; });
+        break;
+    }
+    // 遥测：只在播放器线程更新，采样时整体写入环
+    case kPropFrameDropCount:
+        m_telemetryCur.frame_drops = *(int64_t*)p->data;
+        break;
+    case kPropDecoderFrameDropCount:
+        m_telemetryCur.decoder_drops = *(int64_t*)p->data;
+        break;
+    case kPropVoDelayedFrameCount:
+        m_telemetryCur.vo_delayed = *(int64_t*)p->data;
+        break;
+    case kPropAvsync:
+        m_telemetryCur.avsync = *(double*)p->data;
+        break;
+    case kPropEstimatedVfFps:
+        m_telemetryCur.vf_fps = *(double*)p->data;
+        break;
+    case kPropVideoBitrate:
+        m_telemetryCur.video_bitrate = *(double*)p->data;
+        break;
+    case kPropDemuxerCacheState: {
+        // 解析 node map（先解析到局部变量，发布时只做赋值）
+        auto* n = (mpv_node*)p->data;
+        if (n->format != MPV_FORMAT_NODE_MAP)
+            break;
+        bool hasDuration = false, hasFw = false, hasBw = false, hasRanges = false;
+        double cacheDuration = 0.0, fwBytes = 0.0, bwBytes = 0.0;
+        int rangeCount = 0;
+        double rangeStart[kMaxSeekableRanges], rangeEnd[kMaxSeekableRanges];
+        for (int i = 0; i < n->u.list->num; ++i) {
+            const char* key = n->u.list->keys[i];
+            mpv_node* val = n->u.list->values + i;
+            if (!key) continue;
+            if (std::strcmp(key, "cache-duration") == 0 && val->format == MPV_FORMAT_DOUBLE) {
+                cacheDuration = val->u.double_;
+                hasDuration = true;
             }
-            else if (std::strcmp(p->name, "cache-buffering-state") == 0 && p->format == MPV_FORMAT_INT64) {
-                m_info.buffering_state = (int)*(int64_t*)p->data; // 0/1
+            else if (std::strcmp(key, "fw-bytes") == 0 && val->format == MPV_FORMAT_INT64) {
+                fwBytes = (double)val->u.int64;
+                hasFw = true;
             }
-            else if (std::strcmp(p->name, "cache-buffering-percent") == 0 && p->format == MPV_FORMAT_INT64) {
-                m_info.buffering_percent = (int)*(int64_t*)p->data;
+            else if (std::strcmp(key, "bw-bytes") == 0 && val->format == MPV_FORMAT_INT64) {
+                bwBytes = (double)val->u.int64;
+                hasBw = true;
             }
-            else if (std::strcmp(p->name, "demuxer-cache-state") == 0 && p->format == MPV_FORMAT_NODE) {
-                // 解析 node map
-                auto* n = (mpv_node*)p->data;
-                if (n->format == MPV_FORMAT_NODE_MAP) {
-                    for (int i = 0; i < n->u.list->num; ++i) {
-                        const char* key = n->u.list->keys[i];
-                        mpv_node* val = n->u.list->values + i;
-                        if (!key) continue;
-                        if (std::strcmp(key, "cache-duration") == 0 && val->format == MPV_FORMAT_DOUBLE) {
-                            m_info.cache_duration = val->u.double_;
-                        }
-                        else if (std::strcmp(key, "fw-bytes") == 0 && val->format == MPV_FORMAT_INT64) {
-                            m_info.fw_bytes = (double)val->u.int64;
-                        }
-                        else if (std::strcmp(key, "bw-bytes") == 0 && val->format == MPV_FORMAT_INT64) {
-                            m_info.bw_bytes = (double)val->u.int64;
-                        }
-                        // 还可以解析 seekable-ranges 等，按需扩展
-                    }
+            else if (std::strcmp(key, "seekable-ranges") == 0 && val->format == MPV_FORMAT_NODE_ARRAY) {
+                // [{start, end}, ...]，超出的段丢弃
+                hasRanges = true;
+                for (int r = 0; r < val->u.list->num && rangeCount < kMaxSeekableRanges; ++r) {
+                    const mpv_node* s = FindNode(val->u.list->values + r, "start");
+                    const mpv_node* e = FindNode(val->u.list->values + r, "end");
+                    if (!s || !e || s->format != MPV_FORMAT_DOUBLE || e->format != MPV_FORMAT_DOUBLE)
+                        continue;
+                    rangeStart[rangeCount] = s->u.double_;
+                    rangeEnd[rangeCount] = e->u.double_;
+                    ++rangeCount;
                 }
             }
-            break;
-        }
-        default:
-            break;
         }
+        updateInfo([&](InfoState& info) {
+            if (hasDuration) info.cache_duration = cacheDuration;
+            if (hasFw) info.fw_bytes = fwBytes;
+            if (hasBw) info.bw_bytes = bwBytes;
+            if (hasRanges) {
+                info.seek_ranges = rangeCount;
+                std::copy(rangeStart, rangeStart + rangeCount, info.seek_start);
+                std::copy(rangeEnd, rangeEnd + rangeCount, info.seek_end);
+            }
+        });
+        break;
+    }
+    default:
+        break;
     }
 }
 
 void WMPVPlayer::applyFillMode()
 {
     if (!m_mpv) return;
+
+    // 异步设置，不在事件循环里等 mpv 核心锁
+    auto setAsync = [this](const char* name, const char* value) {
+        mpv_set_property_async(m_mpv, 0, name, MPV_FORMAT_STRING, &value);
+    };
     switch (m_fill) {
     case FillMode::Contain:
-        mpv_set_property_string(m_mpv, "keepaspect", "yes");
-        mpv_set_property_string(m_mpv, "panscan", "0");
+        setAsync("keepaspect", "yes");
+        setAsync("panscan", "0");
         break;
     case FillMode::Cover:
-        mpv_set_property_string(m_mpv, "keepaspect", "yes");
-        mpv_set_property_string(m_mpv, "panscan", "1.0");
+        setAsync("keepaspect", "yes");
+        setAsync("panscan", "1.0");
         break;
     case FillMode::Stretch:
-        mpv_set_property_string(m_mpv, "panscan", "0");
-        mpv_set_property_string(m_mpv, "keepaspect", "no");
+        setAsync("panscan", "0");
+        setAsync("keepaspect", "no");
         break;
     }
 }
@@ -636,4 +2250,31 @@ void* WMPVPlayer::getProcAddr(void*, const char* name) {
     return SDL_GL_GetProcAddress(name);
 }
 
+int WMPVPlayer::onStreamOpen(void* user_data, char* uri, mpv_stream_cb_info* info) {
+    auto* self = static_cast<WMPVPlayer*>(user_data);
+    const char* name = std::strstr(uri, "://");
+    if (!name)
+        return MPV_ERROR_LOADING_FAILED;
+    name += 3;
+
+    StreamRef stream;
+    {
+        std::lock_guard<std::mutex> lk(self->m_streamsMx);
+        auto it = self->m_streams.find(name);
+        if (it == self->m_streams.end())
+            return MPV_ERROR_LOADING_FAILED;
+        stream = it->second;
+    }
+
+    // mpv 可能为探测重复打开同一个流，每次都从缓冲窗口开头读
+    stream->OpenReader();
+    info->cookie = new StreamRef(std::move(stream));
+    info->read_fn = &StreamRead;
+    info->seek_fn = &StreamSeek;
+    info->size_fn = &StreamSize;
+    info->close_fn = &StreamClose;
+    info->cancel_fn = &StreamCancel;
+    return 0;
+}
+
 }  // namespace wmediakits
\ No newline at end of file
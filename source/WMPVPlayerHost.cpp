@@ -0,0 +1,318 @@
+﻿#include "WMPVPlayerHost.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "WMPVPlayer.h"
+
+namespace wmediakits {
+
+WMPVPlayerHost::WMPVPlayerHost()
+{
+}
+
+WMPVPlayerHost::~WMPVPlayerHost()
+{
+    Stop();
+}
+
+bool WMPVPlayerHost::Start()
+{
+    if (m_running.exchange(true))
+        return true;
+
+    m_quit.store(false);
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_started = false;
+    }
+    m_thread = std::thread([this] { threadFunc(); });
+
+    bool ok = false;
+    {
+        std::unique_lock<std::mutex> lk(m_mx);
+        m_cv.wait(lk, [this] { return m_started; });
+        ok = m_evCommand != 0;
+    }
+    if (!ok) {
+        m_thread.join();
+        m_running.store(false);
+    }
+    return ok;
+}
+
+void WMPVPlayerHost::Stop()
+{
+    if (!m_running.load())
+        return;
+    m_quit.store(true);
+
+    Uint32 ev = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        ev = m_evCommand;
+    }
+    if (ev) {
+        SDL_Event e{};
+        e.type = ev;
+        SDL_PushEvent(&e);
+    }
+
+    if (m_thread.joinable())
+        m_thread.join();
+    m_running.store(false);
+}
+
+size_t WMPVPlayerHost::PlayerCount() const
+{
+    std::lock_guard<std::mutex> lk(m_mx);
+    return m_live.size();
+}
+
+bool WMPVPlayerHost::attach(WMPVPlayer* player)
+{
+    Uint32 ev = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        if (!m_started || !m_evCommand || m_quit.load())
+            return false;
+        m_live.insert(player);
+        m_pendingAttach.push_back(player);
+        ev = m_evCommand;
+    }
+    SDL_Event e{};
+    e.type = ev;
+    SDL_PushEvent(&e);
+    return true;
+}
+
+void WMPVPlayerHost::detach(WMPVPlayer* player)
+{
+    if (std::this_thread::get_id() == m_thread.get_id()) {
+        // 在 host 线程（播放器回调）里：直接拆
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+            if (m_slots[i].player == player) {
+                teardown(i);
+                return;
+            }
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lk(m_mx);
+    if (!m_live.count(player))
+        return;
+    m_pendingDetach.push_back(player);
+    SDL_Event e{};
+    e.type = m_evCommand;
+    SDL_PushEvent(&e);
+    m_cv.wait(lk, [this, player] { return !m_live.count(player); });
+}
+
+void WMPVPlayerHost::threadFunc()
+{
+    // 不要让 SDL 接管信号，避免和 mpv/你的程序冲突
+    SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
+
+    // host 自己只需要事件队列；各播放器启动时再按需初始化视频等子系统（SDL 内部有引用计数）
+    const bool sdlOk = SDL_Init(SDL_INIT_EVENTS | SDL_INIT_TIMER) == 0;
+    const Uint32 ev = sdlOk ? SDL_RegisterEvents(1) : (Uint32)-1;
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_evCommand = ev == (Uint32)-1 ? 0 : ev;
+        m_started = true;
+    }
+    m_cv.notify_all();
+    if (ev == (Uint32)-1) {
+        std::fprintf(stderr, "WMPVPlayerHost: SDL init failed: %s\n", SDL_GetError());
+        if (sdlOk)
+            SDL_QuitSubSystem(SDL_INIT_EVENTS | SDL_INIT_TIMER);
+        return;
+    }
+
+    m_lastPass = std::chrono::steady_clock::now();
+    while (!m_quit.load()) {
+        // 有待渲染的窗口时只等到下一轮渲染的时间点
+        SDL_Event e{};
+        if (SDL_WaitEventTimeout(&e, waitTimeoutMs()) == 1) {
+            // 先取完队列里已有的事件再渲染：同一轮里的多次更新只绘制最新一帧
+            do {
+                dispatch(e);
+            } while (SDL_PollEvent(&e) == 1);
+        }
+
+        runCommands();
+
+        // 窗口被关掉的播放器：拆掉（它之后的 Stop() 直接返回）
+        for (size_t i = m_slots.size(); i-- > 0;) {
+            if (m_slots[i].player->m_quit.load())
+                teardown(i);
+        }
+
+        renderPass();
+    }
+
+    runCommands();
+    while (!m_slots.empty())
+        teardown(m_slots.size() - 1);
+
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_evCommand = 0;
+    }
+    SDL_QuitSubSystem(SDL_INIT_EVENTS | SDL_INIT_TIMER);
+}
+
+void WMPVPlayerHost::runCommands()
+{
+    std::vector<WMPVPlayer*> attaching, detaching;
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        attaching.swap(m_pendingAttach);
+        detaching.swap(m_pendingDetach);
+    }
+
+    for (WMPVPlayer* p : attaching) {
+        if (p->beginSession()) {
+            Slot slot;
+            slot.player = p;
+            m_slots.push_back(slot);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lk(m_mx);
+            m_live.erase(p);
+        }
+        m_cv.notify_all();
+    }
+
+    for (WMPVPlayer* p : detaching) {
+        auto it = std::find_if(m_slots.begin(), m_slots.end(),
+                               [p](const Slot& s) { return s.player == p; });
+        if (it != m_slots.end()) {
+            teardown(it - m_slots.begin());
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lk(m_mx);
+            m_live.erase(p);
+        }
+        m_cv.notify_all();
+    }
+}
+
+void WMPVPlayerHost::dispatch(const SDL_Event& e)
+{
+    if (e.type == m_evCommand)
+        return; // 命令在取完事件后统一处理
+
+    Slot* slot = route(e);
+    if (!slot)
+        return;
+    // 回调里可能拆掉播放器（m_slots 会变），处理完按播放器重新查找
+    WMPVPlayer* p = slot->player;
+    bool redraw = false;
+    p->handleEvent(e, redraw);
+    if (!redraw)
+        return;
+    for (Slot& s : m_slots) {
+        if (s.player == p)
+            s.redraw = true;
+    }
+}
+
+WMPVPlayerHost::Slot* WMPVPlayerHost::route(const SDL_Event& e)
+{
+    // 输入/窗口事件按窗口 ID，播放器的自定义事件按各自注册的类型
+    Uint32 windowId = 0;
+    switch (e.type) {
+    case SDL_WINDOWEVENT:     windowId = e.window.windowID; break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:           windowId = e.key.windowID; break;
+    case SDL_MOUSEMOTION:     windowId = e.motion.windowID; break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:   windowId = e.button.windowID; break;
+    case SDL_MOUSEWHEEL:      windowId = e.wheel.windowID; break;
+    default: break;
+    }
+
+    for (Slot& s : m_slots) {
+        const WMPVPlayer* p = s.player;
+        if (windowId != 0) {
+            if (p->m_win && SDL_GetWindowID(p->m_win) == windowId)
+                return &s;
+        }
+        else if (e.type == p->m_evRenderUpdate || e.type == p->m_evMpvEvents || e.type == p->m_evWake) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+int WMPVPlayerHost::waitTimeoutMs() const
+{
+    bool pending = false;
+    for (const Slot& s : m_slots)
+        pending = pending || s.redraw;
+    if (!pending)
+        return -1;
+
+    const double elapsed = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - m_lastPass).count();
+    return std::max(0, (int)std::ceil(m_passIntervalMs - elapsed));
+}
+
+void WMPVPlayerHost::renderPass()
+{
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point now = Clock::now();
+    if (std::chrono::duration<double, std::milli>(now - m_lastPass).count() < m_passIntervalMs)
+        return;
+
+    // 等得最久的先画：窗口重绘（没有新帧）排最前，其余按帧就绪时间
+    std::vector<WMPVPlayer*> due;
+    for (Slot& s : m_slots) {
+        if (s.redraw)
+            due.push_back(s.player);
+        s.redraw = false;
+    }
+    if (due.empty())
+        return;
+    std::stable_sort(due.begin(), due.end(), [](const WMPVPlayer* a, const WMPVPlayer* b) {
+        if (a->m_frameWaiting != b->m_frameWaiting)
+            return !a->m_frameWaiting;
+        return a->m_frameWaiting && a->m_frameReadyAt < b->m_frameReadyAt;
+    });
+
+    double maxHz = 0.0;
+    for (WMPVPlayer* p : due) {
+        // 前面的帧回调里可能已经拆掉了它
+        const bool live = std::any_of(m_slots.begin(), m_slots.end(),
+                                      [p](const Slot& s) { return s.player == p; });
+        if (!live)
+            continue;
+        if (p->m_renderReady)
+            p->renderFrame();
+        std::lock_guard<std::mutex> lk(p->m_timingMx);
+        maxHz = std::max(maxHz, p->m_timings.refresh_hz);
+    }
+
+    // 按最快的显示器刷新率限速，未知时按 60Hz
+    m_passIntervalMs = 1000.0 / (maxHz > 0.0 ? maxHz : 60.0);
+    m_lastPass = now;
+}
+
+void WMPVPlayerHost::teardown(size_t index)
+{
+    WMPVPlayer* p = m_slots[index].player;
+    m_slots.erase(m_slots.begin() + index);
+    p->endSession();
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_live.erase(p);
+    }
+    m_cv.notify_all();
+}
+
+}  // namespace wmediakits
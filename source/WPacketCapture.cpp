@@ -0,0 +1,612 @@
+﻿#include "WPacketCapture.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "WBigEndian.h"
+#include "WDecoder.h"
+#include "WSDLPlayer.h"
+
+namespace wmediakits {
+
+namespace {
+
+const char kMagic[8] = { 'W', 'M', 'K', 'P', 'C', 'A', 'P', '\0' };
+const char kIndexMagic[8] = { 'W', 'M', 'K', 'P', 'I', 'D', 'X', '\0' };
+constexpr uint32_t kVersion = 2;
+constexpr size_t kFixedHeaderBytes = 16;
+constexpr size_t kRecordHeaderBytes = 16;
+constexpr size_t kRecordAlignment = 16;
+constexpr size_t kTrailerBytes = 24;
+
+// 包的大小与码率有关，关键帧可能上 MB，环形缓冲给大一些以免丢包
+constexpr size_t kCaptureRingBytes = 32 << 20;
+
+// 超过这些长度视为文件损坏
+constexpr uint32_t kMaxPayloadBytes = 64 << 20;
+constexpr uint32_t kMaxHeaderBytes = 64 << 10;
+
+const uint8_t kZeros[kRecordAlignment + AV_INPUT_BUFFER_PADDING_SIZE] = {};
+
+uint64_t AlignUp(uint64_t v, uint64_t a) {
+    return (v + a - 1) / a * a;
+}
+
+// 一条记录在文件里占的总字节数（含记录头和补零）
+uint64_t RecordBytes(uint32_t version, uint32_t size) {
+    if (version < 2)
+        return kRecordHeaderBytes + size;
+    return AlignUp(kRecordHeaderBytes + size + AV_INPUT_BUFFER_PADDING_SIZE, kRecordAlignment);
+}
+
+void AppendString16(std::vector<uint8_t>& out, const std::string& s)
+{
+    const uint16_t len = static_cast<uint16_t>(std::min<size_t>(s.size(), 0xFFFF));
+    uint8_t buf[2];
+    WriteLittleEndian16(buf, len);
+    out.insert(out.end(), buf, buf + 2);
+    out.insert(out.end(), s.begin(), s.begin() + len);
+}
+
+bool ParseString16(const uint8_t*& p, const uint8_t* end, std::string& s)
+{
+    if (end - p < 2)
+        return false;
+    const uint16_t len = ReadLittleEndian16(p);
+    p += 2;
+    if (end - p < len)
+        return false;
+    s.assign(reinterpret_cast<const char*>(p), len);
+    p += len;
+    return true;
+}
+
+struct FileHeader {
+    uint32_t    version = 0;
+    uint32_t    headerBytes = 0;
+    std::string acodecName;
+    std::string vcodecName;
+};
+
+// 只校验固定部分，得到文件头总长度
+bool PeekHeaderBytes(const uint8_t* p, size_t avail, uint32_t* headerBytes)
+{
+    if (avail < kFixedHeaderBytes || memcmp(p, kMagic, sizeof(kMagic)) != 0)
+        return false;
+    *headerBytes = ReadLittleEndian32(p + 12);
+    return *headerBytes >= kFixedHeaderBytes && *headerBytes <= kMaxHeaderBytes;
+}
+
+bool ParseHeader(const uint8_t* p, size_t avail, FileHeader* h)
+{
+    if (!PeekHeaderBytes(p, avail, &h->headerBytes) || h->headerBytes > avail)
+        return false;
+    h->version = ReadLittleEndian32(p + 8);
+
+    const uint8_t* cur = p + kFixedHeaderBytes;
+    const uint8_t* end = p + h->headerBytes;
+    return ParseString16(cur, end, h->acodecName) && ParseString16(cur, end, h->vcodecName);
+}
+
+// 校验尾部，成功时返回索引位置和条数
+bool IsKnownType(uint8_t type)
+{
+    return type == static_cast<uint8_t>(WPacketType::Video) || type == static_cast<uint8_t>(WPacketType::Audio);
+}
+
+bool ParseTrailer(const uint8_t* t, uint64_t fileSize, uint64_t dataOffset, uint64_t* indexOffset, uint64_t* count)
+{
+    if (memcmp(t + 16, kIndexMagic, sizeof(kIndexMagic)) != 0)
+        return false;
+    *indexOffset = ReadLittleEndian64(t);
+    *count = ReadLittleEndian64(t + 8);
+    return *indexOffset >= dataOffset && *indexOffset <= fileSize &&
+           *count <= (fileSize - *indexOffset) / 8 &&
+           *indexOffset + *count * 8 + kTrailerBytes == fileSize;
+}
+
+int Seek64(FILE* fp, uint64_t offset, int whence)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, static_cast<__int64>(offset), whence);
+#else
+    return fseeko(fp, static_cast<off_t>(offset), whence);
+#endif
+}
+
+uint64_t Tell64(FILE* fp)
+{
+#ifdef _WIN32
+    return static_cast<uint64_t>(_ftelli64(fp));
+#else
+    return static_cast<uint64_t>(ftello(fp));
+#endif
+}
+
+// RealTime 模式下按记录的到达时间等待，同时统计投递延迟
+class ReplayPacer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    ReplayPacer(WPacketReplayer::Mode mode, WPacketReplayer::Stats& stats)
+        : m_mode(mode), m_stats(stats), m_start(Clock::now())
+    {
+        m_stats = WPacketReplayer::Stats();
+    }
+
+    void Wait(uint64_t arrivalUs)
+    {
+        if (m_mode != WPacketReplayer::Mode::RealTime)
+            return;
+        // 以第一个包为零点：录制开始到第一个包之间的空闲不回放
+        if (!m_hasBase) {
+            m_baseUs = arrivalUs;
+            m_hasBase = true;
+        }
+        const uint64_t offsetUs = arrivalUs > m_baseUs ? arrivalUs - m_baseUs : 0;
+        const Clock::time_point due = m_start + std::chrono::microseconds(offsetUs);
+        std::this_thread::sleep_until(due);
+        const double lateMs = std::chrono::duration<double, std::milli>(Clock::now() - due).count();
+        m_stats.maxLateMs = std::max(m_stats.maxLateMs, lateMs);
+    }
+
+    void Delivered(uint32_t size)
+    {
+        ++m_stats.packets;
+        m_stats.bytes += size;
+    }
+
+    void Finish()
+    {
+        m_stats.seconds = std::chrono::duration<double>(Clock::now() - m_start).count();
+    }
+
+private:
+    WPacketReplayer::Mode   m_mode;
+    WPacketReplayer::Stats& m_stats;
+    Clock::time_point       m_start;
+    uint64_t                m_baseUs = 0;
+    bool                    m_hasBase = false;
+};
+
+}  // namespace
+
+WPacketRecorder::WPacketRecorder()
+{
+}
+
+WPacketRecorder::~WPacketRecorder()
+{
+    Close();
+}
+
+bool WPacketRecorder::Open(const std::string& path, const std::string& acodec_name, const std::string& vcodec_name)
+{
+    Close();
+
+    std::vector<uint8_t> header(kFixedHeaderBytes);
+    memcpy(header.data(), kMagic, sizeof(kMagic));
+    WriteLittleEndian32(header.data() + 8, kVersion);
+    AppendString16(header, acodec_name);
+    AppendString16(header, vcodec_name);
+    header.resize(static_cast<size_t>(AlignUp(header.size(), kRecordAlignment)), 0);
+    WriteLittleEndian32(header.data() + 12, static_cast<uint32_t>(header.size()));
+
+    {
+        std::lock_guard<std::mutex> lock(m_indexMutex);
+        m_index.clear();
+        m_offset = header.size();
+        m_sealed = false;
+    }
+
+    WDumpWriter::Options opts;
+    opts.ringBytes = kCaptureRingBytes;
+    m_start = std::chrono::steady_clock::now();
+    m_packets.store(0, std::memory_order_relaxed);
+    if (!m_writer.Open(path, opts))
+        return false;
+
+    m_writer.Write(header.data(), header.size());
+    return true;
+}
+
+void WPacketRecorder::Close()
+{
+    if (!m_writer.IsOpen())
+        return;
+
+    std::vector<uint64_t> index;
+    uint64_t indexOffset = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_indexMutex);
+        m_sealed = true;
+        index.swap(m_index);
+        indexOffset = m_offset;
+    }
+    const uint64_t dropped = m_writer.DroppedRecords();
+
+    // 索引可能比环形缓冲还大，阻塞写；封口之后不会再有生产者插进来
+    uint8_t trailer[kTrailerBytes];
+    WriteLittleEndian64(trailer, indexOffset);
+    WriteLittleEndian64(trailer + 8, index.size());
+    memcpy(trailer + 16, kIndexMagic, sizeof(kIndexMagic));
+    for (uint64_t& offset : index)
+        WriteLittleEndian64(&offset, offset);
+    m_writer.WriteBlocking(index.data(), index.size() * sizeof(uint64_t));
+    m_writer.WriteBlocking(trailer, sizeof(trailer));
+
+    m_writer.Close();
+    if (dropped > 0) {
+        fprintf(stderr, "WPacketRecorder: %llu packets dropped (ring full)\n",
+                static_cast<unsigned long long>(dropped));
+    }
+}
+
+bool WPacketRecorder::Record(WPacketType type, const uint8_t* data, int size)
+{
+    if (size < 0 || static_cast<uint32_t>(size) > kMaxPayloadBytes)
+        return false;
+
+    const uint64_t recordBytes = RecordBytes(kVersion, static_cast<uint32_t>(size));
+    WDumpWriter::ScopedRecord rec(m_writer, static_cast<size_t>(recordBytes));
+    if (!rec)
+        return false;
+
+    // 持有 rec 期间其它生产者被挡住，这里登记的偏移和写入顺序一致。
+    // 封口后直接返回，未追加的预留会在 rec 析构时撤销。
+    {
+        std::lock_guard<std::mutex> lock(m_indexMutex);
+        if (m_sealed)
+            return false;
+        m_index.push_back(m_offset);
+        m_offset += recordBytes;
+    }
+
+    // 持锁后再取时间，保证文件里的时间戳单调（音视频包来自不同线程）
+    const uint64_t arrivalUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_start).count());
+
+    uint8_t hdr[kRecordHeaderBytes] = {};
+    hdr[0] = static_cast<uint8_t>(type);
+    WriteLittleEndian32(hdr + 4, static_cast<uint32_t>(size));
+    WriteLittleEndian64(hdr + 8, arrivalUs);
+    rec.Append(hdr, sizeof(hdr));
+    rec.Append(data, size);
+    rec.Append(kZeros, static_cast<size_t>(recordBytes - kRecordHeaderBytes - size));
+
+    m_packets.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+WPacketReplayer::WPacketReplayer()
+{
+}
+
+WPacketReplayer::~WPacketReplayer()
+{
+    Close();
+}
+
+bool WPacketReplayer::Open(const std::string& path)
+{
+    Close();
+
+    m_file = fopen(path.c_str(), "rb");
+    if (!m_file) {
+        fprintf(stderr, "WPacketReplayer: failed to open %s\n", path.c_str());
+        return false;
+    }
+    setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+
+    uint8_t fixed[kFixedHeaderBytes];
+    uint32_t headerBytes = 0;
+    if (fread(fixed, 1, sizeof(fixed), m_file) != sizeof(fixed) ||
+        !PeekHeaderBytes(fixed, sizeof(fixed), &headerBytes)) {
+        fprintf(stderr, "WPacketReplayer: %s is not a packet capture\n", path.c_str());
+        Close();
+        return false;
+    }
+
+    std::vector<uint8_t> raw(headerBytes);
+    memcpy(raw.data(), fixed, sizeof(fixed));
+    FileHeader header;
+    if (fread(raw.data() + sizeof(fixed), 1, raw.size() - sizeof(fixed), m_file) != raw.size() - sizeof(fixed) ||
+        !ParseHeader(raw.data(), raw.size(), &header)) {
+        fprintf(stderr, "WPacketReplayer: truncated header in %s\n", path.c_str());
+        Close();
+        return false;
+    }
+    if (header.version < 1 || header.version > kVersion) {
+        fprintf(stderr, "WPacketReplayer: unsupported capture version %u\n", header.version);
+        Close();
+        return false;
+    }
+
+    m_version = header.version;
+    m_acodecName = header.acodecName;
+    m_vcodecName = header.vcodecName;
+    m_dataOffset = header.headerBytes;
+
+    // 有尾部索引时记录区到索引为止
+    Seek64(m_file, 0, SEEK_END);
+    const uint64_t fileSize = Tell64(m_file);
+    m_dataEnd = fileSize;
+    uint8_t trailer[kTrailerBytes];
+    uint64_t indexOffset = 0, count = 0;
+    if (m_version >= 2 && fileSize >= m_dataOffset + kTrailerBytes &&
+        Seek64(m_file, fileSize - kTrailerBytes, SEEK_SET) == 0 &&
+        fread(trailer, 1, sizeof(trailer), m_file) == sizeof(trailer) &&
+        ParseTrailer(trailer, fileSize, m_dataOffset, &indexOffset, &count)) {
+        m_dataEnd = indexOffset;
+    }
+    return true;
+}
+
+void WPacketReplayer::Close()
+{
+    if (m_file) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    m_acodecName.clear();
+    m_vcodecName.clear();
+    m_version = 0;
+    m_dataOffset = 0;
+    m_dataEnd = 0;
+}
+
+bool WPacketReplayer::Replay(Mode mode, const PacketHandler& handler)
+{
+    if (!m_file || Seek64(m_file, m_dataOffset, SEEK_SET) != 0)
+        return false;
+
+    m_stop.store(false, std::memory_order_relaxed);
+    ReplayPacer pacer(mode, m_stats);
+
+    bool ok = true;
+    uint64_t pos = m_dataOffset;
+    while (pos < m_dataEnd && !m_stop.load(std::memory_order_relaxed)) {
+        uint8_t hdr[kRecordHeaderBytes];
+        if (fread(hdr, 1, sizeof(hdr), m_file) != sizeof(hdr)) {
+            ok = false;
+            break;
+        }
+        const uint32_t size = ReadLittleEndian32(hdr + 4);
+        if (!IsKnownType(hdr[0]) || size > kMaxPayloadBytes) {
+            ok = false;
+            break;
+        }
+        const uint64_t recordBytes = RecordBytes(m_version, size);
+        const size_t bodyBytes = static_cast<size_t>(recordBytes - kRecordHeaderBytes);
+        if (pos + recordBytes > m_dataEnd) {
+            ok = false;
+            break;
+        }
+
+        // 负载缓冲只增不减，回放过程中不再分配；v1 文件没有补零，这里补上
+        const size_t need = std::max<size_t>(bodyBytes, size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (m_payload.size() < need)
+            m_payload.resize(need);
+        if (bodyBytes > 0 && fread(m_payload.data(), 1, bodyBytes, m_file) != bodyBytes) {
+            ok = false;
+            break;
+        }
+        memset(m_payload.data() + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        pos += recordBytes;
+
+        pacer.Wait(ReadLittleEndian64(hdr + 8));
+        handler(static_cast<WPacketType>(hdr[0]), m_payload.data(), static_cast<int>(size));
+        pacer.Delivered(size);
+    }
+
+    pacer.Finish();
+    if (!ok)
+        fprintf(stderr, "WPacketReplayer: capture truncated after %llu packets\n",
+                static_cast<unsigned long long>(m_stats.packets));
+    return ok;
+}
+
+bool WPacketReplayer::Replay(Mode mode, WSDLPlayer& player)
+{
+    return Replay(mode, [&player](WPacketType type, uint8_t* data, int size) {
+        if (type == WPacketType::Video)
+            player.ProcessVideo(data, size);
+        else if (type == WPacketType::Audio)
+            player.ProcessAudio(data, size);
+    });
+}
+
+WPacketMappedReader::WPacketMappedReader()
+{
+}
+
+WPacketMappedReader::~WPacketMappedReader()
+{
+    Close();
+}
+
+bool WPacketMappedReader::Open(const std::string& path)
+{
+    Close();
+
+    // 映射建立后文件句柄即可关闭，映射区独立保持文件引用
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "WPacketMappedReader: failed to open %s\n", path.c_str());
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart >= static_cast<LONGLONG>(kFixedHeaderBytes)) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            m_base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            m_size = static_cast<uint64_t>(size.QuadPart);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "WPacketMappedReader: failed to open %s\n", path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(kFixedHeaderBytes)) {
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            m_base = static_cast<const uint8_t*>(p);
+            m_size = static_cast<uint64_t>(st.st_size);
+        }
+    }
+    close(fd);
+#endif
+    if (!m_base) {
+        fprintf(stderr, "WPacketMappedReader: failed to map %s\n", path.c_str());
+        Close();
+        return false;
+    }
+
+    FileHeader header;
+    if (!ParseHeader(m_base, static_cast<size_t>(std::min<uint64_t>(m_size, kMaxHeaderBytes)), &header)) {
+        fprintf(stderr, "WPacketMappedReader: %s is not a packet capture\n", path.c_str());
+        Close();
+        return false;
+    }
+    if (header.version != kVersion) {
+        // v1 负载后没有补零，不能直接交给解码器，用 WPacketReplayer 读
+        fprintf(stderr, "WPacketMappedReader: capture version %u is not supported\n", header.version);
+        Close();
+        return false;
+    }
+    m_acodecName = header.acodecName;
+    m_vcodecName = header.vcodecName;
+
+    uint64_t indexOffset = 0, count = 0;
+    if (m_size >= header.headerBytes + kTrailerBytes &&
+        ParseTrailer(m_base + m_size - kTrailerBytes, m_size, header.headerBytes, &indexOffset, &count)) {
+        m_footerIndex = m_base + indexOffset;
+        m_count = static_cast<size_t>(count);
+        m_dataEnd = indexOffset;
+        return true;
+    }
+
+    fprintf(stderr, "WPacketMappedReader: %s has no index, scanning records\n", path.c_str());
+    m_dataEnd = m_size;
+    return scanRecords(header.headerBytes, m_size);
+}
+
+void WPacketMappedReader::Close()
+{
+    if (m_base) {
+#ifdef _WIN32
+        UnmapViewOfFile(m_base);
+#else
+        munmap(const_cast<uint8_t*>(m_base), static_cast<size_t>(m_size));
+#endif
+        m_base = nullptr;
+    }
+    m_size = 0;
+    m_dataEnd = 0;
+    m_acodecName.clear();
+    m_vcodecName.clear();
+    m_footerIndex = nullptr;
+    m_scanIndex.clear();
+    m_count = 0;
+}
+
+bool WPacketMappedReader::scanRecords(uint64_t dataOffset, uint64_t dataEnd)
+{
+    uint64_t pos = dataOffset;
+    while (dataEnd - pos >= kRecordHeaderBytes) {
+        // 异常退出时直写模式的最后一块带着补零，类型为 0 的记录即视为结束
+        const uint32_t size = ReadLittleEndian32(m_base + pos + 4);
+        const uint64_t recordBytes = RecordBytes(kVersion, size);
+        if (!IsKnownType(m_base[pos]) || size > kMaxPayloadBytes || recordBytes > dataEnd - pos)
+            break;
+        m_scanIndex.push_back(pos);
+        pos += recordBytes;
+    }
+    // 异常退出时最后一条可能不完整，保留之前的完整记录
+    if (pos != dataEnd)
+        fprintf(stderr, "WPacketMappedReader: ignoring %llu trailing bytes\n",
+                static_cast<unsigned long long>(dataEnd - pos));
+    m_dataEnd = pos;
+    m_count = m_scanIndex.size();
+    return true;
+}
+
+WPacketMappedReader::Packet WPacketMappedReader::GetPacket(size_t i) const
+{
+    Packet pkt = { WPacketType::Video, nullptr, 0, 0 };
+    if (i >= m_count)
+        return pkt;
+
+    const uint64_t offset = m_footerIndex ? ReadLittleEndian64(m_footerIndex + i * 8) : m_scanIndex[i];
+    if (offset > m_dataEnd || m_dataEnd - offset < kRecordHeaderBytes)
+        return pkt;
+    const uint8_t* hdr = m_base + offset;
+    const uint32_t size = ReadLittleEndian32(hdr + 4);
+    if (size > kMaxPayloadBytes || RecordBytes(kVersion, size) > m_dataEnd - offset)
+        return pkt;
+
+    pkt.type = static_cast<WPacketType>(hdr[0]);
+    pkt.data = hdr + kRecordHeaderBytes;
+    pkt.size = static_cast<int>(size);
+    pkt.arrivalUs = ReadLittleEndian64(hdr + 8);
+    return pkt;
+}
+
+bool WPacketMappedReader::Replay(WPacketReplayer::Mode mode, const WPacketReplayer::PacketHandler& handler)
+{
+    if (!m_base)
+        return false;
+
+    m_stop.store(false, std::memory_order_relaxed);
+    ReplayPacer pacer(mode, m_stats);
+
+    bool ok = true;
+    for (size_t i = 0; i < m_count && !m_stop.load(std::memory_order_relaxed); ++i) {
+        const Packet pkt = GetPacket(i);
+        if (!pkt.data) {
+            fprintf(stderr, "WPacketMappedReader: bad index entry %zu\n", i);
+            ok = false;
+            break;
+        }
+        pacer.Wait(pkt.arrivalUs);
+        // 映射区只读；解码器只读取输入（包未引用计数，avcodec 内部会自行拷贝）
+        handler(pkt.type, const_cast<uint8_t*>(pkt.data), pkt.size);
+        pacer.Delivered(static_cast<uint32_t>(pkt.size));
+    }
+    pacer.Finish();
+    return ok;
+}
+
+bool WPacketMappedReader::Replay(WPacketReplayer::Mode mode, WDecoder* audio, WDecoder* video)
+{
+    return Replay(mode, [audio, video](WPacketType type, uint8_t* data, int size) {
+        if (type == WPacketType::Video && video)
+            video->Decode(data, size);
+        else if (type == WPacketType::Audio && audio)
+            audio->Decode(data, size);
+    });
+}
+
+}  // namespace wmediakits
@@ -1,11 +1,68 @@
 ﻿#include "WSDLPlayer.h"
+#include "WBackgroundRunner.h"
 #include "WBigEndian.h"
+#include "WTrace.h"
 #include "WUtils.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
 namespace wmediakits {
 
 constexpr SDL_AudioFormat kSDLAudioFormatUnknown = 0;
 
+namespace {
+
+// 进程内的播放器，供 GetProcessMemoryReport() 遍历
+struct SessionRegistry {
+    std::mutex               mx;
+    std::vector<WSDLPlayer*> players;
+};
+
+SessionRegistry& GetSessionRegistry()
+{
+    static SessionRegistry registry;
+    return registry;
+}
+
+// 包实际占住的内存是池里分到的整块 buffer，不只是 size
+size_t PacketBufferBytes(const AVPacket& packet)
+{
+    return packet.buf ? packet.buf->size : static_cast<size_t>(packet.size);
+}
+
+// 包里是否有关键帧（h264 IDR/SPS、hevc IRAP/VPS/SPS、vp8 关键帧）。
+// 超预算清空视频包后从这里恢复解码；认不出的 codec 一律当作关键帧
+bool IsVideoKeyPacket(const std::string& codec, const uint8_t* data, int size)
+{
+    if (codec == "vp8")
+        return size > 0 && (data[0] & 0x01) == 0;
+
+    const bool hevc = codec == "hevc" || codec == "h265";
+    if (!hevc && codec != "h264")
+        return true;
+    for (int i = 0; i + 3 < size; ++i) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+            continue;
+        const uint8_t nal = data[i + 3];
+        if (hevc) {
+            const int type = (nal >> 1) & 0x3f;
+            if ((type >= 16 && type <= 21) || type == 32 || type == 33)
+                return true;
+        }
+        else {
+            const int type = nal & 0x1f;
+            if (type == 5 || type == 7)
+                return true;
+        }
+        i += 2;
+    }
+    return false;
+}
+
+}  // namespace
+
 // custom event type
 enum {
     SDL_EVENT_CREATE_WINDOW = SDL_USEREVENT
@@ -17,6 +74,11 @@ WSDLPlayer::WSDLPlayer(std::shared_ptr<ISDLEventHandler> eventHandler)
     : m_audioDevice(0), m_window(nullptr), m_renderer(nullptr), m_texture(nullptr),
       m_videoWidth(0), m_videoHeight(0), m_eventHandler(eventHandler), m_onDisconnect(nullptr)
 {
+    {
+        SessionRegistry& reg = GetSessionRegistry();
+        std::lock_guard<std::mutex> lock(reg.mx);
+        reg.players.push_back(this);
+    }
     {
         std::lock_guard<std::mutex> lock(m_initMutex);
         if (s_instanceCount == 0) {
@@ -32,6 +94,20 @@ WSDLPlayer::WSDLPlayer(std::shared_ptr<ISDLEventHandler> eventHandler)
 
 WSDLPlayer::~WSDLPlayer()
 {
+    // 先摘掉，报告不会再读到析构中的播放器
+    {
+        SessionRegistry& reg = GetSessionRegistry();
+        std::lock_guard<std::mutex> lock(reg.mx);
+        reg.players.erase(std::remove(reg.players.begin(), reg.players.end(), this), reg.players.end());
+    }
+    // StopAsync 的后台任务引用着 this，等它们结束
+    {
+        std::unique_lock<std::mutex> lock(m_asyncStopMutex);
+        m_asyncStopCV.wait(lock, [this] { return m_asyncStops == 0; });
+    }
+    // 渲染线程用着 this，不能在它自己的回调（ISDLEventHandler）里析构：
+    // join 不了自己，detach 之后它又会访问已释放的成员。要在回调里结束播放，用 StopAsync()
+    assert(m_renderThread.get_id() != std::this_thread::get_id());
     Stop();
     SDL_DestroyTexture(m_texture);
     SDL_DestroyRenderer(m_renderer);
@@ -56,11 +132,25 @@ void WSDLPlayer::Init(const std::string& name, const std::string& acodec_name, c
 
 void WSDLPlayer::Play()
 {
+    // 上一次的线程可能已经退出但还没 join（在渲染线程回调里 Stop 过，或窗口关闭后自行结束），
+    // 给 joinable 的 std::thread 赋值会 std::terminate，先收掉。不能在渲染线程上重新 Play
+    assert(m_renderThread.get_id() != std::this_thread::get_id());
+    {
+        std::lock_guard<std::mutex> lock(m_stopMutex);
+        m_quit = true;
+        m_audioCV.notify_all();
+        m_videoCV.notify_all();
+        if (m_audioThread.joinable()) m_audioThread.join();
+        if (m_videoThread.joinable()) m_videoThread.join();
+        if (m_renderThread.joinable()) m_renderThread.join();
+    }
+
+    m_quit = false;
     m_audioThread = std::thread(&WSDLPlayer::AudioThreadFunc, this);
     m_videoThread = std::thread(&WSDLPlayer::VideoThreadFunc, this);
-    m_quit = false;
 
-    std::thread([this]() {
+    m_renderThread = std::thread([this]() {
+        WMK_TRACE_THREAD_NAME("render");
         while (!m_quit) {
             HandleEvents();
             HandleCustomEvents();
@@ -70,41 +160,113 @@ void WSDLPlayer::Play()
 
         //std::cerr << "WSDLPlayer::Play thread exit!!! " << std::endl;
 
-	}).detach();
+	});
 }
 
 void WSDLPlayer::Stop()
 {
     //std::cerr << "WSDLPlayer::Stop!!! " << std::endl;
+    std::lock_guard<std::mutex> lock(m_stopMutex);
     m_quit = true;
     m_audioCV.notify_all();
     m_videoCV.notify_all();
 
     if (m_audioThread.joinable()) m_audioThread.join();
     if (m_videoThread.joinable()) m_videoThread.join();
+    // 在渲染线程自己的回调里调用时不能 join 自己；它看到 m_quit 会自行退出，留给之后的 Stop/析构 join
+    if (m_renderThread.joinable() && m_renderThread.get_id() != std::this_thread::get_id())
+        m_renderThread.join();
+
+    m_pcmDump.Close();
+    m_packetRecorder.Close();
+    m_streamRecorder.Close();
+}
 
-    if (m_pcmDumpFile) {
-        fclose(m_pcmDumpFile);
-        m_pcmDumpFile = nullptr;
+void WSDLPlayer::StopAsync(OnStopped done, int deadlineMs)
+{
+    m_quit = true;
+    m_audioCV.notify_all();
+    m_videoCV.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(m_asyncStopMutex);
+        ++m_asyncStops;
     }
+
+    // 完成和截止时间谁先到谁回调，只回调一次
+    struct StopState {
+        std::atomic<bool> fired{ false };
+        OnStopped done;
+    };
+    auto state = std::make_shared<StopState>();
+    state->done = std::move(done);
+    auto finish = [state](bool finished) {
+        if (!state->fired.exchange(true) && state->done)
+            state->done(finished);
+    };
+
+    WBackgroundRunner& runner = WBackgroundRunner::Shared();
+    if (deadlineMs >= 0)
+        runner.PostCallback([finish] { finish(false); }, deadlineMs);
+    runner.PostBlocking([this, finish] {
+        Stop();
+        {
+            std::lock_guard<std::mutex> lock(m_asyncStopMutex);
+            --m_asyncStops;
+            m_asyncStopCV.notify_all();
+        }
+        // 之后不再碰 this：回调里可以直接销毁播放器
+        finish(true);
+    });
 }
 
 void WSDLPlayer::ProcessVideo(uint8_t* buffer, int bufSize)
 {
+    WMK_TRACE_SCOPE("ProcessVideo");
+    if (m_packetRecorder.IsOpen())
+        m_packetRecorder.Record(WPacketType::Video, buffer, bufSize);
+    if (m_streamRecorder.IsOpen())
+        m_streamRecorder.Record(WPacketType::Video, buffer, bufSize);
+
+    bool resumedAtKey = false;
+    if (m_videoWaitKey.load(std::memory_order_relaxed)) {
+        if (!IsVideoKeyPacket(m_videoDecoder.codec_name(), buffer, bufSize)) {
+            m_budgetDrops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        m_videoWaitKey = false;
+        resumedAtKey = true;
+    }
+
+    AVPacketPool::UniquePtr packet = m_packetPool.AcquireCopy(buffer, bufSize);
+    if (!packet)
+        return;
     {
         std::lock_guard<std::mutex> lock(m_videoMutex);
-        m_videoQueue.push(std::vector<uint8_t>(buffer, buffer + bufSize));
+        m_videoQueueBytes += PacketBufferBytes(*packet);
+        m_videoQueue.push(std::move(packet));
     }
     m_videoCV.notify_one();
+    EnforceMemoryBudget(resumedAtKey);
 }
 
 void WSDLPlayer::ProcessAudio(uint8_t* buffer, int bufSize)
 {
+    WMK_TRACE_SCOPE("ProcessAudio");
+    if (m_packetRecorder.IsOpen())
+        m_packetRecorder.Record(WPacketType::Audio, buffer, bufSize);
+    if (m_streamRecorder.IsOpen())
+        m_streamRecorder.Record(WPacketType::Audio, buffer, bufSize);
+
+    AVPacketPool::UniquePtr packet = m_packetPool.AcquireCopy(buffer, bufSize);
+    if (!packet)
+        return;
     {
         std::lock_guard<std::mutex> lock(m_audioMutex);
-        m_audioQueue.push(std::vector<uint8_t>(buffer, buffer + bufSize));
+        m_audioQueueBytes += PacketBufferBytes(*packet);
+        m_audioQueue.push(std::move(packet));
     }
     m_audioCV.notify_one();
+    EnforceMemoryBudget();
 }
 
 void WSDLPlayer::RegisterOnDisconnect(OnDisconnect handler)
@@ -112,6 +274,151 @@ void WSDLPlayer::RegisterOnDisconnect(OnDisconnect handler)
     m_onDisconnect = handler;
 }
 
+bool WSDLPlayer::StartPacketCapture(const std::string& path)
+{
+    return m_packetRecorder.Open(path, m_audioDecoder.codec_name(), m_videoDecoder.codec_name());
+}
+
+void WSDLPlayer::StopPacketCapture()
+{
+    m_packetRecorder.Close();
+}
+
+bool WSDLPlayer::StartRecording(const std::string& path, const WStreamRecorder::Options& options)
+{
+    return m_streamRecorder.Open(path, m_audioDecoder.codec_name(), m_videoDecoder.codec_name(), options);
+}
+
+void WSDLPlayer::StopRecording()
+{
+    m_streamRecorder.Close();
+}
+
+int WSDLPlayer::AddVideoSink(WFrameFanout::FrameSink sink)
+{
+    return m_videoFanout.AddSink(std::move(sink));
+}
+
+int WSDLPlayer::AddVideoSink(WFrameFanout::FrameSink sink, const WFrameFanout::SinkOptions& options)
+{
+    return m_videoFanout.AddSink(std::move(sink), options);
+}
+
+void WSDLPlayer::RemoveVideoSink(int id)
+{
+    m_videoFanout.RemoveSink(id);
+}
+
+WSDLPlayer::MemoryUsage WSDLPlayer::GetMemoryUsage() const
+{
+    MemoryUsage usage;
+    usage.name = m_winName;
+    usage.video_packet_bytes = m_videoQueueBytes.load(std::memory_order_relaxed);
+    usage.audio_packet_bytes = m_audioQueueBytes.load(std::memory_order_relaxed);
+    usage.render_frames = m_renderQueueFrames.load(std::memory_order_relaxed);
+    usage.render_frame_bytes = m_renderQueueBytes.load(std::memory_order_relaxed);
+    usage.sdl_audio_bytes = m_sdlQueuedBytes.load(std::memory_order_relaxed);
+    usage.sink_frame_bytes = m_videoFanout.QueuedBytes();
+    usage.decoder_bytes = m_audioDecoder.EstimatedBufferBytes() + m_videoDecoder.EstimatedBufferBytes();
+    usage.budget = m_memoryBudget.load(std::memory_order_relaxed);
+    usage.budget_drops = m_budgetDrops.load(std::memory_order_relaxed);
+    return usage;
+}
+
+std::vector<WSDLPlayer::MemoryUsage> WSDLPlayer::GetProcessMemoryReport()
+{
+    std::vector<MemoryUsage> report;
+    {
+        SessionRegistry& reg = GetSessionRegistry();
+        std::lock_guard<std::mutex> lock(reg.mx);
+        report.reserve(reg.players.size());
+        for (const WSDLPlayer* p : reg.players)
+            report.push_back(p->GetMemoryUsage());
+    }
+    std::sort(report.begin(), report.end(),
+              [](const MemoryUsage& a, const MemoryUsage& b) { return a.Total() > b.Total(); });
+    return report;
+}
+
+size_t WSDLPlayer::MemoryBytes() const
+{
+    return DroppableBytes() + m_audioDecoder.EstimatedBufferBytes() + m_videoDecoder.EstimatedBufferBytes();
+}
+
+size_t WSDLPlayer::DroppableBytes() const
+{
+    return m_videoQueueBytes.load(std::memory_order_relaxed) +
+           m_audioQueueBytes.load(std::memory_order_relaxed) +
+           m_renderQueueBytes.load(std::memory_order_relaxed) +
+           m_sdlQueuedBytes.load(std::memory_order_relaxed) +
+           m_videoFanout.QueuedBytes();
+}
+
+size_t WSDLPlayer::DroppableBudget() const
+{
+    const size_t budget = m_memoryBudget.load(std::memory_order_relaxed);
+    if (budget == 0)
+        return SIZE_MAX;
+    // 解码器的参考帧/线程缓冲丢不掉，先从预算里扣掉，否则会为它把队列清空
+    const size_t decoder = m_audioDecoder.EstimatedBufferBytes() + m_videoDecoder.EstimatedBufferBytes();
+    return budget > decoder ? budget - decoder : 0;
+}
+
+void WSDLPlayer::EnforceMemoryBudget(bool keepNewestVideo)
+{
+    const size_t budget = DroppableBudget();
+    if (DroppableBytes() <= budget)
+        return;
+
+    // 1. 积压的旧画面：实时镜像里本来就该追帧丢掉，sink 队列同理
+    {
+        std::lock_guard<std::mutex> lock(m_renderMutex);
+        m_budgetDrops.fetch_add(TrimRenderQueue(1), std::memory_order_relaxed);
+    }
+    m_budgetDrops.fetch_add(m_videoFanout.Trim(1), std::memory_order_relaxed);
+    if (DroppableBytes() <= budget)
+        return;
+
+    // 2. 最老的音频包。之后只是 SDL 里排队的 PCM 超出时，让音频线程在下次入队前清掉它，
+    //    不为音频去丢视频包
+    {
+        std::lock_guard<std::mutex> lock(m_audioMutex);
+        while (!m_audioQueue.empty() && DroppableBytes() > budget) {
+            m_audioQueueBytes -= PacketBufferBytes(*m_audioQueue.front());
+            m_audioQueue.pop();
+            m_budgetDrops.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    const size_t sdlBytes = m_sdlQueuedBytes.load(std::memory_order_relaxed);
+    const size_t total = DroppableBytes();
+    if (total <= budget)
+        return;
+    if (total - std::min(total, sdlBytes) <= budget) {
+        m_clearSdlAudio = true;
+        return;
+    }
+
+    // 3. 视频包不能挑着丢：全部清空，之后丢到下一个关键帧。
+    //    最新的一个就是刚等到的关键帧时留下它，从它继续解码，不再等下一个
+    {
+        std::lock_guard<std::mutex> lock(m_videoMutex);
+        const size_t keep = keepNewestVideo ? 1 : 0;
+        if (m_videoQueue.size() > keep) {
+            m_budgetDrops.fetch_add(m_videoQueue.size() - keep, std::memory_order_relaxed);
+            while (m_videoQueue.size() > keep) {
+                m_videoQueueBytes -= PacketBufferBytes(*m_videoQueue.front());
+                m_videoQueue.pop();
+            }
+            if (!keep)
+                m_videoWaitKey = true;
+        }
+    }
+
+    // 4. 视频也腾不出来了，最后才丢正在排队播放的声音
+    if (DroppableBytes() > budget)
+        m_clearSdlAudio = true;
+}
+
 void WSDLPlayer::InitAudioDecoder(const std::string& acodec_name)
 {
     if (!HasAudioDecoder() && !acodec_name.empty()) {
@@ -138,39 +445,45 @@ bool WSDLPlayer::HasVideoDecoder() {
 
 void WSDLPlayer::VideoThreadFunc()
 {
+    WMK_TRACE_THREAD_NAME("video decode");
     while (!m_quit) {
-        std::vector<uint8_t> data;
+        AVPacketPool::UniquePtr packet;
         {
+            WMK_TRACE_SCOPE("video queue wait");
             std::unique_lock<std::mutex> lock(m_videoMutex);
             m_videoCV.wait(lock, [this] { return !m_videoQueue.empty() || m_quit; });
             if (!m_videoQueue.empty()) {
-                data = std::move(m_videoQueue.front());
+                packet = std::move(m_videoQueue.front());
                 m_videoQueue.pop();
+                m_videoQueueBytes -= PacketBufferBytes(*packet);
             }
         }
 
-        if (!data.empty()) {
-            m_videoDecoder.Decode(const_cast<uint8_t*>(data.data()), data.size());
+        if (packet && packet->size > 0) {
+            m_videoDecoder.Decode(packet->data, packet->size);
         }
     }
 }
 
 void WSDLPlayer::AudioThreadFunc()
 {
+    WMK_TRACE_THREAD_NAME("audio decode");
     while (!m_quit) {
-        std::vector<uint8_t> data;
+        AVPacketPool::UniquePtr packet;
         {
+            WMK_TRACE_SCOPE("audio queue wait");
             std::unique_lock<std::mutex> lock(m_audioMutex);
             m_audioCV.wait(lock, [this] { return !m_audioQueue.empty() || m_quit; });
 
             if (!m_audioQueue.empty()) {
-                data = std::move(m_audioQueue.front());
+                packet = std::move(m_audioQueue.front());
                 m_audioQueue.pop();
+                m_audioQueueBytes -= PacketBufferBytes(*packet);
             }
         }
 
-        if (!data.empty()) {
-            m_audioDecoder.Decode(const_cast<uint8_t*>(data.data()), data.size());
+        if (packet && packet->size > 0) {
+            m_audioDecoder.Decode(packet->data, packet->size);
         }
     }
 }
@@ -180,29 +493,37 @@ void WSDLPlayer::Render()
     std::lock_guard<std::mutex> lock(m_renderMutex);
 
     if (!m_renderQueue.empty()) {
-        AVFrame* frame = m_renderQueue.front();
+        AVFramePool::UniquePtr frame = std::move(m_renderQueue.front());
         m_renderQueue.pop();
+        m_renderQueueBytes -= AVFrameBufferBytes(*frame);
+        --m_renderQueueFrames;
 
-        SDL_UpdateYUVTexture(m_texture, nullptr,
-            frame->data[0], frame->linesize[0],
-            frame->data[1], frame->linesize[1],
-            frame->data[2], frame->linesize[2]);
+        {
+            WMK_TRACE_SCOPE("texture upload");
+            SDL_UpdateYUVTexture(m_texture, nullptr,
+                frame->data[0], frame->linesize[0],
+                frame->data[1], frame->linesize[1],
+                frame->data[2], frame->linesize[2]);
+        }
 
+        WMK_TRACE_SCOPE("present");
         SDL_RenderClear(m_renderer);
         SDL_RenderCopy(m_renderer, m_texture, nullptr, nullptr);
         SDL_RenderPresent(m_renderer);
-
-        av_frame_free(&frame);
     }
 }
 
-void WSDLPlayer::ClearQueue(std::queue<AVFrame*>& queue)
+size_t WSDLPlayer::TrimRenderQueue(size_t keep)
 {
-    while (!queue.empty()) {
-        AVFrame* frame = queue.front();
-        queue.pop();
-        av_frame_free(&frame);
+    // 出队即归还到 m_framePool
+    size_t dropped = 0;
+    while (m_renderQueue.size() > keep) {
+        m_renderQueueBytes -= AVFrameBufferBytes(*m_renderQueue.front());
+        --m_renderQueueFrames;
+        m_renderQueue.pop();
+        ++dropped;
     }
+    return dropped;
 }
 
 void WSDLPlayer::CreateWindowAndRenderer(int width, int height)
@@ -273,8 +594,10 @@ void WSDLPlayer::HandleEvents()
             if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
                 if (IsEventForWindow(event, m_window)) {
                     m_quit = true;
+                    // 不在渲染线程上回调：回调里常常直接 Stop()/销毁播放器
                     if (m_onDisconnect) {
-                        m_onDisconnect();
+                        OnDisconnect onDisconnect = m_onDisconnect;
+                        WBackgroundRunner::Shared().PostCallback(onDisconnect);
                     }
                 }
             }
@@ -344,22 +667,33 @@ SDL_AudioFormat WSDLPlayer::GetSDLAudioFormat(AVSampleFormat format) {
 
 void WSDLPlayer::OnFrameDecoded(const AVFrame& frame)
 {
+    WMK_TRACE_SCOPE("OnFrameDecoded");
     if (frame.width > 0 && frame.height > 0) { //video
-        std::lock_guard<std::mutex> lock(m_renderMutex);
-        AVFrame* cloneFrame = av_frame_clone(&frame);
-        // create window
-        if (frame.width != m_videoWidth || frame.height != m_videoHeight) {
-            m_videoWidth = frame.width;
-            m_videoHeight = frame.height;
-
-            CreateWindowEvent event;
-            event.w = m_videoWidth;
-            event.h = m_videoHeight;
-            PushCustomEvent(event);
-            ClearQueue(m_renderQueue);
-        }
+        // 不持有 m_renderMutex：各 sink 只是入队一份引用
+        m_videoFanout.Push(frame);
 
-        m_renderQueue.push(cloneFrame);
+        {
+            std::lock_guard<std::mutex> lock(m_renderMutex);
+            AVFramePool::UniquePtr cloneFrame = m_framePool.Acquire();
+            if (!cloneFrame || av_frame_ref(cloneFrame.get(), &frame) < 0)
+                return;
+            // create window
+            if (frame.width != m_videoWidth || frame.height != m_videoHeight) {
+                m_videoWidth = frame.width;
+                m_videoHeight = frame.height;
+
+                CreateWindowEvent event;
+                event.w = m_videoWidth;
+                event.h = m_videoHeight;
+                PushCustomEvent(event);
+                TrimRenderQueue(0);
+            }
+
+            m_renderQueueBytes += AVFrameBufferBytes(*cloneFrame);
+            ++m_renderQueueFrames;
+            m_renderQueue.push(std::move(cloneFrame));
+        }
+        EnforceMemoryBudget();
     }
     else { //audio
         if (m_audioDevice == 0) {
@@ -393,15 +727,22 @@ void WSDLPlayer::OnFrameDecoded(const AVFrame& frame)
             SDL_PauseAudioDevice(m_audioDevice, 0); // resume audio play
 
             // 第一次创建 audio device 时顺便打开 dump 文件
-            if (m_enablePcmDump && !m_pcmDumpFile) {
-                m_pcmDumpFile = fopen("C:\\A_ReservedLand\\alac_dump.pcm", "wb");
-                if (!m_pcmDumpFile) {
+            if (m_enablePcmDump && !m_pcmDump.IsOpen()) {
+                if (!m_pcmDump.Open("C:\\A_ReservedLand\\alac_dump.pcm")) {
                     std::cerr << "Failed to open pcm dump file\n";
                     m_enablePcmDump = false; // 打不开就不要再尝试写了
                 }
             }
         }
 
+        // EnforceMemoryBudget 判定排队的 PCM 该丢时清掉：丢一段声音，积压的延迟也一起追回来
+        m_sdlQueuedBytes = SDL_GetQueuedAudioSize(m_audioDevice);
+        if (m_clearSdlAudio.exchange(false) && m_sdlQueuedBytes > 0) {
+            SDL_ClearQueuedAudio(m_audioDevice);
+            m_sdlQueuedBytes = 0;
+            m_budgetDrops.fetch_add(1, std::memory_order_relaxed);
+        }
+
         int channels = frame.ch_layout.nb_channels;
         int sample_size = av_get_bytes_per_sample((AVSampleFormat)frame.format);  // 每个样本的字节数
         int frame_size = frame.nb_samples;
@@ -432,18 +773,19 @@ void WSDLPlayer::OnFrameDecoded(const AVFrame& frame)
 
             //InterleaveAudioSamples(&frame, interleaved_audio_buffer);
             SDL_QueueAudio(m_audioDevice, interleaved_audio_buffer.data(), interleaved_audio_buffer.size());
+            m_sdlQueuedBytes = SDL_GetQueuedAudioSize(m_audioDevice);
 
             // dump PCM：interleaved_audio_buffer 已经是交错格式
-            if (m_enablePcmDump && m_pcmDumpFile) {
-                fwrite(interleaved_audio_buffer.data(), 1,
-                    interleaved_audio_buffer.size(), m_pcmDumpFile);
+            if (m_enablePcmDump) {
+                m_pcmDump.Write(interleaved_audio_buffer.data(), interleaved_audio_buffer.size());
             }
         }
         else {
             const int bytes = sample_size * frame_size * channels;
             SDL_QueueAudio(m_audioDevice, frame.data[0], bytes);
-            if (m_enablePcmDump && m_pcmDumpFile) {
-                fwrite(frame.data[0], 1, bytes, m_pcmDumpFile);
+            m_sdlQueuedBytes = SDL_GetQueuedAudioSize(m_audioDevice);
+            if (m_enablePcmDump) {
+                m_pcmDump.Write(frame.data[0], bytes);
             }
         }
     }
@@ -0,0 +1,866 @@
+﻿#include "WSegmentCache.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <direct.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+#include <libavutil/sha.h>
+}
+
+namespace wmediakits {
+
+namespace {
+
+constexpr intptr_t kInvalidSocket = -1;
+constexpr size_t   kIoChunk = 64 << 10;
+constexpr size_t   kMaxRequestHeader = 16 << 10;
+// 播放列表不会这么大，超过就当作回源失败，避免把大文件读进内存
+constexpr size_t   kMaxPlaylistBytes = 16 << 20;
+
+const char kProxyPathPrefix[] = "/c/";
+const char kSegmentSuffix[] = ".seg";
+const char kTempSuffix[] = ".tmp";
+
+#ifdef _WIN32
+
+bool SocketInit() {
+    WSADATA wsa{};
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+}
+
+void SocketCleanup() {
+    WSACleanup();
+}
+
+intptr_t ToRaw(SOCKET s) {
+    return s == INVALID_SOCKET ? kInvalidSocket : static_cast<intptr_t>(s);
+}
+
+SOCKET FromRaw(intptr_t s) {
+    return static_cast<SOCKET>(s);
+}
+
+void CloseSocketRaw(intptr_t s) {
+    closesocket(FromRaw(s));
+}
+
+void ShutdownSocketRaw(intptr_t s) {
+    shutdown(FromRaw(s), SD_BOTH);
+}
+
+int SendRaw(intptr_t s, const char* data, size_t size) {
+    return send(FromRaw(s), data, static_cast<int>(std::min<size_t>(size, 1 << 30)), 0);
+}
+
+int64_t FileSeekRaw(FILE* fp, uint64_t offset) {
+    return _fseeki64(fp, static_cast<__int64>(offset), SEEK_SET);
+}
+
+bool MakeDirRaw(const std::string& dir) {
+    return _mkdir(dir.c_str()) == 0 || errno == EEXIST;
+}
+
+// 列出目录下的文件名与大小、修改时间
+struct DirItem {
+    std::string name;
+    uint64_t    size;
+    uint64_t    mtime;
+};
+
+void ListDirRaw(const std::string& dir, std::vector<DirItem>& out) {
+    WIN32_FIND_DATAA fd{};
+    HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+    if (h == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        DirItem item;
+        item.name = fd.cFileName;
+        item.size = (static_cast<uint64_t>(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
+        item.mtime = (static_cast<uint64_t>(fd.ftLastWriteTime.dwHighDateTime) << 32) | fd.ftLastWriteTime.dwLowDateTime;
+        out.push_back(item);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+}
+
+#else
+
+bool SocketInit() {
+    return true;
+}
+
+void SocketCleanup() {
+}
+
+intptr_t ToRaw(int s) {
+    return s < 0 ? kInvalidSocket : static_cast<intptr_t>(s);
+}
+
+int FromRaw(intptr_t s) {
+    return static_cast<int>(s);
+}
+
+void CloseSocketRaw(intptr_t s) {
+    close(FromRaw(s));
+}
+
+void ShutdownSocketRaw(intptr_t s) {
+    shutdown(FromRaw(s), SHUT_RDWR);
+}
+
+int SendRaw(intptr_t s, const char* data, size_t size) {
+#ifdef MSG_NOSIGNAL
+    return static_cast<int>(send(FromRaw(s), data, size, MSG_NOSIGNAL));
+#else
+    return static_cast<int>(send(FromRaw(s), data, size, 0));
+#endif
+}
+
+int64_t FileSeekRaw(FILE* fp, uint64_t offset) {
+    return fseeko(fp, static_cast<off_t>(offset), SEEK_SET);
+}
+
+bool MakeDirRaw(const std::string& dir) {
+    return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+struct DirItem {
+    std::string name;
+    uint64_t    size;
+    uint64_t    mtime;
+};
+
+void ListDirRaw(const std::string& dir, std::vector<DirItem>& out) {
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return;
+    while (struct dirent* e = readdir(d)) {
+        struct stat st {};
+        const std::string name = e->d_name;
+        if (stat((dir + "/" + name).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        DirItem item;
+        item.name = name;
+        item.size = static_cast<uint64_t>(st.st_size);
+        item.mtime = static_cast<uint64_t>(st.st_mtime);
+        out.push_back(item);
+    }
+    closedir(d);
+}
+
+#endif
+
+bool SendAll(intptr_t s, const char* data, size_t size) {
+    while (size > 0) {
+        const int n = SendRaw(s, data, size);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool EndsWith(const std::string& s, const char* suffix) {
+    const size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool StartsWithNoCase(const std::string& s, const char* prefix) {
+    const size_t n = strlen(prefix);
+    if (s.size() < n)
+        return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (tolower(static_cast<unsigned char>(s[i])) != prefix[i])
+            return false;
+    }
+    return true;
+}
+
+bool IsHttpUrl(const std::string& url) {
+    return StartsWithNoCase(url, "http://") || StartsWithNoCase(url, "https://");
+}
+
+// 去掉 ?query 与 #fragment
+std::string StripQuery(const std::string& url) {
+    return url.substr(0, url.find_first_of("?#"));
+}
+
+std::string LastPathComponent(const std::string& url) {
+    const std::string path = StripQuery(url);
+    const size_t scheme = path.find("://");
+    const size_t slash = path.rfind('/');
+    if (slash == std::string::npos || (scheme != std::string::npos && slash < scheme + 3))
+        return std::string();
+    return path.substr(slash + 1);
+}
+
+bool LooksLikePlaylistUrl(const std::string& url) {
+    std::string name = LastPathComponent(url);
+    std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+    return EndsWith(name, ".m3u8") || EndsWith(name, ".m3u");
+}
+
+bool IsPlaylistBody(const char* data, size_t size) {
+    // 可能带 UTF-8 BOM
+    if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+        data += 3;
+        size -= 3;
+    }
+    return size >= 7 && memcmp(data, "#EXTM3U", 7) == 0;
+}
+
+std::string ToHex(const uint8_t* data, size_t size) {
+    static const char kDigits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(size * 2);
+    for (size_t i = 0; i < size; ++i) {
+        out += kDigits[data[i] >> 4];
+        out += kDigits[data[i] & 15];
+    }
+    return out;
+}
+
+bool FromHex(const std::string& hex, std::string& out) {
+    if (hex.size() % 2)
+        return false;
+    out.clear();
+    out.reserve(hex.size() / 2);
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int v = 0;
+        for (size_t j = i; j < i + 2; ++j) {
+            const char c = hex[j];
+            v <<= 4;
+            if (c >= '0' && c <= '9')      v |= c - '0';
+            else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+            else return false;
+        }
+        out += static_cast<char>(v);
+    }
+    return true;
+}
+
+// 按 RFC 3986 的常见情形把相对地址解析成绝对地址（不处理 ../ 归一化，交给服务器）
+std::string ResolveUrl(const std::string& base, const std::string& ref) {
+    if (ref.find("://") != std::string::npos)
+        return ref;
+    const size_t scheme = base.find("://");
+    if (scheme == std::string::npos)
+        return ref;
+    if (ref.compare(0, 2, "//") == 0)
+        return base.substr(0, scheme + 1) + ref;
+
+    const size_t hostEnd = base.find_first_of("/?#", scheme + 3);
+    const std::string origin = base.substr(0, hostEnd);
+    if (!ref.empty() && ref[0] == '/')
+        return origin + ref;
+
+    const std::string path = StripQuery(base);
+    const size_t slash = path.rfind('/');
+    if (slash == std::string::npos || slash < scheme + 3)
+        return origin + "/" + ref;
+    return path.substr(0, slash + 1) + ref;
+}
+
+// 解析 "Range: bytes=a-" / "bytes=a-b"，不支持多段与 "bytes=-n"
+bool ParseRange(const std::string& headers, uint64_t& first, uint64_t& last, bool& hasLast) {
+    size_t pos = 0;
+    while ((pos = headers.find('\n', pos)) != std::string::npos) {
+        ++pos;
+        const std::string line = headers.substr(pos, headers.find('\n', pos) - pos);
+        if (!StartsWithNoCase(line, "range:"))
+            continue;
+        const size_t eq = line.find("bytes=");
+        if (eq == std::string::npos)
+            return false;
+        const char* p = line.c_str() + eq + 6;
+        char* end = nullptr;
+        first = strtoull(p, &end, 10);
+        if (end == p || *end != '-')
+            return false;
+        p = end + 1;
+        hasLast = *p >= '0' && *p <= '9';
+        if (hasLast)
+            last = strtoull(p, nullptr, 10);
+        return true;
+    }
+    return false;
+}
+
+std::string ResponseHeader(int status, const char* reason, const char* type, uint64_t length,
+                           uint64_t first, uint64_t last, uint64_t total) {
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %llu\r\n"
+                     "Accept-Ranges: bytes\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "Connection: close\r\n",
+                     status, reason, type, (unsigned long long)length);
+    if (status == 206 && n > 0 && n < (int)sizeof(buf)) {
+        n += snprintf(buf + n, sizeof(buf) - n, "Content-Range: bytes %llu-%llu/%llu\r\n",
+                      (unsigned long long)first, (unsigned long long)last, (unsigned long long)total);
+    }
+    std::string out(buf, std::min<size_t>(n > 0 ? n : 0, sizeof(buf) - 1));
+    out += "\r\n";
+    return out;
+}
+
+void SendStatus(intptr_t s, int status, const char* reason) {
+    const std::string h = ResponseHeader(status, reason, "text/plain", 0, 0, 0, 0);
+    SendAll(s, h.data(), h.size());
+}
+
+}  // namespace
+
+WSegmentCache::WSegmentCache(const Options& options)
+    : m_opt(options)
+{
+}
+
+WSegmentCache::~WSegmentCache()
+{
+    Stop();
+}
+
+bool WSegmentCache::Start()
+{
+    if (m_running.load())
+        return true;
+    if (m_opt.dir.empty() || !MakeDirRaw(m_opt.dir)) {
+        fprintf(stderr, "WSegmentCache: cannot use cache dir '%s'\n", m_opt.dir.c_str());
+        return false;
+    }
+    if (!SocketInit())
+        return false;
+
+    scanDir();
+
+    // 只监听回环地址，端口由系统分配
+    const intptr_t s = ToRaw(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (s == kInvalidSocket ||
+        bind(FromRaw(s), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(FromRaw(s), 64) != 0 ||
+        getsockname(FromRaw(s), reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        fprintf(stderr, "WSegmentCache: cannot listen on loopback\n");
+        if (s != kInvalidSocket)
+            CloseSocketRaw(s);
+        SocketCleanup();
+        return false;
+    }
+
+    m_listen = s;
+    m_port = ntohs(addr.sin_port);
+    m_quit.store(false);
+    m_running.store(true);
+    m_acceptThread = std::thread(&WSegmentCache::acceptLoop, this);
+    return true;
+}
+
+void WSegmentCache::Stop()
+{
+    if (!m_running.load())
+        return;
+    m_quit.store(true);
+    if (m_acceptThread.joinable())
+        m_acceptThread.join();
+    CloseSocketRaw(m_listen);
+    m_listen = kInvalidSocket;
+
+    // 打断正在收发的连接；回源中的下载由中断回调结束
+    std::list<Conn> conns;
+    {
+        std::lock_guard<std::mutex> lk(m_connMx);
+        for (Conn& c : m_conns)
+            ShutdownSocketRaw(c.sock);
+        conns.swap(m_conns);
+    }
+    m_cv.notify_all();
+    for (Conn& c : conns) {
+        c.thread.join();
+        CloseSocketRaw(c.sock);
+    }
+
+    SocketCleanup();
+    m_port = 0;
+    m_running.store(false);
+}
+
+std::string WSegmentCache::ProxyUrl(const std::string& url) const
+{
+    if (!m_running.load() || !IsHttpUrl(url) || !LooksLikePlaylistUrl(url))
+        return url;
+    return proxyUrlFor(url);
+}
+
+std::string WSegmentCache::proxyUrlFor(const std::string& url) const
+{
+    // 末尾保留原文件名：lavf 的 hls 会按扩展名核对分片格式
+    std::string name = LastPathComponent(url);
+    for (char& c : name) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-' && c != '_')
+            c = '_';
+    }
+    if (name.empty())
+        name = "index";
+
+    char origin[64];
+    snprintf(origin, sizeof(origin), "http://127.0.0.1:%u", (unsigned)m_port);
+    return std::string(origin) + kProxyPathPrefix +
+           ToHex(reinterpret_cast<const uint8_t*>(url.data()), url.size()) + "/" + name;
+}
+
+WSegmentCache::Stats WSegmentCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lk(m_mx);
+    Stats s = m_stats;
+    s.entries = m_entries.size();
+    return s;
+}
+
+std::string WSegmentCache::KeyFor(const std::string& url) const
+{
+    const std::string id = m_opt.ignore_query ? StripQuery(url) : url;
+    uint8_t digest[32] = {};
+    struct AVSHA* sha = av_sha_alloc();
+    if (sha) {
+        av_sha_init(sha, 256);
+        av_sha_update(sha, reinterpret_cast<const uint8_t*>(id.data()), static_cast<unsigned>(id.size()));
+        av_sha_final(sha, digest);
+        av_free(sha);
+    }
+    return ToHex(digest, sizeof(digest));
+}
+
+std::string WSegmentCache::entryPath(const std::string& key) const
+{
+#ifdef _WIN32
+    return m_opt.dir + "\\" + key + kSegmentSuffix;
+#else
+    return m_opt.dir + "/" + key + kSegmentSuffix;
+#endif
+}
+
+void WSegmentCache::scanDir()
+{
+    std::vector<DirItem> items;
+    ListDirRaw(m_opt.dir, items);
+    // 旧到新加入，最近修改的排在 LRU 最前
+    std::sort(items.begin(), items.end(), [](const DirItem& a, const DirItem& b) { return a.mtime < b.mtime; });
+
+    std::lock_guard<std::mutex> lk(m_mx);
+    for (const DirItem& item : items) {
+        if (EndsWith(item.name, kTempSuffix)) {
+            // 上次退出时没下完的
+            remove((m_opt.dir + "/" + item.name).c_str());
+            continue;
+        }
+        const std::string key = item.name.substr(0, item.name.size() - (sizeof(kSegmentSuffix) - 1));
+        if (!EndsWith(item.name, kSegmentSuffix) || key.size() != 64 || m_entries.count(key))
+            continue;
+        Entry& e = m_entries[key];
+        e.size = item.size;
+        e.ready = true;
+        m_lru.push_front(key);
+        e.lru = m_lru.begin();
+        m_stats.bytes_on_disk += item.size;
+    }
+    evictLocked();
+}
+
+void WSegmentCache::evictLocked()
+{
+    // 从最久没用的开始删，跳过正在读/正在下载的
+    auto it = m_lru.end();
+    while (m_stats.bytes_on_disk > m_opt.max_bytes && it != m_lru.begin()) {
+        --it;
+        auto e = m_entries.find(*it);
+        if (e == m_entries.end() || e->second.pins > 0 || !e->second.ready)
+            continue;
+        remove(entryPath(*it).c_str());
+        m_stats.bytes_on_disk -= e->second.size;
+        ++m_stats.evictions;
+        m_entries.erase(e);
+        it = m_lru.erase(it);
+    }
+}
+
+void WSegmentCache::acceptLoop()
+{
+    while (!m_quit.load()) {
+        // 回收已结束的连接
+        std::list<Conn> finished;
+        {
+            std::lock_guard<std::mutex> lk(m_connMx);
+            for (auto it = m_conns.begin(); it != m_conns.end();) {
+                auto cur = it++;
+                if (cur->done)
+                    finished.splice(finished.end(), m_conns, cur);
+            }
+        }
+        for (Conn& c : finished) {
+            c.thread.join();
+            CloseSocketRaw(c.sock);
+        }
+
+        // 带超时等连接，好及时看到 m_quit
+        fd_set rd;
+        FD_ZERO(&rd);
+        FD_SET(FromRaw(m_listen), &rd);
+        timeval tv{};
+        tv.tv_usec = 200 * 1000;
+        if (select(static_cast<int>(m_listen) + 1, &rd, nullptr, nullptr, &tv) <= 0)
+            continue;
+        const intptr_t s = ToRaw(accept(FromRaw(m_listen), nullptr, nullptr));
+        if (s == kInvalidSocket)
+            continue;
+
+        std::lock_guard<std::mutex> lk(m_connMx);
+        m_conns.emplace_back();
+        Conn& c = m_conns.back();
+        c.sock = s;
+        Conn* conn = &c;
+        c.thread = std::thread([this, conn, s] {
+            serve(s);
+            std::lock_guard<std::mutex> lk(m_connMx);
+            conn->done = true;
+        });
+    }
+}
+
+void WSegmentCache::serve(intptr_t sock)
+{
+    // 读请求头
+    std::string req;
+    char buf[4096];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+        const int n = static_cast<int>(recv(FromRaw(sock), buf, sizeof(buf), 0));
+        if (n <= 0 || req.size() + n > kMaxRequestHeader)
+            return;
+        req.append(buf, n);
+    }
+
+    const bool head = req.compare(0, 5, "HEAD ") == 0;
+    if (!head && req.compare(0, 4, "GET ") != 0) {
+        SendStatus(sock, 405, "Method Not Allowed");
+        return;
+    }
+    const size_t pathStart = req.find(' ') + 1;
+    const std::string path = req.substr(pathStart, req.find(' ', pathStart) - pathStart);
+    const size_t prefix = sizeof(kProxyPathPrefix) - 1;
+    std::string url;
+    if (path.compare(0, prefix, kProxyPathPrefix) != 0 ||
+        !FromHex(path.substr(prefix, path.find('/', prefix) - prefix), url) || !IsHttpUrl(url)) {
+        SendStatus(sock, 404, "Not Found");
+        return;
+    }
+
+    // 取内容：播放列表直接回源，分片走磁盘缓存
+    std::string key, memory, location;
+    uint64_t size = 0;
+    FetchResult r = kFetchFailed;
+    if (LooksLikePlaylistUrl(url)) {
+        r = download(url, std::string(), memory, size, location);
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_stats.bytes_fetched += size;
+    } else {
+        r = acquire(url, key, size, memory, location);
+    }
+    if (r == kFetchFailed) {
+        SendStatus(sock, 502, "Bad Gateway");
+        return;
+    }
+
+    const bool playlist = r == kFetchMemory && IsPlaylistBody(memory.data(), memory.size());
+    if (playlist)
+        memory = rewritePlaylist(memory, location);
+    if (r == kFetchMemory)
+        size = memory.size();
+
+    FILE* fp = nullptr;
+    if (r == kFetchFile) {
+        fp = fopen(entryPath(key).c_str(), "rb");
+        if (!fp) {
+            release(key);
+            SendStatus(sock, 500, "Internal Server Error");
+            return;
+        }
+    }
+
+    uint64_t first = 0, last = size ? size - 1 : 0;
+    bool hasLast = false;
+    const bool ranged = ParseRange(req, first, last, hasLast);
+    if (!hasLast || last >= size)
+        last = size ? size - 1 : 0;
+    bool ok = true;
+    if (ranged && size > 0 && first >= size) {
+        SendStatus(sock, 416, "Range Not Satisfiable");
+        ok = false;
+    }
+
+    const char* type = playlist ? "application/vnd.apple.mpegurl" : "application/octet-stream";
+    const uint64_t length = size ? last - first + 1 : 0;
+    if (ok) {
+        const std::string h = ranged && size > 0
+            ? ResponseHeader(206, "Partial Content", type, length, first, last, size)
+            : ResponseHeader(200, "OK", type, size, 0, 0, 0);
+        if (!ranged)
+            first = 0;
+        ok = SendAll(sock, h.data(), h.size()) && !head;
+    }
+
+    uint64_t sent = 0;
+    if (ok && fp) {
+        std::vector<char> chunk(kIoChunk);
+        ok = FileSeekRaw(fp, first) == 0;
+        while (ok && sent < length && !m_quit.load()) {
+            const size_t want = static_cast<size_t>(std::min<uint64_t>(chunk.size(), length - sent));
+            const size_t n = fread(chunk.data(), 1, want, fp);
+            ok = n > 0 && SendAll(sock, chunk.data(), n);
+            sent += n;
+        }
+    } else if (ok) {
+        ok = SendAll(sock, memory.data() + first, static_cast<size_t>(length));
+        if (ok)
+            sent = length;
+    }
+
+    if (fp) {
+        fclose(fp);
+        release(key);
+    }
+    std::lock_guard<std::mutex> lk(m_mx);
+    m_stats.bytes_served += sent;
+}
+
+WSegmentCache::FetchResult WSegmentCache::acquire(const std::string& url, std::string& key, uint64_t& size,
+                                                  std::string& memory, std::string& location)
+{
+    key = KeyFor(url);
+    std::unique_lock<std::mutex> lk(m_mx);
+    for (;;) {
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+            break;
+        if (it->second.ready) {
+            Entry& e = it->second;
+            ++e.pins;
+            ++m_stats.hits;
+            m_lru.splice(m_lru.begin(), m_lru, e.lru);
+            size = e.size;
+            return kFetchFile;
+        }
+        // 别的连接正在下同一个分片，等它下完；下载失败（或内容其实是播放列表）时条目被移除，由自己重新取
+        m_cv.wait(lk);
+        if (m_quit.load())
+            return kFetchFailed;
+    }
+
+    // 占位：之后同 key 的请求等这次下载
+    ++m_stats.misses;
+    Entry& placeholder = m_entries[key];
+    placeholder.pins = 1;
+    m_lru.push_front(key);
+    placeholder.lru = m_lru.begin();
+    lk.unlock();
+
+    const std::string finalPath = entryPath(key);
+    const std::string tmpPath = finalPath.substr(0, finalPath.size() - (sizeof(kSegmentSuffix) - 1)) + kTempSuffix;
+    FetchResult r = download(url, tmpPath, memory, size, location);
+    if (r == kFetchFile) {
+        // Windows 上 rename 不覆盖已有文件
+        remove(finalPath.c_str());
+        if (rename(tmpPath.c_str(), finalPath.c_str()) != 0) {
+            remove(tmpPath.c_str());
+            r = kFetchFailed;
+        }
+    }
+
+    lk.lock();
+    auto it = m_entries.find(key);
+    m_stats.bytes_fetched += size;
+    if (r == kFetchFile) {
+        it->second.ready = true;
+        it->second.size = size;
+        m_stats.bytes_on_disk += size;
+        evictLocked();
+    } else {
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
+    lk.unlock();
+    m_cv.notify_all();
+    return r;
+}
+
+void WSegmentCache::release(const std::string& key)
+{
+    std::lock_guard<std::mutex> lk(m_mx);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return;
+    --it->second.pins;
+    // 读的过程中可能已经超了上限（被 pin 住的没法删）
+    evictLocked();
+}
+
+int WSegmentCache::interruptCallback(void* opaque)
+{
+    return static_cast<WSegmentCache*>(opaque)->m_quit.load() ? 1 : 0;
+}
+
+WSegmentCache::FetchResult WSegmentCache::download(const std::string& url, const std::string& tmpPath,
+                                                   std::string& memory, uint64_t& size, std::string& location)
+{
+    size = 0;
+    memory.clear();
+    location = url;
+
+    AVDictionary* opts = nullptr;
+    char timeout[32];
+    snprintf(timeout, sizeof(timeout), "%lld", (long long)m_opt.timeout_ms * 1000);
+    av_dict_set(&opts, "rw_timeout", timeout, 0);
+    av_dict_set(&opts, "reconnect", "1", 0);
+    AVIOInterruptCB cb = { &WSegmentCache::interruptCallback, this };
+    AVIOContext* io = nullptr;
+    const int err = avio_open2(&io, url.c_str(), AVIO_FLAG_READ, &cb, &opts);
+    av_dict_free(&opts);
+    if (err < 0) {
+        char msg[128] = {};
+        av_strerror(err, msg, sizeof(msg));
+        fprintf(stderr, "WSegmentCache: fetch %s failed: %s\n", url.c_str(), msg);
+        return kFetchFailed;
+    }
+
+    std::vector<unsigned char> chunk(kIoChunk);
+    FILE* fp = nullptr;
+    bool toMemory = tmpPath.empty();
+    bool first = true;
+    bool ok = true;
+    for (;;) {
+        const int n = avio_read(io, chunk.data(), static_cast<int>(chunk.size()));
+        if (n == AVERROR_EOF || n == 0)
+            break;
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        if (first) {
+            // 扩展名不是 .m3u8 的子播放列表：不落盘，改写后返回
+            first = false;
+            toMemory = toMemory || IsPlaylistBody(reinterpret_cast<const char*>(chunk.data()), n);
+            if (!toMemory) {
+                fp = fopen(tmpPath.c_str(), "wb");
+                if (!fp) {
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        size += n;
+        if (toMemory) {
+            if (memory.size() + n > kMaxPlaylistBytes) {
+                ok = false;
+                break;
+            }
+            memory.append(reinterpret_cast<const char*>(chunk.data()), n);
+        } else if (fwrite(chunk.data(), 1, n, fp) != static_cast<size_t>(n)) {
+            ok = false;
+            break;
+        }
+    }
+    // 跟随重定向后的最终地址（http 协议的 location 选项），播放列表里的相对地址要相对它解析
+    uint8_t* loc = nullptr;
+    if (av_opt_get(io, "location", AV_OPT_SEARCH_CHILDREN, &loc) >= 0 && loc) {
+        if (IsHttpUrl(reinterpret_cast<const char*>(loc)))
+            location = reinterpret_cast<const char*>(loc);
+        av_free(loc);
+    }
+    avio_closep(&io);
+    if (fp)
+        ok = fclose(fp) == 0 && ok;
+
+    if (!ok) {
+        if (fp)
+            remove(tmpPath.c_str());
+        memory.clear();
+        return kFetchFailed;
+    }
+    // 空响应也当作内存内容，不建缓存条目
+    return fp ? kFetchFile : kFetchMemory;
+}
+
+std::string WSegmentCache::rewritePlaylist(const std::string& body, const std::string& baseUrl) const
+{
+    std::string out;
+    out.reserve(body.size() * 2);
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t end = body.find('\n', pos);
+        if (end == std::string::npos)
+            end = body.size();
+        std::string line = body.substr(pos, end - pos);
+        pos = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.empty()) {
+        } else if (line[0] != '#') {
+            // 分片或子播放列表
+            const std::string abs = ResolveUrl(baseUrl, line);
+            line = IsHttpUrl(abs) ? proxyUrlFor(abs) : abs;
+        } else {
+            const size_t uri = line.find("URI=\"");
+            const size_t valueStart = uri + 5;
+            const size_t valueEnd = uri == std::string::npos ? uri : line.find('"', valueStart);
+            if (valueEnd != std::string::npos) {
+                const std::string abs = ResolveUrl(baseUrl, line.substr(valueStart, valueEnd - valueStart));
+                // 解密密钥只补全地址、不经过缓存，不把它写到磁盘上
+                const bool key = line.compare(0, 11, "#EXT-X-KEY:") == 0 ||
+                                 line.compare(0, 19, "#EXT-X-SESSION-KEY:") == 0;
+                line.replace(valueStart, valueEnd - valueStart, key || !IsHttpUrl(abs) ? abs : proxyUrlFor(abs));
+            }
+        }
+        out += line;
+        out += '\n';
+    }
+    return out;
+}
+
+}  // namespace wmediakits
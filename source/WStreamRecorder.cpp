@@ -0,0 +1,484 @@
+﻿#include "WStreamRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <utility>
+
+#include "WDecoder.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+namespace wmediakits {
+
+namespace {
+
+const AVRational kMicroseconds = { 1, 1000000 };
+const AVRational kVideoTimeBase = { 1, 90000 };
+constexpr int kOpusSampleRate = 48000;
+constexpr int kAlacFrameSize = 352;
+
+bool NeedsParameterSets(AVCodecID id) {
+    return id == AV_CODEC_ID_H264 || id == AV_CODEC_ID_HEVC;
+}
+
+// 下一个 00 00 01 起始码的位置，没有时返回 size
+int FindStartCode(const uint8_t* data, int from, int size) {
+    for (int i = from; i + 3 <= size; ++i) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+            return i;
+    }
+    return size;
+}
+
+// 从 Annex B 数据里取出参数集（h264: SPS/PPS，hevc: VPS/SPS/PPS），带起始码拼成 extradata，
+// 封装器会自己转成 avcC/hvcC
+bool ExtractParameterSets(AVCodecID id, const uint8_t* data, int size, std::vector<uint8_t>& out) {
+    static const uint8_t kStartCode[4] = { 0, 0, 0, 1 };
+    out.clear();
+    int start = FindStartCode(data, 0, size);
+    while (start < size) {
+        const int nal = start + 3;
+        const int next = FindStartCode(data, nal, size);
+        // 四字节起始码的前导 0 算在上一个 NAL 末尾，去掉
+        int end = next;
+        while (end > nal && data[end - 1] == 0)
+            --end;
+        if (end > nal) {
+            const int type = id == AV_CODEC_ID_H264 ? (data[nal] & 0x1f) : ((data[nal] >> 1) & 0x3f);
+            const bool ps = id == AV_CODEC_ID_H264 ? (type == 7 || type == 8) : (type >= 32 && type <= 34);
+            if (ps) {
+                out.insert(out.end(), kStartCode, kStartCode + sizeof(kStartCode));
+                out.insert(out.end(), data + nal, data + end);
+            }
+        }
+        start = next;
+    }
+    return !out.empty();
+}
+
+// RFC 7845 的 OpusHead：立体声、48kHz、映射族 0
+std::vector<uint8_t> MakeOpusHead(int channels) {
+    std::vector<uint8_t> head(19, 0);
+    memcpy(head.data(), "OpusHead", 8);
+    head[8] = 1;                         // version
+    head[9] = static_cast<uint8_t>(channels);
+    head[10] = 312 & 0xff;               // pre-skip（libopus 默认）
+    head[11] = 312 >> 8;
+    head[12] = kOpusSampleRate & 0xff;
+    head[13] = (kOpusSampleRate >> 8) & 0xff;
+    head[14] = (kOpusSampleRate >> 16) & 0xff;
+    head[15] = (kOpusSampleRate >> 24) & 0xff;
+    return head;
+}
+
+bool SetExtradata(AVCodecParameters* par, const std::vector<uint8_t>& data) {
+    if (data.empty())
+        return true;
+    par->extradata = static_cast<uint8_t*>(av_mallocz(data.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+    if (!par->extradata)
+        return false;
+    memcpy(par->extradata, data.data(), data.size());
+    par->extradata_size = static_cast<int>(data.size());
+    return true;
+}
+
+void PrintAvError(const char* what, const std::string& path, int err) {
+    char msg[AV_ERROR_MAX_STRING_SIZE] = {};
+    av_strerror(err, msg, sizeof(msg));
+    fprintf(stderr, "WStreamRecorder: %s %s failed: %s\n", what, path.c_str(), msg);
+}
+
+}  // namespace
+
+WStreamRecorder::WStreamRecorder()
+{
+}
+
+WStreamRecorder::~WStreamRecorder()
+{
+    Close();
+}
+
+bool WStreamRecorder::Open(const std::string& path, const std::string& acodec_name, const std::string& vcodec_name)
+{
+    return Open(path, acodec_name, vcodec_name, Options());
+}
+
+bool WStreamRecorder::Open(const std::string& path, const std::string& acodec_name, const std::string& vcodec_name,
+                           const Options& options)
+{
+    Close();
+
+    m_opt = options;
+    m_path = path;
+    m_video = Track();
+    m_audio = Track();
+    m_hasVideo = false;
+    m_hasAudio = false;
+    m_fileIndex = 0;
+
+    // 视频要靠 parser 分帧、判断关键帧和拿到分辨率
+    if (!vcodec_name.empty()) {
+        const AVCodec* codec = avcodec_find_decoder_by_name(vcodec_name.c_str());
+        if (codec) {
+            m_parser = MakeUniqueAVCodecParserContext(codec->id);
+            m_parserCtx = MakeUniqueAVCodecContext(nullptr);
+        }
+        if (codec && m_parser && m_parserCtx) {
+            m_video.codec_id = codec->id;
+            m_hasVideo = true;
+        } else {
+            fprintf(stderr, "WStreamRecorder: cannot record video codec %s\n", vcodec_name.c_str());
+        }
+    }
+
+    // 裸音频帧没有带外配置，只支持能补出 extradata 的几种
+    if (GetAirPlayAudioConfig(acodec_name, &m_audio.extradata, &m_audio.sample_rate, &m_audio.channels)) {
+        m_audio.codec_id = acodec_name == "alac" ? AV_CODEC_ID_ALAC : AV_CODEC_ID_AAC;
+        m_hasAudio = true;
+    } else if (acodec_name == "opus") {
+        m_audio.codec_id = AV_CODEC_ID_OPUS;
+        m_audio.sample_rate = kOpusSampleRate;
+        m_audio.channels = 2;
+        m_audio.extradata = MakeOpusHead(m_audio.channels);
+        m_hasAudio = true;
+    } else if (!acodec_name.empty()) {
+        fprintf(stderr, "WStreamRecorder: cannot record audio codec %s\n", acodec_name.c_str());
+    }
+
+    m_outPacket = MakeUniqueAVPacket();
+    if ((!m_hasVideo && !m_hasAudio) || !m_outPacket)
+        return false;
+
+    m_packets.store(0, std::memory_order_relaxed);
+    m_dropped.store(0, std::memory_order_relaxed);
+    m_files.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_closing = false;
+    }
+    m_start = std::chrono::steady_clock::now();
+    m_open.store(true);
+    m_thread = std::thread(&WStreamRecorder::threadFunc, this);
+    return true;
+}
+
+void WStreamRecorder::Close()
+{
+    if (!m_open.exchange(false))
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        m_closing = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_parser.reset();
+    m_parserCtx.reset();
+    m_outPacket.reset();
+}
+
+bool WStreamRecorder::Record(WPacketType type, const uint8_t* data, int size)
+{
+    if (!IsOpen() || size <= 0)
+        return false;
+
+    AVPacketPool::UniquePtr packet = m_packetPool.AcquireCopy(data, size);
+    if (!packet) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    packet->pts = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_start).count();
+    packet->stream_index = static_cast<int>(type);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mx);
+        // 积压太多时丢包（视频丢包后到下一个关键帧之前会花屏，但不会阻塞调用方）
+        if (m_closing || m_queueBytes + size > m_opt.max_queue_bytes) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_queueBytes += size;
+        m_queue.push_back(std::move(packet));
+    }
+    m_cv.notify_one();
+    m_packets.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void WStreamRecorder::threadFunc()
+{
+    for (;;) {
+        AVPacketPool::UniquePtr packet;
+        {
+            std::unique_lock<std::mutex> lock(m_mx);
+            m_cv.wait(lock, [this] { return m_closing || !m_queue.empty(); });
+            // 关闭时把已入队的写完再退出
+            if (m_queue.empty())
+                break;
+            packet = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_queueBytes -= packet->size;
+        }
+
+        if (packet->stream_index == static_cast<int>(WPacketType::Video)) {
+            if (m_hasVideo)
+                handleVideo(std::move(packet));
+        } else if (m_hasAudio) {
+            writeAudio(packet->data, packet->size, packet->pts);
+        }
+    }
+
+    // parser 里还压着最后一帧
+    if (m_hasVideo) {
+        uint8_t* out = nullptr;
+        int outSize = 0;
+        av_parser_parse2(m_parser.get(), m_parserCtx.get(), &out, &outSize, nullptr, 0,
+                         AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (outSize > 0) {
+            const int64_t pts = m_parser->pts != AV_NOPTS_VALUE ? m_parser->pts : m_video.last_arrival;
+            writeVideoFrame(out, outSize, m_parser->key_frame == 1, pts);
+        }
+    }
+    closeFile();
+}
+
+void WStreamRecorder::handleVideo(AVPacketPool::UniquePtr packet)
+{
+    const uint8_t* data = packet->data;
+    int size = packet->size;
+    while (size > 0) {
+        uint8_t* out = nullptr;
+        int outSize = 0;
+        const int used = av_parser_parse2(m_parser.get(), m_parserCtx.get(), &out, &outSize, data, size,
+                                          packet->pts, packet->pts, 0);
+        if (used < 0)
+            break;
+        data += used;
+        size -= used;
+        if (outSize > 0) {
+            // parser 输出的帧带的是它第一个字节所在输入包的时间戳
+            const int64_t pts = m_parser->pts != AV_NOPTS_VALUE ? m_parser->pts : packet->pts;
+            writeVideoFrame(out, outSize, m_parser->key_frame == 1, pts);
+        }
+    }
+    m_video.last_arrival = packet->pts;
+}
+
+void WStreamRecorder::writeVideoFrame(const uint8_t* data, int size, bool key, int64_t arrivalUs)
+{
+    // 参数集可能单独成包，也可能跟在关键帧前面；记下最新的一份
+    std::vector<uint8_t> ps;
+    if (NeedsParameterSets(m_video.codec_id) && ExtractParameterSets(m_video.codec_id, data, size, ps))
+        m_video.extradata.swap(ps);
+
+    if (key) {
+        const int w = m_parser->width > 0 ? m_parser->width : m_parserCtx->width;
+        const int h = m_parser->height > 0 ? m_parser->height : m_parserCtx->height;
+        if (w > 0 && h > 0) {
+            m_video.width = w;
+            m_video.height = h;
+        }
+    }
+
+    if (!m_fmt) {
+        // 从第一个能独立解码的关键帧开始
+        if (!key || m_video.width <= 0 || (NeedsParameterSets(m_video.codec_id) && m_video.extradata.empty()))
+            return;
+        if (!openFile(arrivalUs))
+            return;
+    } else if (key) {
+        // 分辨率/参数集变了（镜像时转屏），MP4 的轨道配置不能中途改：换一个文件
+        const AVCodecParameters* par = m_video.stream->codecpar;
+        const bool changed = par->width != m_video.width || par->height != m_video.height ||
+                             par->extradata_size != static_cast<int>(m_video.extradata.size()) ||
+                             (par->extradata_size > 0 &&
+                              memcmp(par->extradata, m_video.extradata.data(), par->extradata_size) != 0);
+        if (changed || shouldRotate(arrivalUs)) {
+            closeFile();
+            if (!openFile(arrivalUs))
+                return;
+        }
+    }
+    writePacket(m_video, data, size, key, arrivalUs);
+}
+
+void WStreamRecorder::writeAudio(const uint8_t* data, int size, int64_t arrivalUs)
+{
+    if (!m_fmt) {
+        // 有视频时等视频关键帧开文件，之前的音频丢掉
+        if (m_hasVideo || !openFile(arrivalUs))
+            return;
+    } else if (!m_hasVideo && shouldRotate(arrivalUs)) {
+        closeFile();
+        if (!openFile(arrivalUs))
+            return;
+    }
+    if (arrivalUs < m_fileStartUs)
+        return;
+    writePacket(m_audio, data, size, true, arrivalUs);
+}
+
+bool WStreamRecorder::writePacket(Track& track, const uint8_t* data, int size, bool key, int64_t arrivalUs)
+{
+    AVStream* st = track.stream;
+    int64_t dts = av_rescale_q(arrivalUs - m_fileStartUs, kMicroseconds, st->time_base);
+    // 到达时间可能相同或抖回去，保证单调
+    if (track.written && dts <= track.last_dts)
+        dts = track.last_dts + 1;
+    track.last_dts = dts;
+    track.written = true;
+
+    AVPacket* pkt = m_outPacket.get();
+    pkt->data = const_cast<uint8_t*>(data);
+    pkt->size = size;
+    pkt->stream_index = st->index;
+    pkt->flags = key ? AV_PKT_FLAG_KEY : 0;
+    pkt->pts = dts;
+    pkt->dts = dts;
+    // 已按到达（时间）顺序交错，直接写出，不在封装器里排队
+    const int err = av_write_frame(m_fmt, pkt);
+    av_packet_unref(pkt);
+    if (err < 0) {
+        PrintAvError("write", m_filePath, err);
+        return false;
+    }
+    return true;
+}
+
+bool WStreamRecorder::openFile(int64_t arrivalUs)
+{
+    m_filePath = nextPath();
+    int err = avformat_alloc_output_context2(&m_fmt, nullptr, m_opt.format.empty() ? nullptr : m_opt.format.c_str(),
+                                             m_filePath.c_str());
+    if (err < 0 || !m_fmt) {
+        PrintAvError("create muxer for", m_filePath, err);
+        m_fmt = nullptr;
+        return false;
+    }
+
+    bool ok = true;
+    if (m_hasVideo) {
+        AVStream* st = avformat_new_stream(m_fmt, nullptr);
+        ok = st && SetExtradata(st->codecpar, m_video.extradata);
+        if (ok) {
+            AVCodecParameters* par = st->codecpar;
+            par->codec_type = AVMEDIA_TYPE_VIDEO;
+            par->codec_id = m_video.codec_id;
+            par->width = m_video.width;
+            par->height = m_video.height;
+            st->time_base = kVideoTimeBase;
+        }
+        m_video.stream = st;
+    }
+    if (ok && m_hasAudio) {
+        AVStream* st = avformat_new_stream(m_fmt, nullptr);
+        ok = st && SetExtradata(st->codecpar, m_audio.extradata);
+        if (ok) {
+            AVCodecParameters* par = st->codecpar;
+            par->codec_type = AVMEDIA_TYPE_AUDIO;
+            par->codec_id = m_audio.codec_id;
+            par->sample_rate = m_audio.sample_rate;
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+            av_channel_layout_default(&par->ch_layout, m_audio.channels);
+#else
+            par->channels = m_audio.channels;
+#endif
+            if (m_audio.codec_id == AV_CODEC_ID_ALAC)
+                par->frame_size = kAlacFrameSize;
+            st->time_base = AVRational{ 1, m_audio.sample_rate };
+        }
+        m_audio.stream = st;
+    }
+
+    if (ok && !(m_fmt->oformat->flags & AVFMT_NOFILE)) {
+        err = avio_open(&m_fmt->pb, m_filePath.c_str(), AVIO_FLAG_WRITE);
+        if (err < 0) {
+            PrintAvError("open", m_filePath, err);
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        AVDictionary* opts = nullptr;
+        char value[32];
+        // 每次写出都落到文件里，崩溃时最多丢最后一个分片
+        av_dict_set(&opts, "flush_packets", "1", 0);
+        const char* name = m_fmt->oformat->name;
+        if (m_opt.fragmented && (strstr(name, "mp4") || strstr(name, "mov"))) {
+            av_dict_set(&opts, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+            snprintf(value, sizeof(value), "%lld", (long long)m_opt.fragment_ms * 1000);
+            av_dict_set(&opts, "frag_duration", value, 0);
+        } else if (strstr(name, "matroska") || strstr(name, "webm")) {
+            snprintf(value, sizeof(value), "%d", m_opt.fragment_ms);
+            av_dict_set(&opts, "cluster_time_limit", value, 0);
+        }
+        err = avformat_write_header(m_fmt, &opts);
+        av_dict_free(&opts);
+        if (err < 0) {
+            PrintAvError("write header of", m_filePath, err);
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        if (m_fmt->pb)
+            avio_closep(&m_fmt->pb);
+        avformat_free_context(m_fmt);
+        m_fmt = nullptr;
+        return false;
+    }
+
+    m_fileStartUs = arrivalUs;
+    m_video.written = false;
+    m_audio.written = false;
+    m_files.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void WStreamRecorder::closeFile()
+{
+    if (!m_fmt)
+        return;
+    av_write_trailer(m_fmt);
+    if (m_fmt->pb)
+        avio_closep(&m_fmt->pb);
+    avformat_free_context(m_fmt);
+    m_fmt = nullptr;
+    m_video.stream = nullptr;
+    m_audio.stream = nullptr;
+
+    if (m_onFileClosed)
+        m_onFileClosed(m_filePath);
+}
+
+bool WStreamRecorder::shouldRotate(int64_t arrivalUs) const
+{
+    if (m_opt.rotate_bytes > 0 && m_fmt->pb && static_cast<uint64_t>(avio_tell(m_fmt->pb)) >= m_opt.rotate_bytes)
+        return true;
+    return m_opt.rotate_seconds > 0 && arrivalUs - m_fileStartUs >= m_opt.rotate_seconds * 1000000LL;
+}
+
+std::string WStreamRecorder::nextPath()
+{
+    // 不切文件时第一个文件就用原路径；之后（参数集变化换文件）和开了切文件时都带序号
+    const uint32_t index = m_fileIndex++;
+    const bool numbered = m_opt.rotate_bytes > 0 || m_opt.rotate_seconds > 0;
+    if (!numbered && index == 0)
+        return m_path;
+
+    const size_t slash = m_path.find_last_of("/\\");
+    const size_t dot = m_path.rfind('.');
+    const size_t split = (dot == std::string::npos || (slash != std::string::npos && dot < slash)) ? m_path.size() : dot;
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%03u", index);
+    return m_path.substr(0, split) + suffix + m_path.substr(split);
+}
+
+}  // namespace wmediakits
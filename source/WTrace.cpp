@@ -0,0 +1,268 @@
+﻿#include "WTrace.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace wmediakits {
+
+std::atomic<bool> WTrace::s_enabled{ false };
+
+#ifdef WMEDIAKITS_ENABLE_TRACE
+
+namespace {
+
+// 每个线程最多保留的事件数（每条 24 字节），满了覆盖最老的
+constexpr uint64_t kEventsPerThread = 16384;
+// 已退出线程的缓冲最多留这么多个（最近退出的），其余在有新线程开始记录时释放
+constexpr size_t kMaxExitedBuffers = 8;
+
+struct TraceEvent {
+    const char* name;
+    int64_t     startUs;
+    int64_t     durUs;
+};
+
+// 单写（所属线程）多读（导出）：写线程填好槽位后再 release 递增 head，
+// 导出时读完再看一次 head，期间可能被覆盖的槽位丢弃
+struct ThreadBuffer {
+    uint32_t    tid = 0;
+    std::string name;                       // 受 Registry::mx 保护
+    std::atomic<uint64_t> head{ 0 };
+    std::atomic<uint64_t> clearedAt{ 0 };   // Clear() 时的 head，之前的不再导出
+    std::atomic<uint64_t> exitedAt{ 0 };    // 退出顺序，0 表示还在运行
+    std::vector<TraceEvent> events;
+};
+
+struct Registry {
+    std::mutex mx;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint32_t nextTid = 1;
+    std::atomic<uint64_t> exitSeq{ 0 };
+};
+
+Registry& GetRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+// 线程退出时只做标记，缓冲之后还能导出，由 PruneExitedLocked()/Clear() 释放。
+// 缓冲在第一次 Record() 时才分配；之前 SetThreadName() 的名字先记在 name 里
+struct LocalBuffer {
+    std::shared_ptr<ThreadBuffer> buffer;
+    std::string name;
+    ~LocalBuffer()
+    {
+        if (buffer)
+            buffer->exitedAt.store(GetRegistry().exitSeq.fetch_add(1) + 1, std::memory_order_relaxed);
+    }
+};
+
+thread_local LocalBuffer t_local;
+
+// 持 reg.mx：已退出的缓冲只留最近的 kMaxExitedBuffers 个
+void PruneExitedLocked(Registry& reg)
+{
+    std::vector<uint64_t> exited;
+    for (const std::shared_ptr<ThreadBuffer>& b : reg.buffers) {
+        const uint64_t at = b->exitedAt.load(std::memory_order_relaxed);
+        if (at)
+            exited.push_back(at);
+    }
+    if (exited.size() <= kMaxExitedBuffers)
+        return;
+    std::nth_element(exited.begin(), exited.end() - kMaxExitedBuffers, exited.end());
+    const uint64_t keepFrom = *(exited.end() - kMaxExitedBuffers);
+    reg.buffers.erase(
+        std::remove_if(reg.buffers.begin(), reg.buffers.end(),
+                       [keepFrom](const std::shared_ptr<ThreadBuffer>& b) {
+                           const uint64_t at = b->exitedAt.load(std::memory_order_relaxed);
+                           return at != 0 && at < keepFrom;
+                       }),
+        reg.buffers.end());
+}
+
+ThreadBuffer* GetLocalBuffer()
+{
+    if (!t_local.buffer) {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        buffer->events.resize(kEventsPerThread);
+        Registry& reg = GetRegistry();
+        std::lock_guard<std::mutex> lock(reg.mx);
+        PruneExitedLocked(reg);
+        buffer->tid = reg.nextTid++;
+        buffer->name.swap(t_local.name);
+        reg.buffers.push_back(buffer);
+        t_local.buffer = std::move(buffer);
+    }
+    return t_local.buffer.get();
+}
+
+void WriteJsonString(FILE* fp, const char* s)
+{
+    fputc('"', fp);
+    for (; *s; ++s) {
+        const unsigned char c = static_cast<unsigned char>(*s);
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+}  // namespace
+
+void WTrace::SetEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void WTrace::SetThreadName(const char* name)
+{
+    // 没在记录的线程不为它分配缓冲，名字等第一次 Record() 时带上
+    if (!t_local.buffer) {
+        t_local.name = name ? name : "";
+        return;
+    }
+    std::lock_guard<std::mutex> lock(GetRegistry().mx);
+    t_local.buffer->name = name ? name : "";
+}
+
+int64_t WTrace::NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void WTrace::Record(const char* name, int64_t startUs, int64_t endUs)
+{
+    ThreadBuffer* buffer = GetLocalBuffer();
+    const uint64_t h = buffer->head.load(std::memory_order_relaxed);
+    TraceEvent& e = buffer->events[h % kEventsPerThread];
+    e.name = name;
+    e.startUs = startUs;
+    e.durUs = endUs - startUs;
+    buffer->head.store(h + 1, std::memory_order_release);
+}
+
+bool WTrace::WriteChromeJson(const std::string& path)
+{
+    struct Snapshot {
+        uint32_t    tid;
+        std::string name;
+        std::vector<TraceEvent> events;
+    };
+    std::vector<Snapshot> snapshots;
+    {
+        Registry& reg = GetRegistry();
+        std::lock_guard<std::mutex> lock(reg.mx);
+        snapshots.reserve(reg.buffers.size());
+        for (const std::shared_ptr<ThreadBuffer>& buffer : reg.buffers) {
+            Snapshot snap;
+            snap.tid = buffer->tid;
+            snap.name = buffer->name;
+
+            const uint64_t end = buffer->head.load(std::memory_order_acquire);
+            uint64_t begin = end > kEventsPerThread ? end - kEventsPerThread : 0;
+            begin = std::max(begin, buffer->clearedAt.load(std::memory_order_relaxed));
+            for (uint64_t i = begin; i < end; ++i)
+                snap.events.push_back(buffer->events[i % kEventsPerThread]);
+
+            // 拷贝期间写线程又写了 after - end 条（第 after 条可能正在写），
+            // 比 after + 1 - kEventsPerThread 老的槽位都可能已被覆盖
+            const uint64_t after = buffer->head.load(std::memory_order_acquire);
+            const uint64_t valid = after + 1 > kEventsPerThread ? after + 1 - kEventsPerThread : 0;
+            if (valid > begin) {
+                const size_t stale = static_cast<size_t>(std::min<uint64_t>(valid - begin, snap.events.size()));
+                snap.events.erase(snap.events.begin(), snap.events.begin() + stale);
+            }
+            snapshots.push_back(std::move(snap));
+        }
+    }
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", fp);
+    bool first = true;
+    for (const Snapshot& snap : snapshots) {
+        if (!snap.name.empty()) {
+            fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",\n", snap.tid);
+            WriteJsonString(fp, snap.name.c_str());
+            fputs("}}", fp);
+            first = false;
+        }
+        for (const TraceEvent& e : snap.events) {
+            fprintf(fp, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld,\"name\":",
+                    first ? "" : ",\n", snap.tid,
+                    static_cast<long long>(e.startUs), static_cast<long long>(e.durUs));
+            WriteJsonString(fp, e.name);
+            fputc('}', fp);
+            first = false;
+        }
+    }
+    fputs("\n]}\n", fp);
+
+    const bool ok = !ferror(fp);
+    return fclose(fp) == 0 && ok;
+}
+
+void WTrace::Clear()
+{
+    Registry& reg = GetRegistry();
+    std::lock_guard<std::mutex> lock(reg.mx);
+    for (const std::shared_ptr<ThreadBuffer>& buffer : reg.buffers)
+        buffer->clearedAt.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    reg.buffers.erase(
+        std::remove_if(reg.buffers.begin(), reg.buffers.end(),
+                       [](const std::shared_ptr<ThreadBuffer>& b) { return b->exitedAt.load(std::memory_order_relaxed) != 0; }),
+        reg.buffers.end());
+}
+
+#else  // !WMEDIAKITS_ENABLE_TRACE
+
+void WTrace::SetEnabled(bool enabled)
+{
+    (void)enabled;
+}
+
+void WTrace::SetThreadName(const char* name)
+{
+    (void)name;
+}
+
+int64_t WTrace::NowUs()
+{
+    return 0;
+}
+
+void WTrace::Record(const char* name, int64_t startUs, int64_t endUs)
+{
+    (void)name;
+    (void)startUs;
+    (void)endUs;
+}
+
+bool WTrace::WriteChromeJson(const std::string& path)
+{
+    (void)path;
+    return false;
+}
+
+void WTrace::Clear()
+{
+}
+
+#endif // WMEDIAKITS_ENABLE_TRACE
+
+}  // namespace wmediakits
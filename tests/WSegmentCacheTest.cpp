@@ -0,0 +1,478 @@
+﻿// WSegmentCache 的端到端测试：本机起一个假的源站（HTTP/1.1，支持 302），
+// 经缓存代理取播放列表和分片，覆盖播放列表改写（含重定向后的相对地址）、Range、
+// 单次回源（single-flight）和 LRU 淘汰。
+//
+// 与 WMediaKits 及 FFmpeg（avformat、avutil，需带 http 协议）一起编译成控制台程序
+// （Windows 上用同目录的 WSegmentCacheTest.vcxproj），不需要外网；全部通过时返回 0。
+// 其他平台：g++ -std=c++14 -Iinclude tests/WSegmentCacheTest.cpp source/WSegmentCache.cpp
+//          -lavformat -lavutil -pthread
+#include "WSegmentCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET Socket;
+#define CloseSocket closesocket
+#else
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int Socket;
+#define CloseSocket close
+#endif
+
+using namespace wmediakits;
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_failures;                                                    \
+        }                                                                    \
+    } while (0)
+
+Socket ConnectLoopback(uint16_t port)
+{
+    Socket s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        CloseSocket(s);
+        return static_cast<Socket>(-1);
+    }
+    return s;
+}
+
+void SendString(Socket s, const std::string& data)
+{
+    size_t off = 0;
+    while (off < data.size()) {
+        const int n = static_cast<int>(send(s, data.data() + off, static_cast<int>(data.size() - off), 0));
+        if (n <= 0)
+            return;
+        off += static_cast<size_t>(n);
+    }
+}
+
+// 假源站：路径 -> 内容或重定向目标，记录每个路径被请求的次数
+class Origin {
+public:
+    struct Route {
+        std::string body;
+        std::string redirect;  // 非空时回 302
+        int         delayMs = 0;
+    };
+
+    bool Start()
+    {
+        m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(m_listen, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(m_listen, 64) != 0 ||
+            getsockname(m_listen, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+            return false;
+        m_port = ntohs(addr.sin_port);
+        m_thread = std::thread([this] { acceptLoop(); });
+        return true;
+    }
+
+    void Stop()
+    {
+        m_quit.store(true);
+        // 连一下自己，让 accept 返回
+        Socket s = ConnectLoopback(m_port);
+        if (s != static_cast<Socket>(-1))
+            CloseSocket(s);
+        m_thread.join();
+        CloseSocket(m_listen);
+        for (std::thread& t : m_workers)
+            t.join();
+    }
+
+    std::string Url(const std::string& path) const
+    {
+        return "http://127.0.0.1:" + std::to_string(m_port) + path;
+    }
+
+    void Set(const std::string& path, const Route& route)
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        m_routes[path] = route;
+    }
+
+    int Hits(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lk(m_mx);
+        return m_hits[path];
+    }
+
+private:
+    void acceptLoop()
+    {
+        for (;;) {
+            Socket s = accept(m_listen, nullptr, nullptr);
+            if (m_quit.load()) {
+                if (s != static_cast<Socket>(-1))
+                    CloseSocket(s);
+                return;
+            }
+            if (s == static_cast<Socket>(-1))
+                continue;
+            m_workers.emplace_back([this, s] { serve(s); });
+        }
+    }
+
+    void serve(Socket s)
+    {
+        std::string req;
+        char buf[4096];
+        while (req.find("\r\n\r\n") == std::string::npos) {
+            const int n = static_cast<int>(recv(s, buf, sizeof(buf), 0));
+            if (n <= 0)
+                break;
+            req.append(buf, n);
+        }
+        const size_t start = req.find(' ') + 1;
+        const std::string path = req.substr(start, req.find(' ', start) - start);
+
+        Route route;
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> lk(m_mx);
+            ++m_hits[path];
+            auto it = m_routes.find(path);
+            if (it != m_routes.end()) {
+                route = it->second;
+                found = true;
+            }
+        }
+        if (route.delayMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(route.delayMs));
+
+        std::string resp;
+        if (!found) {
+            resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        } else if (!route.redirect.empty()) {
+            resp = "HTTP/1.1 302 Found\r\nLocation: " + route.redirect +
+                   "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        } else {
+            resp = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: " +
+                   std::to_string(route.body.size()) + "\r\nConnection: close\r\n\r\n" + route.body;
+        }
+        SendString(s, resp);
+        CloseSocket(s);
+    }
+
+    Socket            m_listen = static_cast<Socket>(-1);
+    uint16_t          m_port = 0;
+    std::atomic<bool> m_quit{ false };
+    std::thread       m_thread;
+    std::vector<std::thread> m_workers;  // 只在 accept 线程上追加，Stop() 时 join
+
+    std::mutex m_mx;
+    std::map<std::string, Route> m_routes;
+    std::map<std::string, int>   m_hits;
+};
+
+struct Response {
+    int         status = 0;
+    std::string headers;
+    std::string body;
+};
+
+Response Get(uint16_t port, const std::string& path, const std::string& extraHeaders = std::string())
+{
+    Response r;
+    Socket s = ConnectLoopback(port);
+    if (s == static_cast<Socket>(-1))
+        return r;
+    SendString(s, "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n" + extraHeaders + "\r\n");
+    std::string all;
+    char buf[16384];
+    int n;
+    while ((n = static_cast<int>(recv(s, buf, sizeof(buf), 0))) > 0)
+        all.append(buf, n);
+    CloseSocket(s);
+
+    const size_t end = all.find("\r\n\r\n");
+    if (end == std::string::npos)
+        return r;
+    r.headers = all.substr(0, end);
+    r.body = all.substr(end + 4);
+    r.status = atoi(all.c_str() + all.find(' ') + 1);
+    return r;
+}
+
+// 代理地址 http://127.0.0.1:port/c/<hex(url)>/name 的路径部分
+std::string PathOf(const std::string& url)
+{
+    return url.substr(url.find('/', url.find("://") + 3));
+}
+
+// 从代理地址还原原地址
+std::string OriginalUrl(const std::string& proxyUrl)
+{
+    const std::string path = PathOf(proxyUrl);
+    const size_t begin = path.find("/c/") + 3;
+    const std::string hex = path.substr(begin, path.find('/', begin) - begin);
+    std::string out;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        out += static_cast<char>(strtol(hex.substr(i, 2).c_str(), nullptr, 16));
+    return out;
+}
+
+std::vector<std::string> Lines(const std::string& body)
+{
+    std::vector<std::string> out;
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t end = body.find('\n', pos);
+        if (end == std::string::npos)
+            end = body.size();
+        out.push_back(body.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return out;
+}
+
+std::string MakeSegment(size_t size, int seed)
+{
+    std::string s(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+        s[i] = static_cast<char>((i * 131 + seed * 7) & 0xff);
+    return s;
+}
+
+std::string TempDir()
+{
+#ifdef _WIN32
+    char base[MAX_PATH] = {};
+    GetTempPathA(MAX_PATH, base);
+    return std::string(base) + "wmk_segment_cache_test_" + std::to_string(GetCurrentProcessId());
+#else
+    return "/tmp/wmk_segment_cache_test_" + std::to_string(getpid());
+#endif
+}
+
+// 缓存目录是平铺的一层文件，删掉文件再删目录
+void RemoveDir(const std::string& dir)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+    if (h != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                DeleteFileA((dir + "\\" + fd.cFileName).c_str());
+        } while (FindNextFileA(h, &fd));
+        FindClose(h);
+    }
+    RemoveDirectoryA(dir.c_str());
+#else
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* e = readdir(d)) {
+            if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+                unlink((dir + "/" + e->d_name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+#endif
+}
+
+// 分片的代理路径：/c/<hex(url)>/文件名
+std::string SegmentPath(const Origin& origin, const std::string& originPath)
+{
+    const std::string url = origin.Url(originPath);
+    std::string hex;
+    char b[3];
+    for (unsigned char c : url) {
+        snprintf(b, sizeof(b), "%02x", c);
+        hex += b;
+    }
+    return "/c/" + hex + originPath.substr(originPath.rfind('/'));
+}
+
+void TestPlaylistRewrite(WSegmentCache& cache, Origin& origin)
+{
+    // 入口地址 302 到 CDN 上的另一个目录，相对地址必须相对重定向后的地址解析
+    Origin::Route redirect;
+    redirect.redirect = origin.Url("/cdn/v1/index.m3u8");
+    origin.Set("/live/index.m3u8", redirect);
+    Origin::Route playlist;
+    playlist.body =
+        "#EXTM3U\n"
+        "#EXT-X-KEY:METHOD=AES-128,URI=\"key.bin\"\n"
+        "#EXT-X-MAP:URI=\"init.mp4\"\n"
+        "#EXTINF:2,\n"
+        "seg1.ts\n"
+        "#EXTINF:2,\n"
+        "/abs/seg2.ts?tok=1\n";
+    origin.Set("/cdn/v1/index.m3u8", playlist);
+
+    const std::string proxied = cache.ProxyUrl(origin.Url("/live/index.m3u8"));
+    CHECK(proxied != origin.Url("/live/index.m3u8"));
+    CHECK(cache.ProxyUrl(origin.Url("/movie.mp4")) == origin.Url("/movie.mp4"));
+
+    const Response r = Get(cache.Port(), PathOf(proxied));
+    CHECK(r.status == 200);
+    const std::vector<std::string> lines = Lines(r.body);
+    CHECK(lines.size() == 7);
+    if (lines.size() != 7)
+        return;
+    // 密钥只补全地址，不经过缓存
+    CHECK(lines[1] == "#EXT-X-KEY:METHOD=AES-128,URI=\"" + origin.Url("/cdn/v1/key.bin") + "\"");
+    const size_t uri = lines[2].find("URI=\"") + 5;
+    CHECK(OriginalUrl(lines[2].substr(uri, lines[2].size() - 1 - uri)) == origin.Url("/cdn/v1/init.mp4"));
+    CHECK(OriginalUrl(lines[4]) == origin.Url("/cdn/v1/seg1.ts"));
+    CHECK(OriginalUrl(lines[6]) == origin.Url("/abs/seg2.ts?tok=1"));
+    // 保留原文件名
+    CHECK(lines[4].size() > 8 && lines[4].compare(lines[4].size() - 8, 8, "/seg1.ts") == 0);
+}
+
+void TestRange(WSegmentCache& cache, Origin& origin)
+{
+    const std::string seg = MakeSegment(300000, 1);
+    Origin::Route route;
+    route.body = seg;
+    origin.Set("/range/seg.ts", route);
+    const std::string segPath = SegmentPath(origin, "/range/seg.ts");
+
+    Response r = Get(cache.Port(), segPath);
+    CHECK(r.status == 200 && r.body == seg);
+
+    r = Get(cache.Port(), segPath, "Range: bytes=100-199\r\n");
+    CHECK(r.status == 206);
+    CHECK(r.body == seg.substr(100, 100));
+    CHECK(r.headers.find("Content-Range: bytes 100-199/300000") != std::string::npos);
+
+    r = Get(cache.Port(), segPath, "Range: bytes=299990-\r\n");
+    CHECK(r.status == 206 && r.body == seg.substr(299990));
+
+    r = Get(cache.Port(), segPath, "Range: bytes=400000-\r\n");
+    CHECK(r.status == 416);
+
+    // 全部由缓存提供，只回源一次
+    CHECK(origin.Hits("/range/seg.ts") == 1);
+}
+
+void TestSingleFlight(WSegmentCache& cache, Origin& origin)
+{
+    const std::string seg = MakeSegment(200000, 2);
+    Origin::Route route;
+    route.body = seg;
+    route.delayMs = 300;  // 让并发请求都赶上同一次回源
+    origin.Set("/sf/seg.ts", route);
+    const std::string path = SegmentPath(origin, "/sf/seg.ts");
+
+    std::vector<Response> results(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < results.size(); ++i)
+        threads.emplace_back([&, i] { results[i] = Get(cache.Port(), path); });
+    for (std::thread& t : threads)
+        t.join();
+
+    for (const Response& r : results)
+        CHECK(r.status == 200 && r.body == seg);
+    CHECK(origin.Hits("/sf/seg.ts") == 1);
+}
+
+void TestEviction(const std::string& dir, Origin& origin)
+{
+    const size_t kSegBytes = 100000;
+    WSegmentCache::Options opt;
+    opt.dir = dir + "_lru";
+    opt.max_bytes = kSegBytes * 5 / 2;  // 放得下两个分片
+    WSegmentCache cache(opt);
+    CHECK(cache.Start());
+
+    for (int i = 0; i < 3; ++i) {
+        Origin::Route route;
+        route.body = MakeSegment(kSegBytes, 10 + i);
+        origin.Set("/lru/seg" + std::to_string(i) + ".ts", route);
+    }
+    for (int i = 0; i < 3; ++i) {
+        const std::string p = "/lru/seg" + std::to_string(i) + ".ts";
+        CHECK(Get(cache.Port(), SegmentPath(origin, p)).body == MakeSegment(kSegBytes, 10 + i));
+    }
+
+    const WSegmentCache::Stats st = cache.GetStats();
+    CHECK(st.evictions == 1);
+    CHECK(st.entries == 2);
+    CHECK(st.bytes_on_disk <= opt.max_bytes);
+
+    // 最久没用的 seg0 被淘汰，再取要回源；seg2 仍命中
+    CHECK(Get(cache.Port(), SegmentPath(origin, "/lru/seg2.ts")).body == MakeSegment(kSegBytes, 12));
+    CHECK(origin.Hits("/lru/seg2.ts") == 1);
+    CHECK(Get(cache.Port(), SegmentPath(origin, "/lru/seg0.ts")).body == MakeSegment(kSegBytes, 10));
+    CHECK(origin.Hits("/lru/seg0.ts") == 2);
+    cache.Stop();
+}
+
+}  // namespace
+
+int main()
+{
+#ifdef _WIN32
+    WSADATA wsa{};
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+    Origin origin;
+    if (!origin.Start()) {
+        fprintf(stderr, "cannot start origin\n");
+        return 1;
+    }
+
+    const std::string dir = TempDir();
+    WSegmentCache::Options opt;
+    opt.dir = dir;
+    WSegmentCache cache(opt);
+    CHECK(cache.Start());
+
+    TestPlaylistRewrite(cache, origin);
+    TestRange(cache, origin);
+    TestSingleFlight(cache, origin);
+    cache.Stop();
+    TestEviction(dir, origin);
+
+    origin.Stop();
+    RemoveDir(dir);
+    RemoveDir(dir + "_lru");
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    if (g_failures) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("WSegmentCacheTest: all passed\n");
+    return 0;
+}